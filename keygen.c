@@ -1,39 +1,297 @@
-/**************************************************************** 
+/****************************************************************
 * Author: Nicholas Schaffner
-* Last Modified: 08/25/20
-* Description: This program creates a key file of specified length. The characters in the file generated are any of
-*               the 27 allowed characters(A-Z and ' ') and are generated using the standard UNIX randomization methods.
-*               The last character this program outputs is a newline. The syntax for this program is:
-*               keygen keylength
-*               keylength is the length of the key file in characters. This program outputs to stdout.
+* Last Modified: 10/17/26
+* Description: This program creates a key file of specified length. The characters in the file generated are any of the
+*               27 allowed characters(A-Z and ' ') and are drawn without bias from a ChaCha20 keystream that is keyed
+*               by the kernel's getrandom() (see otp_random.h), so two keys never repeat even when they are made in the
+*               same second. The last character this program outputs is a newline. The syntax for this program is:
+*               keygen [-j N] [-o file] [--binary] keylength
+*               keylength is the length of the key file in characters. This program outputs to stdout unless -o is
+*               given. The key is generated in blocks of KEYGEN_BLOCK_SIZE characters, each from its own ChaCha20
+*               stream, and written with large writes. With -j N, N threads generate blocks in parallel while the main
+*               thread writes them out in order. With -o file, the file is preallocated to its full size and mapped
+*               into memory, and the threads generate their blocks straight into the mapping, so there is no pipe and
+*               no second copy. On a filesystem that cannot preallocate, the blocks are written to the file with pwrite
+*               instead, so a full disk is an error rather than a SIGBUS. Either way the file is flushed to disk before
+*               keygen exits, and a write-back error removes it and sets the exit value to 1. With --binary (or -b),
+*               the key is keylength raw bytes straight from the keystream, every byte value equally likely, with no
+*               trailing newline, for the binary mode of otp_enc and otp_dec. A device or a pipe given as -o, such as
+*               /dev/null, is written to in order like stdout.
 ****************************************************************/
 
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include <stdio.h>
-#include <string.h>
 #include <stdlib.h>
-#include <time.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "otp_random.h"
+
+#define KEYGEN_BLOCK_SIZE (1 << 20)                                             /* Characters generated per block and per write */
+
+struct keygenSlot{                                                              /* A block buffer handed back and forth between a generator thread and the writer */
+    char* data;
+    size_t length;
+    sem_t filled;                                                               /* Posted by the generator once data holds its block */
+    sem_t empty;                                                                /* Posted by the writer once data has been written out */
+};
+
+struct keygenJob{
+    unsigned char key[OTP_RANDOM_KEY_SIZE];
+    unsigned long long keyLength;
+    unsigned long long blockCount;
+    int threads;
+    int binary;                                                                 /* Raw bytes instead of the 27 characters */
+    struct keygenSlot* slots;                                                   /* Two slots per thread so a thread can fill one while the other is written */
+    char* map;                                                                  /* Mapping of the -o file, NULL when the blocks are written out */
+    int outputFD;                                                               /* stdout, or the -o file */
+    const char* outputPath;                                                     /* NULL for stdout */
+    int seekable;                                                               /* The -o file is a regular file or a block device, written at each block's offset */
+};
+
+struct keygenThread{
+    struct keygenJob* job;
+    int index;
+};
+
+static void usage(void){
+    fprintf(stderr, "USAGE: keygen [-j N] [-o file] [--binary] keylength\n");
+    exit(1);
+}
+
+static size_t blockLength(const struct keygenJob* job, unsigned long long block){   /* Every block is full except possibly the last one */
+    unsigned long long start = block * KEYGEN_BLOCK_SIZE;
+    return job->keyLength - start < KEYGEN_BLOCK_SIZE ? job->keyLength - start : KEYGEN_BLOCK_SIZE;
+}
+
+static void fillBlock(const struct keygenJob* job, struct otpRandom* random, char* out, size_t length){
+    if(job->binary){
+        otpRandomBytes(random, (unsigned char*)out, length);
+    }
+    else{
+        otpRandomAlphabet(random, out, length);
+    }
+}
+
+static void* generateBlocks(void* argument){                                    /* Thread t generates blocks t, t + N, t + 2N, ... */
+    struct keygenThread* self = argument;
+    struct keygenJob* job = self->job;
+    struct otpRandom random;
+    unsigned long long block;
+    unsigned long long round = 0;
+
+    if(job->map != NULL){                                                       /* Blocks are disjoint regions of the mapping, no hand-off needed */
+        for(block = self->index; block < job->blockCount; block += job->threads){
+            otpRandomInit(&random, job->key, block);
+            fillBlock(job, &random, job->map + block * KEYGEN_BLOCK_SIZE, blockLength(job, block));
+        }
+        return NULL;
+    }
+
+    for(block = self->index; block < job->blockCount; block += job->threads, round++){
+        struct keygenSlot* slot = &job->slots[2 * self->index + round % 2];
+
+        sem_wait(&slot->empty);
+        otpRandomInit(&random, job->key, block);                                /* Block b always comes from stream b, whatever thread runs it */
+        slot->length = blockLength(job, block);
+        fillBlock(job, &random, slot->data, slot->length);
+        sem_post(&slot->filled);
+    }
+
+    return NULL;
+}
+
+static void outputFailed(const struct keygenJob* job, const char* what){      /* Report an output error and exit, leaving no partial -o file behind */
+    struct stat status;
+
+    if(job->outputPath != NULL){
+        fprintf(stderr, "keygen: could not %s %s: %s\n", what, job->outputPath, strerror(errno));
+        if(fstat(job->outputFD, &status) == 0 && S_ISREG(status.st_mode)){     /* Never a device or a pipe given as the output */
+            unlink(job->outputPath);
+        }
+    }
+    else{
+        fprintf(stderr, "keygen: could not %s stdout: %s\n", what, strerror(errno));
+    }
+    exit(1);
+}
+
+static void writeAll(const struct keygenJob* job, const char* data, size_t length, unsigned long long offset){    /* offset is used for a seekable -o file only, stdout may be a pipe */
+    ssize_t written;
+
+    while(length > 0){
+        if(job->seekable){
+            written = pwrite(job->outputFD, data, length, offset);
+        }
+        else{
+            written = write(job->outputFD, data, length);
+        }
+        if(written < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            outputFailed(job, "write");
+        }
+        data += written;
+        length -= written;
+        offset += written;
+    }
+}
+
+static void openOutput(struct keygenJob* job, unsigned long long size){        /* Create the -o file, mapped with size bytes reserved on disk when the filesystem allows it */
+    struct stat status;
+
+    job->outputFD = open(job->outputPath, O_RDWR | O_CREAT | O_TRUNC, 0600);  /* Key material, readable by the owner only */
+    if(job->outputFD < 0){
+        fprintf(stderr, "keygen: could not open %s: %s\n", job->outputPath, strerror(errno));
+        exit(1);
+    }
+    if(fstat(job->outputFD, &status) != 0){
+        outputFailed(job, "stat");
+    }
+    job->seekable = S_ISREG(status.st_mode) || S_ISBLK(status.st_mode);
+    if(!S_ISREG(status.st_mode)){                                               /* A device or a pipe such as /dev/null, written to like stdout */
+        return;
+    }
+    if(fallocate(job->outputFD, 0, 0, size) != 0){                             /* Reserve every block up front so the fill cannot hit ENOSPC through SIGBUS */
+        if(errno != EOPNOTSUPP && errno != ENODEV && errno != ESPIPE){
+            outputFailed(job, "allocate space for");
+        }
+        return;                                                                 /* Without reserved blocks a sparse mapping could SIGBUS, write the blocks instead */
+    }
+
+    job->map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, job->outputFD, 0);
+    if(job->map == MAP_FAILED){
+        job->map = NULL;
+        outputFailed(job, "map");
+    }
+}
+
+static void closeOutput(struct keygenJob* job, unsigned long long size){       /* Flush the -o file to disk so write-back errors are reported, not lost */
+    if(job->map != NULL){
+        if(msync(job->map, size, MS_SYNC) != 0){
+            outputFailed(job, "write");
+        }
+        munmap(job->map, size);
+    }
+    if((job->seekable && fsync(job->outputFD) != 0) || close(job->outputFD) != 0){  /* Character devices and pipes cannot be synced */
+        outputFailed(job, "write");
+    }
+}
 
 int main(int argc, char *argv[]){
-    int currentIntValue;                                        /* Variable to hold the current integer value that is generated by rand() */
-    int i = 0;                  
-    char currentChar;                                           /* Variable to hold the current ASCII char equivalent to the integer value generated by rand() */
+    static struct option longOptions[] = {
+        {"binary", no_argument, NULL, 'b'},
+        {NULL, 0, NULL, 0}
+    };
+    struct keygenJob job;
+    struct keygenThread* threadArguments;
+    pthread_t* threadIds;
+    unsigned long long block;
+    int option, i;
+    char* end;
 
-    srand(time(0));                                             /* Use the current time as the seed for the random generator */
+    job.outputPath = NULL;
+    job.threads = 1;
+    job.map = NULL;
+    job.binary = 0;
+    job.outputFD = STDOUT_FILENO;
+    job.seekable = 0;
+    while((option = getopt_long(argc, argv, "j:o:b", longOptions, NULL)) != -1){
+        if(option == 'b'){
+            job.binary = 1;
+        }
+        else if(option == 'j' && atoi(optarg) > 0){
+            job.threads = atoi(optarg);
+        }
+        else if(option == 'o'){
+            job.outputPath = optarg;
+        }
+        else{
+            usage();
+        }
+    }
+    if(optind >= argc){
+        usage();
+    }
 
-    int keyLength = atoi(argv[1]);                              /* Convert the string argument after keygen into an integer. Please note, I utilized p.65 of the "All Block 4 Lectures in One PDF" lecture for this line */
+    job.keyLength = strtoull(argv[optind], &end, 10);                           /* Convert the string argument after keygen into an integer */
+    if(*end != '\0' || (job.binary && job.keyLength == 0)){                    /* An empty binary key would be an empty file */
+        usage();
+    }
 
-    for(i = 0; i < keyLength; i++){
-        currentIntValue = (rand() % 27 + 65);                   /* Generate a random number between 65-91, inclusive, and assign it to currentIntValue */
+    if(otpRandomKey(job.key) != 0){
+        perror("keygen: getrandom");
+        exit(1);
+    }
 
-        if(currentIntValue == 91){                              /* If the current generated integer is 64, which is the '@' character, replace it with the value 32, which is the space character */                 
-            currentIntValue = 32;
+    job.blockCount = (job.keyLength + KEYGEN_BLOCK_SIZE - 1) / KEYGEN_BLOCK_SIZE;
+    if((unsigned long long)job.threads > job.blockCount && job.blockCount > 0){ /* No point in threads that would never get a block */
+        job.threads = job.blockCount;
+    }
+
+    if(job.outputPath != NULL){
+        openOutput(&job, job.keyLength + !job.binary);                          /* The key plus its trailing newline, if it has one */
+    }
+
+    job.slots = calloc(2 * job.threads, sizeof(struct keygenSlot));
+    threadArguments = calloc(job.threads, sizeof(struct keygenThread));
+    threadIds = calloc(job.threads, sizeof(pthread_t));
+
+    for(i = 0; i < 2 * job.threads && job.map == NULL; i++){
+        job.slots[i].data = malloc(KEYGEN_BLOCK_SIZE);
+        sem_init(&job.slots[i].filled, 0, 0);
+        sem_init(&job.slots[i].empty, 0, 1);
+    }
+
+    for(i = 0; i < job.threads; i++){
+        threadArguments[i].job = &job;
+        threadArguments[i].index = i;
+        if(pthread_create(&threadIds[i], NULL, generateBlocks, &threadArguments[i]) != 0){
+            fprintf(stderr, "keygen: could not start thread %d\n", i);
+            exit(1);
         }
-        currentChar = currentIntValue;                          /* Set the currentChar equal to the current generated integer, which will set currentChar equal to its corresponding ASCII character */
+    }
+
+    for(block = 0; block < job.blockCount && job.map == NULL; block++){         /* Write the blocks out in order as they become ready */
+        int thread = block % job.threads;
+        struct keygenSlot* slot = &job.slots[2 * thread + (block / job.threads) % 2];
+
+        sem_wait(&slot->filled);
+        writeAll(&job, slot->data, slot->length, block * KEYGEN_BLOCK_SIZE);
+        sem_post(&slot->empty);
+    }
+
+    for(i = 0; i < job.threads; i++){
+        pthread_join(threadIds[i], NULL);
+    }
+
+    if(job.map != NULL && !job.binary){
+        job.map[job.keyLength] = '\n';                                          /* Same trailing newline as the stdout output */
+    }
+    else if(!job.binary){
+        writeAll(&job, "\n", 1, job.keyLength);                                 /* Print out a newline character, per the assignment specifications */
+    }
+    if(job.outputPath != NULL){
+        closeOutput(&job, job.keyLength + !job.binary);
+    }
 
-        printf("%c", currentChar);                              /* Print out the currentChar */
+    for(i = 0; i < 2 * job.threads && job.map == NULL; i++){
+        free(job.slots[i].data);
+        sem_destroy(&job.slots[i].filled);
+        sem_destroy(&job.slots[i].empty);
     }
+    free(job.slots);
+    free(threadArguments);
+    free(threadIds);
 
-    printf("\n");                                               /* Print out a newline character, per the assignment specifications */
-    
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,97 @@
+/****************************************************************
+* Author: Nicholas Schaffner
+* Last Modified: 10/17/26
+* Description: Frame buffer pool of the daemons (see otp_arena.h). Idle buffers are kept on a singly linked list
+*               threaded through their first bytes, so the pool needs no memory of its own. Every process has its own
+*               list: a forked child starts with a copy of its parent's idle buffers and never shares them. Buffers
+*               are mapped one by one rather than taken from malloc, so the ones given back past OTP_ARENA_MAX_IDLE are
+*               unmapped and their memory returns to the system at once; a freed heap block of this size would stay in
+*               the heap after the first burst raised malloc's mmap threshold.
+****************************************************************/
+
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "otp_arena.h"
+#include "otp_stats.h"
+
+static void* idleBuffers = NULL;                                                /* Head of the list, each buffer starts with a pointer to the next */
+static int idleCount = 0;
+
+void* otpArenaAlloc(size_t size){                                               /* malloc that counts itself in the metrics */
+    void* memory = malloc(size);
+
+    if(memory != NULL){
+        otpStatsCount(&otpStatsLocal->allocations, 1);
+    }
+    return memory;
+}
+
+void otpArenaFree(void* memory){
+    free(memory);
+}
+
+char* otpArenaTake(void){                                                       /* An OTP_ARENA_BUFFER_SIZE buffer, NULL when out of memory */
+    char* buffer = idleBuffers;
+
+    if(buffer == NULL){                                                         /* Only until the pool has grown to the peak load */
+        buffer = mmap(NULL, OTP_ARENA_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(buffer == MAP_FAILED){
+            return NULL;
+        }
+        otpStatsCount(&otpStatsLocal->allocations, 1);
+        return buffer;
+    }
+
+    idleBuffers = *(void**)buffer;
+    idleCount--;
+    return buffer;
+}
+
+void otpArenaGive(char* buffer){
+    if(buffer == NULL){
+        return;
+    }
+    if(idleCount >= OTP_ARENA_MAX_IDLE){                                        /* A burst is over, do not hold on to all of its memory */
+        munmap(buffer, OTP_ARENA_BUFFER_SIZE);
+        return;
+    }
+    *(void**)buffer = idleBuffers;
+    idleBuffers = buffer;
+    idleCount++;
+}
+
+void otpArenaReserve(int count){                                                /* Fill the pool ahead of time, so the children forked later start with buffers */
+    char* buffers[OTP_ARENA_MAX_IDLE];
+    int i;
+
+    for(i = 0; i < count && i < OTP_ARENA_MAX_IDLE; i++){
+        buffers[i] = otpArenaTake();
+    }
+    while(i-- > 0){
+        otpArenaGive(buffers[i]);
+    }
+}
+
+/* Give an empty receive buffer a pooled buffer to receive into. Returns OTP_ERR_IO when out of memory */
+int otpArenaAttach(struct otpRecvBuffer* buffer){
+    if(buffer->data != NULL){
+        return OTP_OK;
+    }
+    buffer->data = otpArenaTake();
+    if(buffer->data == NULL){
+        return OTP_ERR_IO;
+    }
+    buffer->capacity = OTP_ARENA_BUFFER_SIZE;                                   /* Holds every frame the daemons accept, recvBufferReserve never has to grow it */
+    buffer->start = 0;
+    buffer->end = 0;
+    return OTP_OK;
+}
+
+void otpArenaDetach(struct otpRecvBuffer* buffer){                              /* Give the buffer back, whatever it still holds is dropped */
+    otpArenaGive(buffer->data);
+    buffer->data = NULL;
+    buffer->capacity = 0;
+    buffer->start = 0;
+    buffer->end = 0;
+}
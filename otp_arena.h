@@ -0,0 +1,37 @@
+/****************************************************************
+* Author: Nicholas Schaffner
+* Last Modified: 10/17/26
+* Description: Per-process pool of the frame buffers the daemons serve connections with. Every buffer is
+*               OTP_ARENA_BUFFER_SIZE bytes, enough for the largest frame a daemon accepts, so a receive buffer built
+*               on one never grows. A connection takes a buffer only while it has bytes in it and gives it back as soon
+*               as it is drained, so memory follows the number of connections with a frame in progress rather than
+*               the number that are open. Buffers given back are kept for the next taker, so once a process has seen
+*               its peak load it serves every further request without touching the heap, up to OTP_ARENA_MAX_IDLE
+*               buffers: the rest of a larger burst goes back to the system when it is over, so the idle memory of a
+*               process never exceeds OTP_ARENA_MAX_IDLE * OTP_ARENA_BUFFER_SIZE (16 MB), whatever its concurrency.
+*               Every heap allocation a worker or event loop makes while serving goes through this module and is
+*               counted in the metrics (otp_allocations_total, see otp_stats.h), which is how the steady state is
+*               checked for zero; their --threads pool is started before they serve. A child forked for one connection
+*               starts that pool only on its first frame of at least --parallel-threshold characters, and those
+*               allocations are not counted.
+****************************************************************/
+
+#ifndef OTP_ARENA_H
+#define OTP_ARENA_H
+
+#include <stddef.h>
+
+#include "otp_proto.h"
+
+#define OTP_ARENA_BUFFER_SIZE OTP_RECV_BUFFER_SIZE                              /* A full DATA frame, with room to read ahead into the next */
+#define OTP_ARENA_MAX_IDLE 64                                                   /* Idle buffers kept per process, the rest go back to the system */
+
+char* otpArenaTake(void);
+void otpArenaGive(char* buffer);
+void otpArenaReserve(int count);
+void* otpArenaAlloc(size_t size);
+void otpArenaFree(void* memory);
+int otpArenaAttach(struct otpRecvBuffer* buffer);
+void otpArenaDetach(struct otpRecvBuffer* buffer);
+
+#endif
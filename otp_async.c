@@ -0,0 +1,570 @@
+/****************************************************************
+* Author: Nicholas Schaffner
+* Last Modified: 10/17/26
+* Description: Non-blocking client library (see otp_async.h). A handle goes through connecting, reading the daemon's
+*               handshake and ready, all driven by otpAsyncProcess() so no call ever waits on the daemon. Requests form
+*               one queue in submission order, walked by three cursors: the oldest request whose frames are not all
+*               written, the oldest one still waiting for replies, and the oldest one whose callback has not run. DATA
+*               frames are written straight from the caller's text and key buffers with sendmsg, one chunk at a time,
+*               and RESULT frames are copied from the receive buffer into the caller's output buffer, so the library
+*               holds no copy of a message. A request the daemon rejects skips its remaining DATA frames but still
+*               sends its END, which the daemon drops along with the rest of the request, and its callback runs once
+*               that END is written so the caller's buffers are never read after the callback. Given several daemons, a
+*               handle ranks them by rendezvous hashing of its process and address, so the handles of programs spread
+*               evenly over the daemons and each returns to the same one when it reconnects. A daemon that cannot be
+*               reached, hangs up or is busy before the handshake completes is passed over for the next in the ranking,
+*               with the queued requests kept, since none of them has been sent yet; the daemon of the other mode is
+*               not. When the connection fails after that, every request still queued is completed with the error and
+*               the next submit reconnects.
+****************************************************************/
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "otp_async.h"
+#include "otp_codec.h"
+#include "otp_proto.h"
+
+#if OTP_ASYNC_ENCODE != OTP_MODE_ENCODE || OTP_ASYNC_DECODE != OTP_MODE_DECODE  /* Passed through unchanged, the public values must be the internal ones */
+#error "OTP_ASYNC_ENCODE and OTP_ASYNC_DECODE differ from OTP_MODE_*"
+#endif
+#if OTP_ASYNC_OK != OTP_OK || OTP_ASYNC_ERR_IO != OTP_ERR_IO || OTP_ASYNC_ERR_PROTO != OTP_ERR_PROTO
+#error "OTP_ASYNC_* statuses differ from OTP_OK and OTP_ERR_*"
+#endif
+
+#define OTP_ASYNC_IDLE 0                                                        /* No connection, the next submit opens one */
+#define OTP_ASYNC_CONNECTING 1                                                  /* Non-blocking connect in progress */
+#define OTP_ASYNC_HANDSHAKE 2                                                   /* Connected, waiting for the daemon's greeting */
+#define OTP_ASYNC_READY 3
+
+struct otpAsyncRequest{
+    const char* text;
+    const char* key;
+    char* out;                                                                  /* Caller's buffer for the length result characters */
+    size_t length;
+    size_t sent;                                                                /* Characters whose DATA frame has been started */
+    size_t received;                                                            /* Characters of RESULT copied to out */
+    int endWritten;                                                             /* The END frame has been written completely */
+    int status;                                                                 /* OTP_AGAIN until the daemon has answered */
+    char reason[OTP_MAX_ERROR_SIZE + 1];
+    uint16_t requestId;
+    otpAsyncCallback callback;
+    void* context;
+    struct otpAsyncRequest* next;
+};
+
+struct otpAsync{
+    struct otpEndpointList endpoints;                                           /* Socket paths are copies owned by the handle */
+    int order[OTP_MAX_ENDPOINTS];                                               /* The endpoints in the order this handle tries them */
+    int nextEndpoint;                                                           /* Position in order of the next endpoint to try */
+    int busy;                                                                   /* A daemon tried for this connection was busy */
+    int mode;
+    int state;                                                                  /* One of the OTP_ASYNC_* values */
+    int socketFD;                                                               /* -1 when idle */
+    struct otpRecvBuffer recvBuffer;                                            /* Handshake, then reply frames */
+    struct otpAsyncRequest* head;                                               /* Oldest request whose callback has not run */
+    struct otpAsyncRequest* replying;                                           /* Oldest request still waiting for replies */
+    struct otpAsyncRequest* sending;                                            /* Oldest request whose frames are not all started */
+    struct otpAsyncRequest* tail;
+    struct otpAsyncRequest* spare;                                              /* Finished requests kept for reuse */
+    size_t pending;                                                             /* Requests whose callback has not run */
+    uint16_t nextRequestId;
+    int modePending;                                                            /* otp_d: a MODE frame goes out before any request */
+    char operation;                                                             /* Payload of that MODE frame */
+    char header[OTP_FRAME_HEADER_SIZE];                                         /* Header of the frame being written */
+    struct iovec parts[3];                                                      /* Header and payload parts of that frame */
+    int partIndex;                                                              /* First part not completely written */
+    int partCount;                                                              /* partIndex == partCount when no frame is in progress */
+    struct otpAsyncRequest* frameOwner;                                         /* Request of the frame being written, NULL for MODE */
+    int frameIsEnd;
+    int callbackDepth;                                                          /* Callbacks running, the handle is not freed under them */
+    int closed;                                                                 /* otpAsyncClose was called, from a callback when the handle still exists */
+};
+
+/* Create a handle for any of the daemons in endpoints, in OTP_ASYNC_ENCODE or OTP_ASYNC_DECODE. It connects on the
+ * first request. Returns NULL with errno set on failure */
+struct otpAsync* otpAsyncOpen(const struct otpEndpointList* endpoints, int mode){
+    struct otpAsync* async;
+    int i, copied = 1;
+
+    if((mode != OTP_MODE_ENCODE && mode != OTP_MODE_DECODE) || endpoints->count < 1 || endpoints->count > OTP_MAX_ENDPOINTS){
+        errno = EINVAL;
+        return NULL;
+    }
+    async = calloc(1, sizeof(*async));
+    if(async == NULL){
+        return NULL;
+    }
+
+    async->endpoints = *endpoints;
+    for(i = 0; i < endpoints->count; i++){
+        if(endpoints->endpoints[i].unixPath != NULL){
+            async->endpoints.endpoints[i].unixPath = strdup(endpoints->endpoints[i].unixPath);
+            copied &= async->endpoints.endpoints[i].unixPath != NULL;
+        }
+    }
+    otpEndpointsRank(&async->endpoints, ((uint64_t)getpid() << 32) ^ (uintptr_t)async, async->order);     /* Fixed for the handle's lifetime, see above */
+    async->mode = mode;
+    async->operation = mode;
+    async->state = OTP_ASYNC_IDLE;
+    async->socketFD = -1;
+    if(recvBufferInit(&async->recvBuffer, OTP_RECV_BUFFER_SIZE) != OTP_OK || !copied){
+        otpAsyncClose(async);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    return async;
+}
+
+static void failRequests(struct otpAsync* async, int status, const char* reason){    /* Drop the connection and complete every unanswered request with status */
+    struct otpAsyncRequest* request;
+
+    if(async->socketFD >= 0){
+        close(async->socketFD);
+    }
+    async->socketFD = -1;
+    async->state = OTP_ASYNC_IDLE;
+    async->recvBuffer.start = 0;
+    async->recvBuffer.end = 0;
+    async->partIndex = 0;
+    async->partCount = 0;
+    async->modePending = 0;
+
+    for(request = async->head; request != NULL; request = request->next){
+        if(request->status == OTP_AGAIN){
+            request->status = status;
+            snprintf(request->reason, sizeof(request->reason), "%s", reason);
+        }
+        request->endWritten = 1;                                                /* Nothing more is read from the caller's buffers */
+    }
+    async->sending = NULL;
+    async->replying = NULL;
+}
+
+static int startConnecting(struct otpAsync* async){                             /* Start connecting to the next daemon in the ranking. Returns 0, or -1 with errno set when none is left */
+    while(async->nextEndpoint < async->endpoints.count){
+        async->socketFD = otpEndpointConnect(&async->endpoints.endpoints[async->order[async->nextEndpoint++]], SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(async->socketFD >= 0){
+            async->state = OTP_ASYNC_CONNECTING;
+            async->recvBuffer.start = 0;
+            async->recvBuffer.end = 0;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void connectFailed(struct otpAsync* async, int busy, const char* reason){    /* Before the handshake: nothing was sent, so the queue moves to the next daemon */
+    close(async->socketFD);
+    async->socketFD = -1;
+    async->busy |= busy;
+    if(startConnecting(async) < 0){
+        failRequests(async, OTP_ERR_IO, async->busy ? "the daemon is busy" : reason);
+    }
+}
+
+static void freeHandle(struct otpAsync* async){
+    struct otpAsyncRequest* request;
+    int i;
+
+    while((request = async->spare) != NULL){
+        async->spare = request->next;
+        free(request);
+    }
+    recvBufferFree(&async->recvBuffer);
+    for(i = 0; i < async->endpoints.count; i++){
+        free((char*)async->endpoints.endpoints[i].unixPath);
+    }
+    free(async);
+}
+
+/* Run the callbacks of the finished requests at the head of the queue. A callback may submit, process or close the
+ * handle: once the outermost call has run them all, a handle closed meanwhile is freed and *freed, when given, is set.
+ * Returns how many requests finished */
+static int finishRequests(struct otpAsync* async, int* freed){
+    struct otpAsyncRequest* request;
+    int finished = 0;
+
+    async->callbackDepth++;
+    while((request = async->head) != NULL && request->status != OTP_AGAIN && request->endWritten){
+        async->head = request->next;                                            /* Unlinked first, the callback may submit more */
+        if(async->head == NULL){
+            async->tail = NULL;
+        }
+        async->pending--;
+        if(request->callback != NULL){
+            request->callback(request->context, request->status, request->status == OTP_OK ? NULL : request->reason);
+        }
+        request->next = async->spare;                                           /* Only now, so a submit from the callback cannot reuse reason */
+        async->spare = request;
+        finished++;
+    }
+    async->callbackDepth--;
+
+    if(async->closed && async->callbackDepth == 0){
+        freeHandle(async);
+        if(freed != NULL){
+            *freed = 1;
+        }
+    }
+    return finished;
+}
+
+/* Queue a request: the length characters of text, transformed with the coinciding characters of key, are written to
+ * out, which may be text. The three buffers must stay valid until the callback runs. Returns 0, or -1 with errno
+ * EINVAL when text or key holds bad characters, or the errno of a connection that could not be started */
+int otpAsyncSubmit(struct otpAsync* async, const char* text, const char* key, char* out, size_t length, otpAsyncCallback callback, void* context){
+    struct otpAsyncRequest* request;
+
+    if(async->closed){                                                          /* Closed by a callback that is still running */
+        errno = EBADF;
+        return -1;
+    }
+    if(!otpValidate(text, length) || !otpValidate(key, length)){                /* Rejected here rather than by the daemon */
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(async->state == OTP_ASYNC_IDLE){                                         /* Every earlier request has been completed, start over */
+        async->nextEndpoint = 0;
+        async->busy = 0;
+        if(startConnecting(async) < 0){
+            return -1;
+        }
+    }
+
+    request = async->spare;
+    if(request != NULL){
+        async->spare = request->next;
+    }
+    else if((request = malloc(sizeof(*request))) == NULL){
+        return -1;
+    }
+    memset(request, '\0', sizeof(*request));
+    request->text = text;
+    request->key = key;
+    request->out = out;
+    request->length = length;
+    request->status = OTP_AGAIN;
+    request->requestId = async->nextRequestId++;                                /* Only has to tell apart the requests in flight */
+    request->callback = callback;
+    request->context = context;
+
+    if(async->tail != NULL){
+        async->tail->next = request;
+    }
+    else{
+        async->head = request;
+    }
+    async->tail = request;
+    if(async->sending == NULL){
+        async->sending = request;
+    }
+    if(async->replying == NULL){
+        async->replying = request;
+    }
+    async->pending++;
+
+    return 0;
+}
+
+static void startFrame(struct otpAsync* async, int type, struct otpAsyncRequest* owner, const char* first, const char* second, uint32_t partLength){    /* Header plus up to two payload parts of partLength bytes */
+    async->parts[0].iov_base = async->header;
+    async->parts[0].iov_len = OTP_FRAME_HEADER_SIZE;
+    async->partCount = 1;
+    if(first != NULL){
+        async->parts[async->partCount].iov_base = (void*)first;
+        async->parts[async->partCount++].iov_len = partLength;
+    }
+    if(second != NULL){                                                         /* DATA: the key chunk follows the text chunk */
+        async->parts[async->partCount].iov_base = (void*)second;
+        async->parts[async->partCount++].iov_len = partLength;
+    }
+    encodeFrameHeader(async->header, type, owner != NULL ? owner->requestId : 0, (async->partCount - 1) * partLength);
+    async->partIndex = 0;
+    async->frameOwner = owner;
+    async->frameIsEnd = type == OTP_FRAME_END;
+}
+
+static int nextFrame(struct otpAsync* async){                                  /* Start the next frame to write. Returns 0 when there is none */
+    struct otpAsyncRequest* request = async->sending;
+    size_t chunk;
+
+    if(async->modePending){                                                     /* otp_d: name the operation once, it holds for every request */
+        async->modePending = 0;
+        startFrame(async, OTP_FRAME_MODE, NULL, &async->operation, NULL, 1);
+        return 1;
+    }
+    if(request == NULL){
+        return 0;
+    }
+
+    if(request->status == OTP_AGAIN && request->sent < request->length){       /* A rejected request skips its remaining DATA frames */
+        chunk = request->length - request->sent < OTP_CHUNK_SIZE ? request->length - request->sent : OTP_CHUNK_SIZE;
+        startFrame(async, OTP_FRAME_DATA, request, request->text + request->sent, request->key + request->sent, chunk);
+        request->sent += chunk;
+        return 1;
+    }
+
+    startFrame(async, OTP_FRAME_END, request, NULL, NULL, 0);
+    async->sending = request->next;
+    return 1;
+}
+
+static int writeFrames(struct otpAsync* async){                                 /* Write frames until the socket is full. Returns OTP_OK or OTP_ERR_IO */
+    struct msghdr message;
+    ssize_t charsWritten;
+
+    while(async->partIndex < async->partCount || nextFrame(async)){
+        memset(&message, '\0', sizeof(message));
+        message.msg_iov = async->parts + async->partIndex;
+        message.msg_iovlen = async->partCount - async->partIndex;
+
+        charsWritten = sendmsg(async->socketFD, &message, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if(charsWritten < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK ? OTP_OK : OTP_ERR_IO;
+        }
+
+        while(async->partIndex < async->partCount && (size_t)charsWritten >= async->parts[async->partIndex].iov_len){   /* Skip the parts that were written completely */
+            charsWritten -= async->parts[async->partIndex++].iov_len;
+        }
+        if(async->partIndex < async->partCount){                                /* Advance into the part that was written partially */
+            async->parts[async->partIndex].iov_base = (char*)async->parts[async->partIndex].iov_base + charsWritten;
+            async->parts[async->partIndex].iov_len -= charsWritten;
+        }
+        else if(async->frameIsEnd){
+            async->frameOwner->endWritten = 1;
+        }
+    }
+
+    return OTP_OK;
+}
+
+static int handleReply(struct otpAsync* async, const struct otpFrameHeader* header, const char* payload){    /* Returns OTP_OK or OTP_ERR_PROTO */
+    struct otpAsyncRequest* request = async->replying;
+
+    if(request == NULL || header->requestId != request->requestId){             /* Replies come back in the order the requests were sent */
+        return OTP_ERR_PROTO;
+    }
+
+    switch(header->type){
+        case OTP_FRAME_RESULT:
+            if(header->length > request->length - request->received){
+                return OTP_ERR_PROTO;
+            }
+            memcpy(request->out + request->received, payload, header->length);
+            request->received += header->length;
+            return OTP_OK;
+        case OTP_FRAME_END:                                                     /* The message is complete */
+            if(request->received != request->length){
+                return OTP_ERR_PROTO;
+            }
+            request->status = OTP_OK;
+            break;
+        case OTP_FRAME_ERROR:                                                   /* The daemon rejected the request and drops the rest of it */
+            request->status = OTP_ASYNC_ERR_REJECTED;
+            snprintf(request->reason, sizeof(request->reason), "%.*s", (int)(header->length < OTP_MAX_ERROR_SIZE ? header->length : OTP_MAX_ERROR_SIZE), payload);
+            break;
+        default:
+            return OTP_ERR_PROTO;
+    }
+
+    async->replying = request->next;
+    return OTP_OK;
+}
+
+static int readFrames(struct otpAsync* async){                                  /* Read and handle every reply the socket has. Returns OTP_OK, OTP_ERR_IO or OTP_ERR_PROTO */
+    struct otpFrameHeader header;
+    char* payload;
+    ssize_t charsRead;
+    int status;
+
+    while(1){
+        status = recvBufferNextFrame(&async->recvBuffer, OTP_CHUNK_SIZE, &header, &payload);
+        if(status == OTP_OK){
+            if(handleReply(async, &header, payload) != OTP_OK){
+                return OTP_ERR_PROTO;
+            }
+            continue;
+        }
+        if(status != OTP_AGAIN){
+            return status;
+        }
+
+        charsRead = recvBufferRead(async->socketFD, &async->recvBuffer);
+        if(charsRead < 0 && errno == EINTR){
+            continue;
+        }
+        if(charsRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+            return OTP_OK;
+        }
+        if(charsRead <= 0){                                                     /* Error, or the daemon closed the connection */
+            return OTP_ERR_IO;
+        }
+    }
+}
+
+static void readHandshake(struct otpAsync* async){                              /* Check the greeting once all of it has arrived */
+    static const char* reasons[] = {NULL, "could not connect to the daemon", "connected to the daemon of the other mode", "not connected to a daemon", "the daemon is busy"};
+    ssize_t charsRead;
+    int failure, unified;
+
+    while(async->recvBuffer.end - async->recvBuffer.start < OTP_HANDSHAKE_SIZE){
+        charsRead = recvBufferRead(async->socketFD, &async->recvBuffer);
+        if(charsRead < 0 && errno == EINTR){
+            continue;
+        }
+        if(charsRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+            return;
+        }
+        if(charsRead <= 0){
+            connectFailed(async, 0, reasons[OTP_CONNECT_NO_HANDSHAKE]);
+            return;
+        }
+    }
+
+    failure = otpCheckHandshake(async->recvBuffer.data + async->recvBuffer.start, async->mode, &unified);
+    if(failure == OTP_CONNECT_OTHER_DAEMON){                                    /* A mistake in the list, not a reason to move on */
+        failRequests(async, OTP_ERR_PROTO, reasons[failure]);
+        return;
+    }
+    if(failure != OTP_CONNECT_OK){
+        connectFailed(async, failure == OTP_CONNECT_BUSY, reasons[failure]);
+        return;
+    }
+    async->recvBuffer.start += OTP_HANDSHAKE_SIZE;                              /* Reply frames follow the greeting */
+    async->modePending = unified;
+    async->state = OTP_ASYNC_READY;
+}
+
+int otpAsyncFD(const struct otpAsync* async){                                   /* Descriptor to poll, -1 while there is nothing to wait for */
+    return async->socketFD;
+}
+
+short otpAsyncEvents(const struct otpAsync* async){                             /* poll events to wait for on otpAsyncFD() */
+    switch(async->state){
+        case OTP_ASYNC_CONNECTING:
+            return POLLOUT;
+        case OTP_ASYNC_HANDSHAKE:
+            return POLLIN;
+        case OTP_ASYNC_READY:                                                   /* POLLIN even when idle, to notice the daemon hanging up */
+            return POLLIN | (async->partIndex < async->partCount || async->modePending || async->sending != NULL ? POLLOUT : 0);
+        default:
+            return 0;
+    }
+}
+
+/* Make whatever progress the socket allows without blocking and run the callbacks of the requests that finished.
+ * Sets *freed when a callback closed the handle. Returns the number of requests completed */
+static int processHandle(struct otpAsync* async, int* freed){
+    char reason[OTP_MAX_ERROR_SIZE + 1];
+    socklen_t errorLength = sizeof(int);
+    int connectError = 0;
+    int status;
+
+    if(async->state == OTP_ASYNC_CONNECTING){
+        struct pollfd ready = {async->socketFD, POLLOUT, 0};
+
+        if(poll(&ready, 1, 0) == 1){                                            /* Not done connecting until the socket is writable */
+            getsockopt(async->socketFD, SOL_SOCKET, SO_ERROR, &connectError, &errorLength);
+            if(connectError != 0){
+                snprintf(reason, sizeof(reason), "could not connect: %s", strerror(connectError));
+                connectFailed(async, 0, reason);
+            }
+            else{
+                async->state = OTP_ASYNC_HANDSHAKE;
+            }
+        }
+    }
+    if(async->state == OTP_ASYNC_HANDSHAKE){
+        readHandshake(async);
+    }
+    if(async->state == OTP_ASYNC_READY){
+        status = writeFrames(async);
+        if(status == OTP_OK){
+            status = readFrames(async);
+        }
+        if(status == OTP_OK){
+            status = writeFrames(async);                                        /* The replies may have freed room in the socket */
+        }
+        if(status != OTP_OK){
+            failRequests(async, status, status == OTP_ERR_PROTO ? "unexpected reply from the daemon" : "lost the connection to the daemon");
+        }
+    }
+
+    return finishRequests(async, freed);
+}
+
+/* Call it when otpAsyncFD() is ready for otpAsyncEvents(); calling it at other times is harmless. Returns the number of
+ * requests completed. The handle no longer exists afterwards if a callback closed it */
+int otpAsyncProcess(struct otpAsync* async){
+    return processHandle(async, NULL);
+}
+
+size_t otpAsyncPending(const struct otpAsync* async){                           /* Requests whose callback has not run yet */
+    return async->pending;
+}
+
+/* For callers without an event loop: poll and process until every request has completed or timeoutMs (-1 for no
+ * limit) has passed. Returns the number of requests still pending, 0 when a callback closed the handle, or -1 with
+ * errno set when poll fails */
+int otpAsyncWait(struct otpAsync* async, int timeoutMs){
+    struct timespec now, deadline;
+    struct pollfd ready;
+    long remainingMs = timeoutMs;
+    int freed = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeoutMs / 1000;
+    deadline.tv_nsec += (long)(timeoutMs % 1000) * 1000000;
+
+    while(async->pending > 0 && async->socketFD >= 0){
+        if(timeoutMs >= 0){
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            remainingMs = (deadline.tv_sec - now.tv_sec) * 1000 + (deadline.tv_nsec - now.tv_nsec) / 1000000;
+            if(remainingMs <= 0){
+                break;
+            }
+        }
+        ready.fd = async->socketFD;
+        ready.events = otpAsyncEvents(async);
+        ready.revents = 0;
+        if(poll(&ready, 1, timeoutMs >= 0 ? (int)remainingMs : -1) < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return -1;
+        }
+        processHandle(async, &freed);
+        if(freed){
+            return 0;
+        }
+    }
+
+    processHandle(async, &freed);                                               /* Requests failed while idle still need their callbacks */
+    return freed ? 0 : (int)async->pending;
+}
+
+/* Complete every pending request with OTP_ERR_IO and free the handle. Called from a callback, the handle is freed
+ * once the callbacks running return */
+void otpAsyncClose(struct otpAsync* async){
+    if(async->closed){
+        return;
+    }
+    async->closed = 1;
+    failRequests(async, OTP_ERR_IO, "the handle was closed");
+    if(async->callbackDepth == 0){
+        finishRequests(async, NULL);                                            /* Frees the handle */
+    }
+}
@@ -0,0 +1,56 @@
+/****************************************************************
+* Author: Nicholas Schaffner
+* Last Modified: 10/17/26
+* Description: Embeddable, non-blocking client for otp_enc_d, otp_dec_d and otp_d, for programs that would otherwise
+*               run otp_enc or otp_dec and read their stdout. An otpAsync handle owns one connection to one of a list
+*               of daemons and reuses it for every request; it connects on the first request and again on the next one
+*               after the connection is lost, moving on to another daemon when one is down or busy. otpAsyncSubmit
+*               queues a text and key buffer pair and returns at once. The caller then polls otpAsyncFD() for
+*               otpAsyncEvents() in its own event loop (poll, epoll, libevent...) and calls otpAsyncProcess() whenever
+*               the descriptor is ready; otpAsyncWait() does both for a caller without one. otpAsyncProcess() writes
+*               and reads only what the socket takes without blocking, copies each result into the caller's output
+*               buffer and runs the callback of every request that finished, in the order the requests were submitted.
+*               Requests are pipelined over the connection (see otp_proto.h), so many can be in flight at once. The
+*               descriptor changes when the handle reconnects, so an event loop that registers it once must check
+*               otpAsyncFD() after every otpAsyncProcess(). A handle is not thread safe. Link with libotp.a, which
+*               compileall builds. It holds only this library and the protocol, endpoint and codec code it uses, and
+*               exports only the otpAsync* functions and otpEndpointsAdd, which fills the struct otpEndpointList that
+*               otpAsyncOpen takes; every other symbol is local to it, so it cannot clash with the host program's.
+*               This header and otp_endpoint.h are all a host includes: the modes and statuses it needs are defined
+*               here as OTP_ASYNC_*, and the protocol and codec headers stay private to the library.
+****************************************************************/
+
+#ifndef OTP_ASYNC_H
+#define OTP_ASYNC_H
+
+#include <stddef.h>
+
+#include "otp_endpoint.h"
+
+#define OTP_ASYNC_ENCODE 0                                                      /* Modes of otpAsyncOpen, the same values as OTP_MODE_* (see otp_codec.h) */
+#define OTP_ASYNC_DECODE 1
+
+#define OTP_ASYNC_OK 0                                                          /* Statuses passed to the callback, the same values as OTP_OK and OTP_ERR_* (see otp_proto.h) */
+#define OTP_ASYNC_ERR_IO -1                                                     /* The connection failed or was lost */
+#define OTP_ASYNC_ERR_PROTO -2                                                  /* Something else than the right daemon answered */
+#define OTP_ASYNC_ERR_REJECTED -4                                               /* The daemon answered the request with an ERROR frame */
+
+/* Called once per request. status is OTP_ASYNC_OK, OTP_ASYNC_ERR_REJECTED with the daemon's reason, or
+ * OTP_ASYNC_ERR_IO or OTP_ASYNC_ERR_PROTO when the connection failed, was lost or reached something else than the
+ * right daemon, with a description in reason. reason is NULL on success and only valid during the call. The callback
+ * may call otpAsyncClose: the requests still queued then complete with OTP_ASYNC_ERR_IO, and the handle is freed when
+ * the otpAsyncProcess, otpAsyncWait or otpAsyncClose call that ran the callback returns, so it must not be used after */
+typedef void (*otpAsyncCallback)(void* context, int status, const char* reason);
+
+struct otpAsync;
+
+struct otpAsync* otpAsyncOpen(const struct otpEndpointList* endpoints, int mode);
+int otpAsyncSubmit(struct otpAsync* async, const char* text, const char* key, char* out, size_t length, otpAsyncCallback callback, void* context);
+int otpAsyncFD(const struct otpAsync* async);
+short otpAsyncEvents(const struct otpAsync* async);
+int otpAsyncProcess(struct otpAsync* async);
+size_t otpAsyncPending(const struct otpAsync* async);
+int otpAsyncWait(struct otpAsync* async, int timeoutMs);
+void otpAsyncClose(struct otpAsync* async);
+
+#endif
@@ -0,0 +1,591 @@
+/****************************************************************
+* Author: Nicholas Schaffner
+* Last Modified: 10/17/26
+* Description: Check of the otpAsync library as a host program sees it: it includes only otp_async.h and links only
+*               libotp.a, so the scripted daemon speaks the wire protocol of otp_proto.h with its own few lines of
+*               frame code, and the expected outputs are added modulo 27 here. Four cases: pipelining, where
+*               TEST_PIPELINED requests of sizes from 0 to several DATA frames are all submitted to a real otp_enc_d,
+*               started from the directory of this program on a unix socket, before any of them is processed, and each
+*               must finish in submission order with the ciphertext computed here; a rejected request, where a scripted
+*               daemon in this program answers the middle one of three queued requests with an ERROR and the two around
+*               it must still succeed on the same connection; and failover, where the first daemon tried hangs up
+*               before its greeting and the second answers BUSY, whichever endpoints the handle ranks first, so every
+*               request must be served by the third, and a list with no daemon up must fail each request with
+*               OTP_ASYNC_ERR_IO; and a handle closed by the callback of its first request, which must finish the other
+*               requests and free the handle once the callbacks return. The syntax for this program is:
+*               otp_async_test
+*               Each case prints one line, "ok" or the first failure. The exit value is 0 when every case passed and 1
+*               otherwise.
+****************************************************************/
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "otp_async.h"
+
+#define TEST_PIPELINED 100                                                      /* Requests in flight at once in the pipelining case */
+#define TEST_CHUNK_SIZE 65536                                                   /* Characters carried by one DATA frame, TEST_CHUNK_SIZE of the protocol */
+#define TEST_MAX_LENGTH (3 * TEST_CHUNK_SIZE + 17)                              /* Longest request, four DATA frames */
+#define TEST_MAX_REASON 80
+#define TEST_TIMEOUT_MS 10000
+#define TEST_FAILOVER_ENDPOINTS 3
+
+#define SCRIPT_HANG_UP 0                                                        /* What the scripted daemon does with a connection */
+#define SCRIPT_BUSY 1
+#define SCRIPT_SERVE 2
+
+#define FRAME_HEADER_SIZE 8                                                     /* The wire protocol as otp_proto.h describes it: version, type, request ID, length */
+#define FRAME_VERSION 1
+#define FRAME_DATA 'D'
+#define FRAME_RESULT 'R'
+#define FRAME_END 'E'
+#define FRAME_ERROR 'X'
+#define HANDSHAKE_SIZE 6
+
+static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ ";
+
+struct testRequest{
+    char* text;
+    char* key;
+    char* out;
+    size_t length;
+    int status;                                                                 /* -100 until the callback ran */
+    int order;                                                                  /* Position among the callbacks */
+    char reason[TEST_MAX_REASON];
+};
+
+struct scriptedDaemon{                                                          /* Stand-in for otp_enc_d behind one or more sockets */
+    int listenFDs[TEST_FAILOVER_ENDPOINTS];
+    int listenCount;
+    const int* script;                                                          /* Behaviour of each connection accepted, in order, over all sockets */
+    int scriptLength;
+    int rejectIndex;                                                            /* Request of a served connection answered with an ERROR, -1 for none */
+    int accepted;
+    pthread_mutex_t lock;
+    char paths[TEST_FAILOVER_ENDPOINTS][sizeof(((struct sockaddr_un*)NULL)->sun_path)];    /* Sockets listened on, named in the endpoint list */
+};
+
+static int callbackCount;
+static char socketDirectory[] = "/tmp/otp_async_testXXXXXX";
+
+static void fillRandom(char* data, size_t length){
+    size_t i;
+
+    for(i = 0; i < length; i++){
+        data[i] = alphabet[rand() % 27];
+    }
+}
+
+static int alphabetIndex(char c){                                               /* 'A' to 'Z' are 0 to 25 and the space is 26 */
+    return c == ' ' ? 26 : c - 'A';
+}
+
+static void encodeExpected(const char* text, const char* key, char* out, size_t length){    /* What otp_enc_d sends back for text and key */
+    size_t i;
+
+    for(i = 0; i < length; i++){
+        out[i] = alphabet[(alphabetIndex(text[i]) + alphabetIndex(key[i])) % 27];
+    }
+}
+
+static void requestInit(struct testRequest* request, size_t length){
+    request->text = malloc(length + 1);
+    request->key = malloc(length + 1);
+    request->out = malloc(length + 1);
+    if(request->text == NULL || request->key == NULL || request->out == NULL){
+        fprintf(stderr, "otp_async_test: out of memory\n");
+        exit(1);
+    }
+    fillRandom(request->text, length);
+    fillRandom(request->key, length);
+    memset(request->out, '\0', length + 1);
+    request->length = length;
+    request->status = -100;
+    request->order = -1;
+    request->reason[0] = '\0';
+}
+
+static void requestFree(struct testRequest* request){
+    free(request->text);
+    free(request->key);
+    free(request->out);
+}
+
+static void requestDone(void* context, int status, const char* reason){
+    struct testRequest* request = context;
+
+    request->status = status;
+    request->order = callbackCount++;
+    snprintf(request->reason, sizeof(request->reason), "%s", reason != NULL ? reason : "");
+}
+
+/* Check that request number index finished with wantStatus in its turn and, when it succeeded, with the right output. Returns 0 on success */
+static int checkRequest(const char* name, const struct testRequest* request, int index, int firstOrder, int wantStatus){
+    char* expected;
+    int matches;
+
+    if(request->status != wantStatus){
+        printf("%s: request %d finished with status %d (%s), expected %d\n", name, index, request->status, request->reason, wantStatus);
+        return -1;
+    }
+    if(request->order != firstOrder + index){
+        printf("%s: request %d finished in position %d\n", name, index, request->order - firstOrder);
+        return -1;
+    }
+    if(wantStatus != OTP_ASYNC_OK){
+        return 0;
+    }
+    expected = malloc(request->length + 1);
+    if(expected == NULL){
+        fprintf(stderr, "otp_async_test: out of memory\n");
+        exit(1);
+    }
+    encodeExpected(request->text, request->key, expected, request->length);
+    matches = memcmp(expected, request->out, request->length) == 0;
+    free(expected);
+    if(!matches){
+        printf("%s: request %d of %zu characters has the wrong output\n", name, index, request->length);
+        return -1;
+    }
+    return 0;
+}
+
+static int listenUnix(const char* path){
+    struct sockaddr_un address;
+    int socketFD = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    memset(&address, '\0', sizeof(address));
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", path);
+    if(socketFD < 0 || bind(socketFD, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(socketFD, 16) < 0){
+        perror("otp_async_test: listen");
+        exit(1);
+    }
+    return socketFD;
+}
+
+static int daemonListening(const char* path){
+    struct sockaddr_un address;
+    int socketFD = socket(AF_UNIX, SOCK_STREAM, 0);
+    int connected;
+
+    memset(&address, '\0', sizeof(address));
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", path);
+    connected = connect(socketFD, (struct sockaddr*)&address, sizeof(address)) == 0;
+    close(socketFD);
+    return connected;
+}
+
+/* Start otp_enc_d from the directory of this program on the unix socket path */
+static pid_t startDaemon(const char* testPath, const char* path){
+    char daemonPath[4096];
+    const char* slash = strrchr(testPath, '/');
+    pid_t daemonPid;
+    int waited;
+
+    snprintf(daemonPath, sizeof(daemonPath), "%.*sotp_enc_d", slash != NULL ? (int)(slash - testPath + 1) : 2, slash != NULL ? testPath : "./");
+    daemonPid = fork();
+    if(daemonPid < 0){
+        perror("otp_async_test: fork");
+        exit(1);
+    }
+    if(daemonPid == 0){
+        setpgid(0, 0);
+        prctl(PR_SET_PDEATHSIG, SIGTERM);                                       /* Do not outlive the test */
+        execl(daemonPath, daemonPath, "--unix", path, (char*)NULL);
+        fprintf(stderr, "otp_async_test: could not run %s\n", daemonPath);
+        _exit(1);
+    }
+    setpgid(daemonPid, daemonPid);
+
+    for(waited = 0; !daemonListening(path); waited += 10){
+        if(waited >= TEST_TIMEOUT_MS || waitpid(daemonPid, NULL, WNOHANG) != 0){
+            fprintf(stderr, "otp_async_test: %s did not start listening on %s\n", daemonPath, path);
+            exit(1);
+        }
+        usleep(10000);
+    }
+    return daemonPid;
+}
+
+static int sendAllBytes(int socketFD, const char* data, size_t length){       /* Returns 0 on success */
+    ssize_t written;
+
+    while(length > 0){
+        written = send(socketFD, data, length, 0);
+        if(written < 0 && errno == EINTR){
+            continue;
+        }
+        if(written <= 0){
+            return -1;
+        }
+        data += written;
+        length -= written;
+    }
+    return 0;
+}
+
+static int recvAllBytes(int socketFD, char* data, size_t length){             /* Returns 0 once length bytes arrived, -1 when the peer closed first */
+    ssize_t received;
+
+    while(length > 0){
+        received = recv(socketFD, data, length, 0);
+        if(received < 0 && errno == EINTR){
+            continue;
+        }
+        if(received <= 0){
+            return -1;
+        }
+        data += received;
+        length -= received;
+    }
+    return 0;
+}
+
+static int sendTestFrame(int socketFD, int type, unsigned requestId, const char* payload, uint32_t length){    /* Returns 0 on success */
+    char header[FRAME_HEADER_SIZE];
+
+    header[0] = FRAME_VERSION;
+    header[1] = type;
+    header[2] = requestId >> 8;
+    header[3] = requestId;
+    header[4] = length >> 24;
+    header[5] = length >> 16;
+    header[6] = length >> 8;
+    header[7] = length;
+    if(sendAllBytes(socketFD, header, FRAME_HEADER_SIZE) < 0){
+        return -1;
+    }
+    return sendAllBytes(socketFD, payload, length);
+}
+
+/* Serve one connection the way otp_enc_d does, answering request number rejectIndex with an ERROR and dropping the rest of it */
+static void serveScripted(int socketFD, int rejectIndex){
+    unsigned char header[FRAME_HEADER_SIZE];
+    char* payload = malloc(2 * TEST_CHUNK_SIZE);
+    char* result = malloc(TEST_CHUNK_SIZE);
+    int request = 0, skipping = 0, type;
+    unsigned requestId;
+    uint32_t length, half;
+
+    if(payload == NULL || result == NULL || sendAllBytes(socketFD, "ENCODE", HANDSHAKE_SIZE) < 0){
+        free(payload);
+        free(result);
+        return;
+    }
+    while(recvAllBytes(socketFD, (char*)header, FRAME_HEADER_SIZE) == 0){
+        type = header[1];
+        requestId = (unsigned)header[2] << 8 | header[3];
+        length = (uint32_t)header[4] << 24 | (uint32_t)header[5] << 16 | (uint32_t)header[6] << 8 | header[7];
+        if(header[0] != FRAME_VERSION || length > 2 * TEST_CHUNK_SIZE || recvAllBytes(socketFD, payload, length) < 0){
+            break;
+        }
+        if(type == FRAME_END){
+            if(!skipping && sendTestFrame(socketFD, FRAME_END, requestId, NULL, 0) < 0){
+                break;
+            }
+            skipping = 0;
+            request++;
+        }
+        else if(type != FRAME_DATA || length % 2 != 0){
+            break;
+        }
+        else if(request == rejectIndex && !skipping){
+            skipping = 1;
+            if(sendTestFrame(socketFD, FRAME_ERROR, requestId, "test rejection", 14) < 0){
+                break;
+            }
+        }
+        else if(!skipping){
+            half = length / 2;
+            encodeExpected(payload, payload + half, result, half);
+            if(sendTestFrame(socketFD, FRAME_RESULT, requestId, result, half) < 0){
+                break;
+            }
+        }
+    }
+    free(payload);
+    free(result);
+}
+
+static void* scriptedDaemonRun(void* argument){
+    struct scriptedDaemon* daemon = argument;
+    struct pollfd listening[TEST_FAILOVER_ENDPOINTS];
+    int i, action, connectionFD;
+
+    for(i = 0; i < daemon->listenCount; i++){
+        listening[i].fd = daemon->listenFDs[i];
+        listening[i].events = POLLIN;
+    }
+    for(;;){
+        if(poll(listening, daemon->listenCount, -1) < 0){
+            continue;
+        }
+        for(i = 0; i < daemon->listenCount; i++){
+            if(!(listening[i].revents & POLLIN) || (connectionFD = accept(listening[i].fd, NULL, NULL)) < 0){
+                continue;
+            }
+            pthread_mutex_lock(&daemon->lock);
+            action = daemon->accepted < daemon->scriptLength ? daemon->script[daemon->accepted] : SCRIPT_SERVE;
+            daemon->accepted++;
+            pthread_mutex_unlock(&daemon->lock);
+            if(action == SCRIPT_BUSY){
+                sendAllBytes(connectionFD, "BUSY  ", HANDSHAKE_SIZE);
+            }
+            else if(action == SCRIPT_SERVE){
+                serveScripted(connectionFD, daemon->rejectIndex);
+            }
+            close(connectionFD);
+        }
+    }
+    return NULL;
+}
+
+/* Listen on count new sockets in socketDirectory, named after name, and add them to endpoints */
+static void startScripted(struct scriptedDaemon* daemon, const char* name, int count, const int* script, int scriptLength, int rejectIndex, struct otpEndpointList* endpoints){
+    pthread_t thread;
+    int i;
+
+    memset(daemon, '\0', sizeof(*daemon));
+    pthread_mutex_init(&daemon->lock, NULL);
+    daemon->script = script;
+    daemon->scriptLength = scriptLength;
+    daemon->rejectIndex = rejectIndex;
+    daemon->listenCount = count;
+    for(i = 0; i < count; i++){
+        snprintf(daemon->paths[i], sizeof(daemon->paths[i]), "%s/%s%d.sock", socketDirectory, name, i);
+        daemon->listenFDs[i] = listenUnix(daemon->paths[i]);
+        if(otpEndpointsAdd(endpoints, NULL, daemon->paths[i]) < 0){
+            fprintf(stderr, "otp_async_test: too many endpoints\n");
+            exit(1);
+        }
+    }
+    if(pthread_create(&thread, NULL, scriptedDaemonRun, daemon) != 0){
+        fprintf(stderr, "otp_async_test: could not start the scripted daemon\n");
+        exit(1);
+    }
+    pthread_detach(thread);
+}
+
+/* Submit every request before processing any, then wait for all of them. Returns 0 on success */
+static int runRequests(const char* name, const struct otpEndpointList* endpoints, struct testRequest* requests, int count){
+    struct otpAsync* async = otpAsyncOpen(endpoints, OTP_ASYNC_ENCODE);
+    int i;
+
+    if(async == NULL){
+        printf("%s: otpAsyncOpen failed\n", name);
+        return -1;
+    }
+    for(i = 0; i < count; i++){
+        if(otpAsyncSubmit(async, requests[i].text, requests[i].key, requests[i].out, requests[i].length, requestDone, &requests[i]) < 0 && requests[i].status == -100){
+            requests[i].status = OTP_ASYNC_ERR_IO;                                    /* No daemon could be reached: the callback does not run */
+            requests[i].order = callbackCount++;
+            snprintf(requests[i].reason, sizeof(requests[i].reason), "%s", strerror(errno));
+        }
+    }
+    if(otpAsyncWait(async, TEST_TIMEOUT_MS) != 0){
+        printf("%s: %zu requests still pending after %d ms\n", name, otpAsyncPending(async), TEST_TIMEOUT_MS);
+        otpAsyncClose(async);
+        return -1;
+    }
+    otpAsyncClose(async);
+    return 0;
+}
+
+static int testPipelining(const char* testPath){
+    struct otpEndpointList endpoints = { .count = 0 };
+    struct testRequest requests[TEST_PIPELINED];
+    char path[sizeof(((struct sockaddr_un*)NULL)->sun_path)];
+    pid_t daemonPid;
+    int i, firstOrder = callbackCount, failed;
+
+    snprintf(path, sizeof(path), "%s/otp_enc_d.sock", socketDirectory);
+    daemonPid = startDaemon(testPath, path);
+    otpEndpointsAdd(&endpoints, NULL, path);
+    for(i = 0; i < TEST_PIPELINED; i++){
+        requestInit(&requests[i], i == 0 ? 0 : i % 10 == 0 ? (size_t)rand() % TEST_MAX_LENGTH : (size_t)rand() % 1000);
+    }
+
+    failed = runRequests("pipelining", &endpoints, requests, TEST_PIPELINED);
+    for(i = 0; !failed && i < TEST_PIPELINED; i++){
+        failed = checkRequest("pipelining", &requests[i], i, firstOrder, OTP_ASYNC_OK);
+    }
+    for(i = 0; i < TEST_PIPELINED; i++){
+        requestFree(&requests[i]);
+    }
+    kill(-daemonPid, SIGTERM);
+    waitpid(daemonPid, NULL, 0);
+    return failed;
+}
+
+static int testRejected(void){
+    static struct scriptedDaemon daemon;
+    struct otpEndpointList endpoints = { .count = 0 };
+    struct testRequest requests[3];
+    int i, firstOrder = callbackCount, failed;
+
+    startScripted(&daemon, "reject", 1, NULL, 0, 1, &endpoints);
+    requestInit(&requests[0], 1000);
+    requestInit(&requests[1], 2 * TEST_CHUNK_SIZE + 5);                          /* Several DATA frames follow the one rejected */
+    requestInit(&requests[2], 1000);
+
+    failed = runRequests("rejected request", &endpoints, requests, 3);
+    for(i = 0; !failed && i < 3; i++){
+        failed = checkRequest("rejected request", &requests[i], i, firstOrder, i == 1 ? OTP_ASYNC_ERR_REJECTED : OTP_ASYNC_OK);
+    }
+    if(!failed && strcmp(requests[1].reason, "test rejection") != 0){
+        printf("rejected request: reason \"%s\"\n", requests[1].reason);
+        failed = -1;
+    }
+    if(!failed && daemon.accepted != 1){
+        printf("rejected request: the handle connected %d times\n", daemon.accepted);
+        failed = -1;
+    }
+    for(i = 0; i < 3; i++){
+        requestFree(&requests[i]);
+    }
+    return failed;
+}
+
+static int testFailover(void){
+    static const int script[] = { SCRIPT_HANG_UP, SCRIPT_BUSY };
+    static struct scriptedDaemon daemon;
+    struct otpEndpointList endpoints = { .count = 0 }, down = { .count = 0 };
+    struct testRequest requests[4];
+    char downPaths[2][sizeof(((struct sockaddr_un*)NULL)->sun_path)];
+    int i, firstOrder = callbackCount, failed;
+
+    startScripted(&daemon, "failover", TEST_FAILOVER_ENDPOINTS, script, 2, -1, &endpoints);
+    for(i = 0; i < 4; i++){
+        requestInit(&requests[i], 100 * i);
+    }
+
+    failed = runRequests("failover", &endpoints, requests, 4);
+    for(i = 0; !failed && i < 4; i++){
+        failed = checkRequest("failover", &requests[i], i, firstOrder, OTP_ASYNC_OK);
+    }
+    if(!failed && daemon.accepted != TEST_FAILOVER_ENDPOINTS){
+        printf("failover: the handle connected %d times, expected %d\n", daemon.accepted, TEST_FAILOVER_ENDPOINTS);
+        failed = -1;
+    }
+
+    for(i = 0; i < 2; i++){                                                     /* Nobody listens on these */
+        snprintf(downPaths[i], sizeof(downPaths[i]), "%s/down%d.sock", socketDirectory, i);
+        otpEndpointsAdd(&down, NULL, downPaths[i]);
+    }
+    for(i = 0; i < 4; i++){
+        requestFree(&requests[i]);
+        requestInit(&requests[i], 100 * i);
+    }
+    firstOrder = callbackCount;
+    if(!failed){
+        failed = runRequests("failover", &down, requests, 4);
+    }
+    for(i = 0; !failed && i < 4; i++){
+        failed = checkRequest("failover with every daemon down", &requests[i], i, firstOrder, OTP_ASYNC_ERR_IO);
+    }
+    for(i = 0; i < 4; i++){
+        requestFree(&requests[i]);
+    }
+    return failed;
+}
+
+static struct otpAsync* closingHandle;                                          /* Closed by the callback of its first request */
+
+static void closingDone(void* context, int status, const char* reason){
+    requestDone(context, status, reason);
+    otpAsyncClose(closingHandle);
+}
+
+static int testCloseFromCallback(void){
+    static struct scriptedDaemon daemon;
+    struct otpEndpointList endpoints = { .count = 0 };
+    struct testRequest requests[3];
+    int i, pending, firstOrder = callbackCount, failed = 0;
+
+    startScripted(&daemon, "close", 1, NULL, 0, -1, &endpoints);
+    closingHandle = otpAsyncOpen(&endpoints, OTP_ASYNC_ENCODE);
+    if(closingHandle == NULL){
+        printf("close from a callback: otpAsyncOpen failed\n");
+        return -1;
+    }
+    for(i = 0; i < 3; i++){
+        requestInit(&requests[i], i == 1 ? 2 * TEST_CHUNK_SIZE : 100);
+        if(otpAsyncSubmit(closingHandle, requests[i].text, requests[i].key, requests[i].out, requests[i].length, i == 0 ? closingDone : requestDone, &requests[i]) < 0){
+            printf("close from a callback: otpAsyncSubmit failed: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+
+    pending = otpAsyncWait(closingHandle, TEST_TIMEOUT_MS);                     /* Frees the handle, which is not touched again */
+    if(pending != 0){
+        printf("close from a callback: otpAsyncWait returned %d\n", pending);
+        failed = -1;
+    }
+    if(!failed){
+        failed = checkRequest("close from a callback", &requests[0], 0, firstOrder, OTP_ASYNC_OK);
+    }
+    for(i = 1; !failed && i < 3; i++){                                          /* Closed while in flight, unless its reply had already arrived */
+        failed = checkRequest("close from a callback", &requests[i], i, firstOrder, requests[i].status == OTP_ASYNC_OK ? OTP_ASYNC_OK : OTP_ASYNC_ERR_IO);
+    }
+    for(i = 0; i < 3; i++){
+        requestFree(&requests[i]);
+    }
+    return failed;
+}
+
+int main(int argc, char* argv[]){
+    int failed = 0;
+    char command[300];
+
+    (void)argc;
+    signal(SIGPIPE, SIG_IGN);
+    srand(1);
+    if(mkdtemp(socketDirectory) == NULL){
+        perror("otp_async_test: mkdtemp");
+        return 1;
+    }
+
+    if(testPipelining(argv[0]) == 0){
+        printf("pipelining: ok\n");
+    }
+    else{
+        failed = 1;
+    }
+    if(testRejected() == 0){
+        printf("rejected request: ok\n");
+    }
+    else{
+        failed = 1;
+    }
+    if(testFailover() == 0){
+        printf("failover: ok\n");
+    }
+    else{
+        failed = 1;
+    }
+    if(testCloseFromCallback() == 0){
+        printf("close from a callback: ok\n");
+    }
+    else{
+        failed = 1;
+    }
+
+    snprintf(command, sizeof(command), "rm -rf %s", socketDirectory);
+    if(system(command) != 0){
+        fprintf(stderr, "otp_async_test: could not remove %s\n", socketDirectory);
+    }
+    return failed;
+}
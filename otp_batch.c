@@ -0,0 +1,401 @@
+/****************************************************************
+* Author: Nicholas Schaffner
+* Last Modified: 10/17/26
+* Description: --batch mode of otp_enc and otp_dec. The manifest lists one job per line, "text key output" separated
+*               by whitespace (blank lines and lines starting with '#' are skipped). --connections N threads each open
+*               one connection to the daemon and keep taking the next job that nobody has started until the list is
+*               used up, so the whole batch pays for process startup and N handshakes once. Each job's output is written
+*               to its output file, followed by a newline. A job that fails does not stop the batch: its output file
+*               is removed, the connection carries on with the next job, and the summary printed to stdout at the end
+*               lists every job as "ok" or "failed" with the reason. Given several daemons, each connection goes to the
+*               one with the fewest of the batch's connections; since a connection carries one job at a time, that is
+*               the daemon with the fewest outstanding requests. A daemon that cannot be reached or is busy is passed
+*               over for the next least loaded one, and a thread whose connection is lost opens a new one the same way.
+*               A thread that cannot connect to any daemon, or that reaches the wrong one, leaves its jobs to the other
+*               threads; jobs that no connection reached are listed as "not attempted" with the reason. The exit value
+*               is 0 when every job succeeded and 1 otherwise.
+****************************************************************/
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "otp_client.h"
+#include "otp_codec.h"
+#include "otp_proto.h"
+
+#define OTP_BATCH_MAX_REASON 80                                                 /* Longest failure reason kept for the summary */
+
+struct otpBatchJob{
+    char* textPath;
+    char* keyPath;
+    char* outputPath;
+    int done;                                                                   /* Set once the job has been attempted */
+    int failed;
+    char reason[OTP_BATCH_MAX_REASON];                                          /* Why the job failed, for the summary */
+};
+
+struct otpBatch{
+    struct otpBatchJob* jobs;
+    size_t jobCount;
+    atomic_size_t next;                                                         /* Next job nobody has started yet */
+    struct otpEndpointList endpoints;
+    int mode;
+    atomic_int connectFailure;                                                  /* OTP_CONNECT_* reason of the last thread that could not connect */
+    pthread_mutex_t lock;                                                       /* Guards connectionCounts */
+    int connectionCounts[OTP_MAX_ENDPOINTS];                                    /* Open or opening connections to each daemon */
+};
+
+static void failJob(struct otpBatchJob* job, const char* reason, int length){
+    job->failed = 1;
+    snprintf(job->reason, sizeof(job->reason), "%.*s", length, reason);
+}
+
+static void freeJobs(struct otpBatch* batch){
+    size_t i;
+
+    for(i = 0; i < batch->jobCount; i++){
+        free(batch->jobs[i].textPath);
+        free(batch->jobs[i].keyPath);
+        free(batch->jobs[i].outputPath);
+    }
+    free(batch->jobs);
+    batch->jobs = NULL;
+    batch->jobCount = 0;
+}
+
+static int loadManifest(const char* path, struct otpBatch* batch){             /* Read every job of the manifest. Returns 0 on success */
+    FILE* manifest = fopen(path, "r");
+    char* line = NULL;
+    size_t lineCapacity = 0;
+    size_t capacity = 0;
+    char text[4096], key[4096], output[4096];
+
+    if(manifest == NULL){
+        fprintf(stderr, "Error: could not open %s\n", path);
+        return -1;
+    }
+
+    batch->jobs = NULL;
+    batch->jobCount = 0;
+    while(getline(&line, &lineCapacity, manifest) != -1){
+        struct otpBatchJob* job;
+        char extra[2];
+        int fields = sscanf(line, "%4095s %4095s %4095s %1s", text, key, output, extra);
+
+        if(fields <= 0 || text[0] == '#'){                                      /* Blank line or comment */
+            continue;
+        }
+        if(fields != 3){
+            fprintf(stderr, "Error: %s line %zu is not \"text key output\"\n", path, batch->jobCount + 1);
+            goto failed;
+        }
+
+        if(batch->jobCount == capacity){
+            size_t grownCapacity = capacity ? 2 * capacity : 64;
+            struct otpBatchJob* grown = realloc(batch->jobs, grownCapacity * sizeof(struct otpBatchJob));
+
+            if(grown == NULL){                                                  /* batch->jobs is still valid, freed below */
+                fprintf(stderr, "Error: out of memory reading %s\n", path);
+                goto failed;
+            }
+            batch->jobs = grown;
+            capacity = grownCapacity;
+        }
+        job = &batch->jobs[batch->jobCount];
+        memset(job, '\0', sizeof(struct otpBatchJob));
+        batch->jobCount++;                                                      /* Counted before its paths, so freeJobs frees whichever were copied */
+        job->textPath = strdup(text);
+        job->keyPath = strdup(key);
+        job->outputPath = strdup(output);
+        if(job->textPath == NULL || job->keyPath == NULL || job->outputPath == NULL){
+            fprintf(stderr, "Error: out of memory reading %s\n", path);
+            goto failed;
+        }
+    }
+
+    free(line);
+    fclose(manifest);
+    return 0;
+
+failed:
+    freeJobs(batch);
+    free(line);
+    fclose(manifest);
+    return -1;
+}
+
+/* Read the reply to one frame of job, writing RESULT payloads to output. Returns the frame type, or -1 when the
+ * connection failed */
+static int recvJobReply(int socketFD, struct otpRecvBuffer* recvBuffer, uint16_t requestId, struct otpBatchJob* job, FILE* output){
+    struct otpFrameHeader header;
+    char* payload;
+
+    if(recvFrame(socketFD, recvBuffer, OTP_CHUNK_SIZE, &header, &payload) != OTP_OK || header.requestId != requestId){
+        failJob(job, "lost the connection to the daemon", -1);
+        return -1;
+    }
+
+    if(header.type == OTP_FRAME_ERROR){                                         /* The daemon skips the rest of this request, END included */
+        failJob(job, payload, header.length);
+    }
+    else if(header.type == OTP_FRAME_RESULT){
+        fwrite(payload, 1, header.length, output);
+    }
+
+    return header.type;
+}
+
+/* Send one job as request requestId on socketFD and write its output. Returns -1 when the connection can no longer
+ * be used, 0 otherwise, whether or not the job itself succeeded */
+static int runJob(int socketFD, struct otpRecvBuffer* recvBuffer, uint16_t requestId, struct otpBatchJob* job){
+    struct otpInput text = {-1, NULL, 0, 0};
+    struct otpInput key = {-1, NULL, 0, 0};
+    FILE* output = NULL;
+    long remaining, textLength;
+    size_t chunk;
+    int outstanding = 0;                                                        /* Number of frames whose reply has not been read yet */
+    int rejected = 0;                                                           /* The daemon answered with ERROR and sends nothing more for this job */
+    int status = 0;
+    int reply;
+
+    if(openInputFile(job->textPath, &text) < 0){
+        failJob(job, "could not open the text file", -1);
+        goto done;
+    }
+    if(openInputFile(job->keyPath, &key) < 0){
+        failJob(job, "could not open the key file", -1);
+        goto done;
+    }
+
+    textLength = text.length;
+    if(text.length > key.length){
+        failJob(job, "key is too short", -1);
+        goto done;
+    }
+    if(!validateInput(&text, text.length) || !validateInput(&key, text.length)){     /* In place, in the mappings */
+        failJob(job, "input contains bad characters", -1);
+        goto done;
+    }
+
+    output = fopen(job->outputPath, "w");
+    if(output == NULL){
+        failJob(job, "could not create the output file", -1);
+        goto done;
+    }
+
+    /* Stream the job like a single otp_enc/otp_dec run, keeping up to OTP_CLIENT_WINDOW frames in flight */
+    remaining = textLength;
+    while(!job->failed && (remaining > 0 || outstanding >= OTP_CLIENT_WINDOW)){
+        if(outstanding >= OTP_CLIENT_WINDOW){
+            reply = recvJobReply(socketFD, recvBuffer, requestId, job, output);
+            if(reply < 0){
+                status = -1;
+                goto done;
+            }
+            rejected = (reply == OTP_FRAME_ERROR);
+            outstanding--;
+            continue;
+        }
+
+        chunk = remaining < OTP_CHUNK_SIZE ? remaining : OTP_CHUNK_SIZE;
+        if(sendFileFrame(socketFD, OTP_FRAME_DATA, requestId, text.fd, textLength - remaining, key.fd, textLength - remaining, chunk) != OTP_OK){
+            failJob(job, "lost the connection to the daemon", -1);
+            status = -1;
+            goto done;
+        }
+        outstanding++;
+        remaining -= chunk;
+    }
+
+    if(sendFrame(socketFD, OTP_FRAME_END, requestId, NULL, 0, NULL, 0) != OTP_OK){     /* Also ends the daemon's skipping after an ERROR */
+        failJob(job, "lost the connection to the daemon", -1);
+        status = -1;
+        goto done;
+    }
+    outstanding++;
+
+    while(outstanding > 0 && !rejected){                                        /* Drain the replies still in flight, END last */
+        reply = recvJobReply(socketFD, recvBuffer, requestId, job, output);
+        if(reply < 0){
+            status = -1;
+            goto done;
+        }
+        rejected = (reply == OTP_FRAME_ERROR);
+        outstanding--;
+    }
+
+    if(!job->failed){
+        fputc('\n', output);                                                    /* Same trailing newline as the output printed to stdout */
+    }
+
+done:
+    if(output != NULL && (fclose(output) != 0 || job->failed)){
+        if(!job->failed){
+            failJob(job, "could not write the output file", -1);
+        }
+        unlink(job->outputPath);                                                /* Never leave a partial output file behind */
+    }
+    closeInputFile(&text);
+    closeInputFile(&key);
+    job->done = 1;
+    return status;
+}
+
+/* Connect to the daemon with the fewest connections of the batch, counting the new one before connecting so threads
+ * starting together spread out, and on to the next least loaded when it cannot be reached or is busy. Returns the socket
+ * with *chosen set, or -1 with the OTP_CONNECT_* reason stored in batch->connectFailure */
+static int openLeastLoaded(struct otpBatch* batch, int* chosen){
+    int tried[OTP_MAX_ENDPOINTS] = {0};
+    int busy = 0;
+    int failure = OTP_CONNECT_FAILED;
+    int attempt, i, socketFD;
+
+    for(attempt = 0; attempt < batch->endpoints.count; attempt++){
+        pthread_mutex_lock(&batch->lock);
+        *chosen = -1;
+        for(i = 0; i < batch->endpoints.count; i++){
+            if(!tried[i] && (*chosen < 0 || batch->connectionCounts[i] < batch->connectionCounts[*chosen])){
+                *chosen = i;
+            }
+        }
+        batch->connectionCounts[*chosen]++;
+        pthread_mutex_unlock(&batch->lock);
+        tried[*chosen] = 1;
+
+        socketFD = openDaemon(&batch->endpoints.endpoints[*chosen], batch->mode, &failure);
+        if(socketFD >= 0){
+            return socketFD;
+        }
+        pthread_mutex_lock(&batch->lock);
+        batch->connectionCounts[*chosen]--;
+        pthread_mutex_unlock(&batch->lock);
+        if(failure == OTP_CONNECT_OTHER_DAEMON){                                /* The wrong kind of daemon is a mistake in the list, not a reason to move on */
+            break;
+        }
+        busy |= (failure == OTP_CONNECT_BUSY);
+    }
+
+    atomic_store(&batch->connectFailure, busy && failure != OTP_CONNECT_OTHER_DAEMON ? OTP_CONNECT_BUSY : failure);
+    return -1;
+}
+
+static void closeConnection(struct otpBatch* batch, int socketFD, int chosen){
+    close(socketFD);
+    pthread_mutex_lock(&batch->lock);
+    batch->connectionCounts[chosen]--;
+    pthread_mutex_unlock(&batch->lock);
+}
+
+static void* runConnection(void* argument){                                     /* Body of one batch thread: one connection at a time, many jobs */
+    struct otpBatch* batch = argument;
+    struct otpRecvBuffer recvBuffer;
+    uint16_t requestId = 0;
+    size_t index;
+    int chosen;
+    int socketFD = openLeastLoaded(batch, &chosen);
+
+    if(socketFD < 0){                                                           /* Leave the jobs to the threads that did connect */
+        return NULL;
+    }
+    if(recvBufferInit(&recvBuffer, OTP_RECV_BUFFER_SIZE) != OTP_OK){         /* Leave the jobs to the other threads */
+        closeConnection(batch, socketFD, chosen);
+        return NULL;
+    }
+
+    while((index = atomic_fetch_add(&batch->next, 1)) < batch->jobCount){
+        if(runJob(socketFD, &recvBuffer, requestId++, &batch->jobs[index]) < 0){     /* This connection is gone, try another one for the next job */
+            closeConnection(batch, socketFD, chosen);
+            recvBuffer.start = recvBuffer.end = 0;                              /* Whatever was left belonged to the lost connection */
+            socketFD = openLeastLoaded(batch, &chosen);
+            if(socketFD < 0){                                                   /* The other threads take the remaining jobs */
+                break;
+            }
+        }
+    }
+
+    if(socketFD >= 0){
+        closeConnection(batch, socketFD, chosen);
+    }
+    recvBufferFree(&recvBuffer);
+    return NULL;
+}
+
+int runBatch(const char* manifestPath, int connections, const struct otpEndpointList* endpoints, int mode){
+    struct otpBatch batch;
+    pthread_t* threadIds;
+    size_t i;
+    int failures = 0;
+    const char* notAttempted;
+    char reason[OTP_BATCH_MAX_REASON];
+
+    if(loadManifest(manifestPath, &batch) != 0){
+        return 1;
+    }
+    batch.endpoints = *endpoints;
+    batch.mode = mode;
+    pthread_mutex_init(&batch.lock, NULL);
+    memset(batch.connectionCounts, '\0', sizeof(batch.connectionCounts));
+    signal(SIGPIPE, SIG_IGN);                                                   /* sendfile has no MSG_NOSIGNAL, a lost connection must fail its job instead */
+    atomic_init(&batch.next, 0);
+    atomic_init(&batch.connectFailure, OTP_CONNECT_OK);
+
+    if((size_t)connections > batch.jobCount){                                   /* No point in connections that would never get a job */
+        connections = batch.jobCount;
+    }
+    threadIds = calloc(connections > 0 ? connections : 1, sizeof(pthread_t));
+    for(i = 0; i < (size_t)connections; i++){
+        if(pthread_create(&threadIds[i], NULL, runConnection, &batch) != 0){
+            fprintf(stderr, "%s: could not start connection thread\n", programName(mode));
+            exit(1);
+        }
+    }
+    for(i = 0; i < (size_t)connections; i++){
+        pthread_join(threadIds[i], NULL);
+    }
+
+    switch(atomic_load(&batch.connectFailure)){                                 /* Why the jobs nobody reached were never attempted */
+        case OTP_CONNECT_FAILED:
+            notAttempted = batch.endpoints.count > 1 ? "not attempted, could not connect to any daemon" : "not attempted, could not connect to the daemon";
+            break;
+        case OTP_CONNECT_OTHER_DAEMON:
+            snprintf(reason, sizeof(reason), "not attempted, the daemon is %s_d", programName(mode == OTP_MODE_ENCODE ? OTP_MODE_DECODE : OTP_MODE_ENCODE));
+            notAttempted = reason;
+            break;
+        case OTP_CONNECT_BUSY:
+            notAttempted = "not attempted, the daemon is busy";
+            break;
+        case OTP_CONNECT_NO_HANDSHAKE:
+            snprintf(reason, sizeof(reason), "not attempted, the daemon is not %s_d", programName(mode));
+            notAttempted = reason;
+            break;
+        default:
+            notAttempted = "not attempted, lost the connection to the daemon";
+            break;
+    }
+
+    for(i = 0; i < batch.jobCount; i++){                                        /* Summary, one line per job in manifest order */
+        struct otpBatchJob* job = &batch.jobs[i];
+
+        if(!job->done){                                                         /* Every connection was lost before this job was reached */
+            failJob(job, notAttempted, -1);
+        }
+        if(job->failed){
+            printf("failed %s: %s\n", job->textPath, job->reason);
+            failures++;
+        }
+        else{
+            printf("ok %s -> %s\n", job->textPath, job->outputPath);
+        }
+    }
+    printf("%zu jobs, %d failed\n", batch.jobCount, failures);
+
+    pthread_mutex_destroy(&batch.lock);
+    freeJobs(&batch);
+    free(threadIds);
+    return failures > 0 ? 1 : 0;
+}
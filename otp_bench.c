@@ -0,0 +1,544 @@
+/****************************************************************
+* Author: Nicholas Schaffner
+* Last Modified: 10/17/26
+* Description: Load generator and end-to-end benchmark for otp_enc_d and otp_dec_d. It starts the daemon (found next to
+*               this program) on a free local port, drives it from --connections N threads that each keep one
+*               connection open, and prints the results as one JSON object on stdout so that runs can be compared
+*               by a script. The syntax for this program is:
+*               otp_bench [--decode] [--unified] [--connections N] [--size N|MIN-MAX|exp:MEAN] [--rate R]
+*                         [--duration SECONDS] [--warmup SECONDS] [-- daemon options...]
+*               --unified starts otp_d, which serves both operations, instead of otp_enc_d or otp_dec_d.
+*               Every request is one message whose length is drawn from --size: a fixed length, uniform between MIN
+*               and MAX, or exponential around MEAN. Without --rate the load is a closed loop: each connection sends
+*               its next message as soon as the previous one has been answered. With --rate R the load is an open
+*               loop: R messages per second are scheduled evenly over the connections and a message's latency counts
+*               from the time it was scheduled, so a daemon that falls behind cannot hide it by slowing the load
+*               down. Only messages started after --warmup and finished within --duration are counted. Every RESULT
+*               is checked against otpTransform, a mismatch or ERROR counts as an error. The report holds the
+*               throughput, p50/p99/p99.9 latency and the CPU time per request spent by the daemon (every process
+*               in its process group) and by this program. Options after -- are passed on to the daemon, for
+*               example -- --engine uring --workers 2.
+****************************************************************/
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+
+#include "otp_client.h"
+#include "otp_codec.h"
+#include "otp_proto.h"
+
+#define BENCH_MAX_DAEMON_ARGS 32
+#define BENCH_EXP_CAP 20                                                        /* Exponential sizes are capped at this many times the mean */
+#define BENCH_STARTUP_TIMEOUT_MS 5000                                           /* How long the daemon gets to start listening */
+
+struct benchOptions{
+    int mode;
+    int unified;                                                                /* Benchmark otp_d instead of the daemon for mode */
+    int connections;
+    size_t minSize;
+    size_t maxSize;
+    double meanSize;                                                            /* Set for exponential sizes, 0 otherwise */
+    double rate;                                                                /* Messages per second over all connections, 0 for a closed loop */
+    double duration;
+    double warmup;
+    char* daemonArgs[BENCH_MAX_DAEMON_ARGS];
+    int daemonArgCount;
+};
+
+struct benchShared{
+    const struct benchOptions* options;
+    struct otpEndpointList endpoints;                                           /* The one daemon started by main */
+    uint64_t startNs;                                                           /* When the connections were started, the open loop schedule begins here */
+    atomic_uint_fast64_t measureStartNs;                                        /* Set by main at the end of the warmup, 0 before */
+    atomic_uint_fast64_t measureEndNs;
+    atomic_int stop;
+};
+
+struct benchThread{
+    struct benchShared* shared;
+    int index;
+    pthread_t threadId;
+    uint64_t* latencies;                                                        /* Latency of every counted message, in nanoseconds */
+    size_t latencyCount;
+    size_t latencyCapacity;
+    uint64_t bytes;                                                             /* Text characters of the counted messages */
+    uint64_t errors;
+    int failed;                                                                 /* The connection was lost */
+};
+
+static void usage(void){
+    fprintf(stderr, "USAGE: otp_bench [--decode] [--unified] [--connections N] [--size N|MIN-MAX|exp:MEAN] [--rate R] [--duration SECONDS] [--warmup SECONDS] [-- daemon options...]\n");
+    exit(1);
+}
+
+static uint64_t nowNs(void){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static void sleepUntilNs(uint64_t deadline){
+    struct timespec until;
+
+    until.tv_sec = deadline / 1000000000ull;
+    until.tv_nsec = deadline % 1000000000ull;
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR);
+}
+
+static uint64_t nextRandom(uint64_t* state){                                    /* xorshift64*, plenty for picking sizes */
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ull;
+}
+
+static size_t pickSize(const struct benchOptions* options, uint64_t* state){
+    double uniform = (nextRandom(state) >> 11) * (1.0 / 9007199254740992.0);   /* In [0, 1) */
+    size_t size;
+
+    if(options->meanSize > 0){
+        size = (size_t)(-log(1.0 - uniform) * options->meanSize) + 1;
+        return size < options->maxSize ? size : options->maxSize;
+    }
+    return options->minSize + (size_t)(uniform * (options->maxSize - options->minSize + 1));
+}
+
+static void parseSize(const char* spec, struct benchOptions* options){
+    char* end;
+
+    if(strncmp(spec, "exp:", 4) == 0){
+        options->meanSize = strtod(spec + 4, &end);
+        if(*end != '\0' || options->meanSize < 1){
+            usage();
+        }
+        options->minSize = 1;
+        options->maxSize = (size_t)(BENCH_EXP_CAP * options->meanSize);
+        return;
+    }
+
+    options->minSize = strtoul(spec, &end, 10);
+    options->maxSize = options->minSize;
+    if(*end == '-'){
+        options->maxSize = strtoul(end + 1, &end, 10);
+    }
+    if(*end != '\0' || options->minSize < 1 || options->maxSize < options->minSize){
+        usage();
+    }
+}
+
+static void parseBenchOptions(int argc, char* argv[], struct benchOptions* options){
+    static struct option longOptions[] = {
+        {"decode", no_argument, NULL, 'D'},
+        {"unified", no_argument, NULL, 'U'},
+        {"connections", required_argument, NULL, 'c'},
+        {"size", required_argument, NULL, 's'},
+        {"rate", required_argument, NULL, 'r'},
+        {"duration", required_argument, NULL, 'd'},
+        {"warmup", required_argument, NULL, 'w'},
+        {NULL, 0, NULL, 0}
+    };
+    int option;
+
+    memset(options, '\0', sizeof(*options));
+    options->mode = OTP_MODE_ENCODE;
+    options->connections = OTP_BATCH_DEFAULT_CONNECTIONS;
+    options->minSize = options->maxSize = 1000;
+    options->duration = 5;
+    options->warmup = 1;
+
+    while((option = getopt_long(argc, argv, "DUc:s:r:d:w:", longOptions, NULL)) != -1){
+        switch(option){
+            case 'D':
+                options->mode = OTP_MODE_DECODE;
+                break;
+            case 'U':
+                options->unified = 1;
+                break;
+            case 'c':
+                options->connections = atoi(optarg);
+                if(options->connections < 1){
+                    usage();
+                }
+                break;
+            case 's':
+                parseSize(optarg, options);
+                break;
+            case 'r':
+                options->rate = atof(optarg);
+                break;
+            case 'd':
+                options->duration = atof(optarg);
+                break;
+            case 'w':
+                options->warmup = atof(optarg);
+                break;
+            default:
+                usage();
+        }
+    }
+    if(options->duration <= 0 || options->rate < 0 || options->warmup < 0){
+        usage();
+    }
+
+    for(; optind < argc; optind++){                                             /* Everything after -- goes to the daemon */
+        if(options->daemonArgCount == BENCH_MAX_DAEMON_ARGS - 3){               /* Leave room for the program name, port and NULL */
+            usage();
+        }
+        options->daemonArgs[options->daemonArgCount++] = argv[optind];
+    }
+}
+
+static const char* daemonName(const struct benchOptions* options){
+    if(options->unified){
+        return "otp_d";
+    }
+    return options->mode == OTP_MODE_ENCODE ? "otp_enc_d" : "otp_dec_d";
+}
+
+static int freePort(void){                                                      /* Let the kernel pick a port nobody is listening on */
+    struct sockaddr_in address;
+    socklen_t length = sizeof(address);
+    int socketFD = socket(AF_INET, SOCK_STREAM, 0);
+
+    memset(&address, '\0', sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(socketFD < 0 || bind(socketFD, (struct sockaddr*)&address, sizeof(address)) < 0 || getsockname(socketFD, (struct sockaddr*)&address, &length) < 0){
+        perror("otp_bench: could not find a free port");
+        exit(1);
+    }
+    close(socketFD);
+    return ntohs(address.sin_port);
+}
+
+static int daemonListening(int portNumber){
+    struct sockaddr_in address;
+    int socketFD = socket(AF_INET, SOCK_STREAM, 0);
+    int connected;
+
+    memset(&address, '\0', sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(portNumber);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    connected = connect(socketFD, (struct sockaddr*)&address, sizeof(address)) == 0;
+    close(socketFD);
+    return connected;
+}
+
+/* Start daemonName() on portNumber, in a process group of its own so its CPU time can be told apart */
+static pid_t startDaemon(const char* benchPath, const struct benchOptions* options, int portNumber){
+    char daemonPath[4096];
+    char portText[16];
+    char* argv[BENCH_MAX_DAEMON_ARGS];
+    const char* slash = strrchr(benchPath, '/');
+    pid_t daemonPid;
+    int i, waited;
+
+    snprintf(daemonPath, sizeof(daemonPath), "%.*s%s", slash != NULL ? (int)(slash - benchPath + 1) : 2, slash != NULL ? benchPath : "./", daemonName(options));
+    snprintf(portText, sizeof(portText), "%d", portNumber);
+    argv[0] = daemonPath;
+    for(i = 0; i < options->daemonArgCount; i++){
+        argv[i + 1] = options->daemonArgs[i];
+    }
+    argv[i + 1] = portText;
+    argv[i + 2] = NULL;
+
+    daemonPid = fork();
+    if(daemonPid < 0){
+        perror("otp_bench: fork");
+        exit(1);
+    }
+    if(daemonPid == 0){
+        setpgid(0, 0);
+        prctl(PR_SET_PDEATHSIG, SIGTERM);                                       /* Do not outlive the benchmark */
+        execv(daemonPath, argv);
+        fprintf(stderr, "otp_bench: could not run %s\n", daemonPath);
+        _exit(1);
+    }
+    setpgid(daemonPid, daemonPid);                                              /* Also here, so the group exists before the first sample */
+
+    for(waited = 0; !daemonListening(portNumber); waited += 10){
+        if(waited >= BENCH_STARTUP_TIMEOUT_MS || waitpid(daemonPid, NULL, WNOHANG) != 0){
+            fprintf(stderr, "otp_bench: %s did not start listening on port %d\n", daemonPath, portNumber);
+            exit(1);
+        }
+        usleep(10000);
+    }
+
+    return daemonPid;
+}
+
+/* CPU time in seconds used so far by every process in the group, including children they have already reaped */
+static double groupCpuSeconds(pid_t group){
+    DIR* proc = opendir("/proc");
+    struct dirent* entry;
+    char path[300], line[1024];
+    unsigned long long utime, stime, cutime, cstime, total = 0;
+    int pgrp;
+
+    if(proc == NULL){
+        return 0;
+    }
+    while((entry = readdir(proc)) != NULL){
+        FILE* stat;
+        char* fields;
+
+        if(entry->d_name[0] < '0' || entry->d_name[0] > '9'){
+            continue;
+        }
+        snprintf(path, sizeof(path), "/proc/%s/stat", entry->d_name);
+        stat = fopen(path, "r");
+        if(stat == NULL){                                                       /* Exited since readdir */
+            continue;
+        }
+        fields = fgets(line, sizeof(line), stat) != NULL ? strrchr(line, ')') : NULL;    /* The command name may contain spaces */
+        fclose(stat);
+        if(fields != NULL && sscanf(fields, ") %*c %*d %d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu %llu %llu", &pgrp, &utime, &stime, &cutime, &cstime) == 5 && pgrp == group){
+            total += utime + stime + cutime + cstime;
+        }
+    }
+    closedir(proc);
+
+    return (double)total / sysconf(_SC_CLK_TCK);
+}
+
+static double selfCpuSeconds(void){
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static void recordLatency(struct benchThread* thread, uint64_t latency){
+    if(thread->latencyCount == thread->latencyCapacity){
+        thread->latencyCapacity = thread->latencyCapacity ? 2 * thread->latencyCapacity : 4096;
+        thread->latencies = realloc(thread->latencies, thread->latencyCapacity * sizeof(uint64_t));
+    }
+    thread->latencies[thread->latencyCount++] = latency;
+}
+
+/* Send one message of length characters as request requestId and check every reply against expected. Returns -1 when
+ * the connection was lost, 1 when the daemon answered wrongly and 0 when the message came back correct */
+static int runMessage(int socketFD, struct otpRecvBuffer* recvBuffer, uint16_t requestId, const char* text, const char* key, const char* expected, size_t length){
+    struct otpFrameHeader header;
+    char* payload;
+    size_t sent = 0, received = 0, chunk;
+    int outstanding = 0;                                                        /* Number of frames whose reply has not been read yet */
+    int wrong = 0;
+
+    while(sent < length || outstanding > 0){
+        if(sent < length && outstanding < OTP_CLIENT_WINDOW){
+            chunk = length - sent < OTP_CHUNK_SIZE ? length - sent : OTP_CHUNK_SIZE;
+            if(sendFrame(socketFD, OTP_FRAME_DATA, requestId, text + sent, chunk, key + sent, chunk) != OTP_OK){
+                return -1;
+            }
+            sent += chunk;
+            outstanding++;
+            if(sent == length){                                                 /* Pipeline the END right behind the last DATA frame */
+                if(sendFrame(socketFD, OTP_FRAME_END, requestId, NULL, 0, NULL, 0) != OTP_OK){
+                    return -1;
+                }
+                outstanding++;
+            }
+            continue;
+        }
+
+        if(recvFrame(socketFD, recvBuffer, OTP_CHUNK_SIZE, &header, &payload) != OTP_OK || header.requestId != requestId){
+            return -1;
+        }
+        outstanding--;
+        if(header.type == OTP_FRAME_ERROR){                                     /* The daemon drops the rest of the request, END included */
+            return 1;
+        }
+        if(header.type == OTP_FRAME_RESULT){
+            if(received + header.length > length || memcmp(payload, expected + received, header.length) != 0){
+                wrong = 1;
+            }
+            received += header.length;
+        }
+    }
+
+    return wrong || received != length;
+}
+
+static void* runBenchThread(void* argument){                                    /* Body of one connection: send messages until main says stop */
+    struct benchThread* thread = argument;
+    struct benchShared* shared = thread->shared;
+    const struct benchOptions* options = shared->options;
+    struct otpRecvBuffer recvBuffer;
+    uint64_t randomState = 0x9E3779B97F4A7C15ull * (thread->index + 1);
+    uint64_t interval = options->rate > 0 ? (uint64_t)(1e9 * options->connections / options->rate) : 0;
+    uint64_t scheduled = shared->startNs + interval * thread->index / options->connections;   /* Spread the connections over one interval */
+    uint64_t begin, end, measureStart;
+    uint16_t requestId = 0;
+    char* text = malloc(options->maxSize);
+    char* key = malloc(options->maxSize);
+    char* expected = malloc(options->maxSize);
+    size_t i, length;
+    int socketFD, status;
+
+    for(i = 0; i < options->maxSize; i++){                                      /* Any text of allowed characters is valid input for both daemons */
+        text[i] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ "[nextRandom(&randomState) % 27];
+        key[i] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ "[nextRandom(&randomState) % 27];
+    }
+    otpTransform(options->mode, text, key, expected, options->maxSize);        /* A message is a prefix, and so is its expected reply */
+
+    socketFD = connectDaemon(&shared->endpoints, options->mode);
+    if(recvBufferInit(&recvBuffer, OTP_RECV_BUFFER_SIZE) != OTP_OK){
+        fprintf(stderr, "otp_bench: out of memory\n");
+        exit(1);
+    }
+
+    while(!atomic_load(&shared->stop)){
+        length = pickSize(options, &randomState);
+        if(interval > 0){                                                       /* Open loop: wait for the slot, but never skip one that is overdue */
+            sleepUntilNs(scheduled);
+            begin = scheduled;
+            scheduled += interval;
+        }
+        else{
+            begin = nowNs();
+        }
+
+        status = runMessage(socketFD, &recvBuffer, requestId++, text, key, expected, length);
+        end = nowNs();
+
+        measureStart = atomic_load(&shared->measureStartNs);
+        if(measureStart != 0 && begin >= measureStart && end <= atomic_load(&shared->measureEndNs)){
+            if(status == 0){
+                recordLatency(thread, end - begin);
+                thread->bytes += length;
+            }
+            else{
+                thread->errors++;
+            }
+        }
+        if(status < 0){
+            thread->failed = 1;
+            break;
+        }
+    }
+
+    close(socketFD);
+    recvBufferFree(&recvBuffer);
+    free(text);
+    free(key);
+    free(expected);
+    return NULL;
+}
+
+static int compareLatency(const void* a, const void* b){
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentileUs(const uint64_t* sorted, size_t count, double fraction){    /* Nearest-rank percentile */
+    size_t rank;
+
+    if(count == 0){
+        return 0;
+    }
+    rank = (size_t)ceil(fraction * count);
+    return sorted[rank > 0 ? rank - 1 : 0] / 1000.0;
+}
+
+int main(int argc, char* argv[]){
+    struct benchOptions options;
+    struct benchShared shared;
+    struct benchThread* threads;
+    uint64_t* latencies;
+    size_t latencyCount = 0, requests;
+    uint64_t bytes = 0, errors = 0;
+    double daemonCpu, selfCpu, seconds;
+    pid_t daemonPid;
+    int i, failedConnections = 0;
+
+    parseBenchOptions(argc, argv, &options);
+    signal(SIGPIPE, SIG_IGN);                                                   /* A daemon that goes away must show up as failed connections */
+
+    memset(&shared, '\0', sizeof(shared));
+    shared.options = &options;
+    shared.endpoints.count = 1;
+    shared.endpoints.endpoints[0].portNumber = freePort();
+    daemonPid = startDaemon(argv[0], &options, shared.endpoints.endpoints[0].portNumber);
+    atomic_init(&shared.measureStartNs, 0);
+    atomic_init(&shared.measureEndNs, 0);
+    atomic_init(&shared.stop, 0);
+
+    threads = calloc(options.connections, sizeof(struct benchThread));
+    shared.startNs = nowNs();
+    for(i = 0; i < options.connections; i++){
+        threads[i].shared = &shared;
+        threads[i].index = i;
+        if(pthread_create(&threads[i].threadId, NULL, runBenchThread, &threads[i]) != 0){
+            fprintf(stderr, "otp_bench: could not start connection thread\n");
+            exit(1);
+        }
+    }
+
+    /* Warm up, then sample the CPU counters around the measured window */
+    sleepUntilNs(shared.startNs + (uint64_t)(options.warmup * 1e9));
+    daemonCpu = groupCpuSeconds(daemonPid);
+    selfCpu = selfCpuSeconds();
+    atomic_store(&shared.measureEndNs, UINT64_MAX);
+    atomic_store(&shared.measureStartNs, nowNs());
+    sleepUntilNs(atomic_load(&shared.measureStartNs) + (uint64_t)(options.duration * 1e9));
+    atomic_store(&shared.measureEndNs, nowNs());
+    daemonCpu = groupCpuSeconds(daemonPid) - daemonCpu;
+    selfCpu = selfCpuSeconds() - selfCpu;
+    seconds = (atomic_load(&shared.measureEndNs) - atomic_load(&shared.measureStartNs)) / 1e9;
+
+    atomic_store(&shared.stop, 1);
+    for(i = 0; i < options.connections; i++){
+        pthread_join(threads[i].threadId, NULL);
+        latencyCount += threads[i].latencyCount;
+        bytes += threads[i].bytes;
+        errors += threads[i].errors;
+        failedConnections += threads[i].failed;
+    }
+    kill(daemonPid, SIGTERM);
+    waitpid(daemonPid, NULL, 0);
+
+    latencies = malloc((latencyCount > 0 ? latencyCount : 1) * sizeof(uint64_t));
+    for(latencyCount = 0, i = 0; i < options.connections; i++){
+        memcpy(latencies + latencyCount, threads[i].latencies, threads[i].latencyCount * sizeof(uint64_t));
+        latencyCount += threads[i].latencyCount;
+        free(threads[i].latencies);
+    }
+    qsort(latencies, latencyCount, sizeof(uint64_t), compareLatency);
+    requests = latencyCount + errors;
+
+    printf("{\"daemon\": \"%s\", \"mode\": \"%s\", \"daemon_args\": \"", daemonName(&options), options.mode == OTP_MODE_ENCODE ? "encode" : "decode");
+    for(i = 0; i < options.daemonArgCount; i++){                                /* Daemon options never contain quotes or backslashes worth escaping */
+        printf("%s%s", i > 0 ? " " : "", options.daemonArgs[i]);
+    }
+    printf("\", \"codec\": \"%s\", \"connections\": %d, \"loop\": \"%s\", \"rate\": %.1f, ", otpCodecName(), options.connections, options.rate > 0 ? "open" : "closed", options.rate);
+    printf("\"size_min\": %zu, \"size_max\": %zu, \"size_mean\": %.1f, \"seconds\": %.3f, ", options.minSize, options.maxSize, options.meanSize, seconds);
+    printf("\"requests\": %zu, \"errors\": %llu, \"failed_connections\": %d, ", requests, (unsigned long long)errors, failedConnections);
+    printf("\"throughput_rps\": %.1f, \"throughput_mb_s\": %.3f, ", latencyCount / seconds, bytes / seconds / 1e6);
+    printf("\"latency_us\": {\"p50\": %.1f, \"p99\": %.1f, \"p99_9\": %.1f, \"max\": %.1f}, ", percentileUs(latencies, latencyCount, 0.5), percentileUs(latencies, latencyCount, 0.99), percentileUs(latencies, latencyCount, 0.999), percentileUs(latencies, latencyCount, 1.0));
+    printf("\"cpu_us_per_request\": {\"daemon\": %.1f, \"bench\": %.1f}}\n", requests > 0 ? 1e6 * daemonCpu / requests : 0.0, requests > 0 ? 1e6 * selfCpu / requests : 0.0);
+
+    free(latencies);
+    free(threads);
+    return errors > 0 || failedConnections > 0 ? 1 : 0;
+}
@@ -0,0 +1,618 @@
+/****************************************************************
+* Author: Nicholas Schaffner
+* Last Modified: 10/17/26
+* Description: Connects to otp_enc_d or otp_dec_d (or otp_d) and streams one or more text files and their key files through it.
+*               Both files are mapped read-only and checked for bad characters in place, then sent one chunk at a time
+*               as DATA frames (see otp_proto.h), copied by the kernel straight from the page cache pages behind the
+*               mapping to the socket with sendfile, while the RESULT frames for earlier chunks are written to stdout.
+*               The input is never copied into the client, so very large files pass through in constant memory. Up to
+*               OTP_CLIENT_WINDOW frames are kept in flight so the daemon never waits for the client between chunks.
+*               Every message is one request on the same connection, tagged with its position as the request ID, and the
+*               next message is sent while the replies to the previous one are still arriving, so extra messages cost
+*               neither a connection nor a handshake. Each message's output is followed by a newline.
+*               With --pad NAME[@OFFSET] there is no key file: the key comes from the daemon's key pad NAME, starting at
+*               OFFSET or, without one, at the next unused range, whose offset is reported on stderr as "key NAME@OFFSET"
+*               so the message can be decoded later with the same --pad argument. With --stats the client sends no
+*               message and prints the daemon's live metrics instead. With --packed the client asks the daemon for the
+*               packed wire format (see otp_proto.h): it packs every chunk 5 characters to 3 bytes before sending it,
+*               which costs a pass over the input instead of sendfile but cuts the bytes on the wire by 40%, and
+*               unpacks the results. A daemon that does not know the format is served in text as before. With --binary
+*               the files may hold any bytes: they are taken whole, trailing newline included, and not checked, the
+*               daemon XORs them with the key (see OTP_FORMAT_BINARY) and the output gets no newline, so binary data
+*               needs no transcoding. A daemon that does not know that format is an error. Given a list of daemons, the
+*               client tries them in the order rendezvous hashing of its process ID gives, passing over any that cannot
+*               be reached or is busy, so clients spread evenly and a daemon that is down moves only its own share.
+****************************************************************/
+
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <getopt.h>
+
+#include "otp_codec.h"
+#include "otp_keystore.h"
+#include "otp_proto.h"
+#include "otp_client.h"
+
+struct otpMessage{                                                              /* One text file and the key it is transformed with */
+    struct otpInput text;
+    struct otpInput key;                                                        /* fd is -1 when the key comes from a daemon pad */
+    long textLength;
+};
+
+struct otpReplyState{                                                           /* Progress through the replies, which come back in request order */
+    int message;                                                                /* Index of the message the next reply belongs to */
+    const char* pad;                                                            /* --pad argument, to report the offsets the daemon picked */
+    int mode;
+    int format;                                                                 /* Wire format the daemon agreed to, OTP_FORMAT_BINARY output gets no newline */
+    char* unpacked;                                                             /* OTP_CHUNK_SIZE bytes to unpack a packed RESULT into */
+};
+
+static void error(const char *msg){                                             /* Error function used for reporting issues */
+    perror(msg);
+    exit(0);
+}
+
+const char* programName(int mode){
+    return mode == OTP_MODE_ENCODE ? "otp_enc" : "otp_dec";
+}
+
+/* Open and map the file at path. Returns 0, or -1 with errno set when it cannot be opened, is not a regular file or
+ * cannot be mapped */
+int openInputFile(const char* path, struct otpInput* input){
+    struct stat status;
+    void* data = NULL;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if(fd < 0){
+        return -1;
+    }
+    if(fstat(fd, &status) < 0 || !S_ISREG(status.st_mode)){                     /* sendfile and the mapping both need a regular file */
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(status.st_size > 0){                                                     /* A zero length mapping is an error */
+        data = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(data == MAP_FAILED){
+            close(fd);
+            return -1;
+        }
+        madvise(data, status.st_size, MADV_SEQUENTIAL);                         /* Read ahead aggressively and drop pages behind the scan */
+    }
+
+    input->fd = fd;
+    input->data = data;
+    input->size = status.st_size;
+    input->length = input->size;
+    if(input->length > 0 && input->data[input->length - 1] == '\n'){           /* The newline character is not part of the message */
+        input->length--;
+    }
+    return 0;
+}
+
+void closeInputFile(struct otpInput* input){
+    if(input->data != NULL){
+        munmap((void*)input->data, input->size);
+    }
+    if(input->fd >= 0){
+        close(input->fd);
+    }
+    input->fd = -1;
+    input->data = NULL;
+}
+
+static void releaseWindow(const struct otpInput* input, size_t offset, size_t length){    /* Unmap the pages of a window that has been scanned */
+    madvise((char*)input->data + offset, length, MADV_DONTNEED);                /* Read-only pages are dropped, not lost: they stay in the page cache for sendfile */
+}
+
+/* Return 1 if the first length characters of input are all allowed characters. Checked in place, one window at a time,
+ * so a huge file never has more than OTP_INPUT_WINDOW bytes mapped in */
+int validateInput(const struct otpInput* input, size_t length){
+    size_t offset, window;
+
+    for(offset = 0; offset < length; offset += window){
+        window = length - offset < OTP_INPUT_WINDOW ? length - offset : OTP_INPUT_WINDOW;
+        if(!otpValidate(input->data + offset, window)){
+            return 0;
+        }
+        releaseWindow(input, offset, window);
+    }
+    return 1;
+}
+
+static void openInput(const char* path, struct otpInput* input){                /* Open a file passed in as an argument, reporting an error and exiting if it cannot be read */
+    if(openInputFile(path, input) < 0){
+        fprintf(stderr, "Error: could not open %s\n", path);
+        exit(1);
+    }
+}
+
+static void recvReply(int socketFD, struct otpRecvBuffer* recvBuffer, struct otpReplyState* state){  /* Read one reply from the daemon and act on it */
+    struct otpFrameHeader header;
+    char* buffer;
+
+    if(recvFrame(socketFD, recvBuffer, OTP_CHUNK_SIZE, &header, &buffer) != OTP_OK){
+        error("CLIENT: ERROR reading from socket");
+    }
+    if(header.requestId != (uint16_t)state->message){                          /* Replies come back in the order the requests were sent */
+        error("CLIENT: ERROR reading from socket");
+    }
+
+    switch(header.type){
+        case OTP_FRAME_ERROR:                                                   /* The daemon rejected the request */
+            fprintf(stderr, "%s error: %.*s\n", programName(state->mode), (int)header.length, buffer);
+            exit(1);
+        case OTP_FRAME_RESULT:
+            if(state->format == OTP_FORMAT_PACKED){
+                uint64_t length = header.length >= OTP_PACKED_COUNT_SIZE ? decodeUint64(buffer) : OTP_CHUNK_SIZE + 1;
+
+                if(length > OTP_CHUNK_SIZE || header.length != OTP_PACKED_COUNT_SIZE + OTP_PACKED_SIZE(length) ||
+                   !otpPackedValidate(buffer + OTP_PACKED_COUNT_SIZE, length)){
+                    error("CLIENT: ERROR reading from socket");
+                }
+                otpUnpack(buffer + OTP_PACKED_COUNT_SIZE, length, state->unpacked);
+                fwrite(state->unpacked, 1, length, stdout);
+                break;
+            }
+            fwrite(buffer, 1, header.length, stdout);                           /* Print the transformed characters to stdout */
+            break;
+        case OTP_FRAME_KEY:
+            if(header.length == 8 && strchr(state->pad, '@') == NULL){          /* The daemon picked the range, the caller needs it to decode */
+                fprintf(stderr, "key %s@%" PRIu64 "\n", state->pad, decodeUint64(buffer));
+            }
+            break;
+        case OTP_FRAME_END:                                                     /* The message is complete */
+            if(state->format != OTP_FORMAT_BINARY){
+                printf("\n");                                                   /* Print out a newline character after the transformed text */
+            }
+            state->message++;
+            break;
+        default:
+            error("CLIENT: ERROR reading from socket");
+    }
+}
+
+static void releaseRead(const struct otpMessage* message, long done){            /* The first done characters have been read from the mappings, let go of every finished window */
+    if(done % OTP_INPUT_WINDOW == 0 || done == message->textLength){            /* Chunks never straddle a window, OTP_INPUT_WINDOW is a multiple of OTP_CHUNK_SIZE */
+        size_t windowStart = (done - 1) / OTP_INPUT_WINDOW * OTP_INPUT_WINDOW;
+        releaseWindow(&message->text, windowStart, done - windowStart);
+        releaseWindow(&message->key, windowStart, done - windowStart);
+    }
+}
+
+static void transformLocally(const struct otpMessage* message, int mode, char* out){    /* --local: run the daemon's codec in this process, OTP_MODE_XOR for --binary */
+    long done = 0;
+    size_t chunk;
+
+    while(done < message->textLength){                                          /* Straight from the mappings, a chunk of output at a time */
+        chunk = message->textLength - done < OTP_CHUNK_SIZE ? message->textLength - done : OTP_CHUNK_SIZE;
+        otpTransform(mode, message->text.data + done, message->key.data + done, out, chunk);
+        fwrite(out, 1, chunk, stdout);                                          /* Print the transformed characters to stdout */
+        done += chunk;
+        releaseRead(message, done);
+    }
+
+    if(mode != OTP_MODE_XOR){
+        printf("\n");                                                           /* Print out a newline character after the transformed text */
+    }
+}
+
+/* Connect to the daemon at endpoint and check that it runs in mode. Returns the socket, or -1 with *failure set to
+ * one of the OTP_CONNECT_* reasons, so a caller with other work to do can carry on */
+int openDaemon(const struct otpEndpoint* endpoint, int mode, int* failure){
+    int socketFD = otpEndpointConnect(endpoint, 0);
+    char handshake[OTP_HANDSHAKE_SIZE] = {0};
+    char operation = mode;
+    int unified;
+
+    if(socketFD < 0){
+        *failure = OTP_CONNECT_FAILED;
+        return -1;
+    }
+
+    /* Check to see if this program is connected to the correct daemon. The daemon's first 6 characters name its mode */
+    if(recvAll(socketFD, handshake, OTP_HANDSHAKE_SIZE) != OTP_OK){
+        *failure = OTP_CONNECT_NO_HANDSHAKE;
+    }
+    else{
+        *failure = otpCheckHandshake(handshake, mode, &unified);
+        if(*failure == OTP_CONNECT_OK && unified){                              /* otp_d: name the operation once, it holds for every request */
+            *failure = sendFrame(socketFD, OTP_FRAME_MODE, 0, &operation, 1, NULL, 0) == OTP_OK ? OTP_CONNECT_OK : OTP_CONNECT_FAILED;
+        }
+    }
+
+    if(*failure != OTP_CONNECT_OK){
+        close(socketFD);
+        return -1;
+    }
+    return socketFD;
+}
+
+/* Try the endpoints in order until one of them serves mode. A daemon that cannot be reached, hangs up without a
+ * greeting or is busy is skipped for the next one, but the daemon of the other mode ends the search as it would with a
+ * single daemon. Returns the socket with *chosen set to its index, or -1 with *failure set to the reason: the other
+ * daemon's (*chosen names it), OTP_CONNECT_BUSY when any daemon was busy, or else the failure of the last daemon tried */
+int openAnyDaemon(const struct otpEndpointList* endpoints, const int* order, int mode, int* failure, int* chosen){
+    int busy = 0;
+    int i, socketFD;
+
+    for(i = 0; i < endpoints->count; i++){
+        *chosen = order[i];
+        socketFD = openDaemon(&endpoints->endpoints[order[i]], mode, failure);
+        if(socketFD >= 0 || *failure == OTP_CONNECT_OTHER_DAEMON){
+            return socketFD;
+        }
+        busy |= (*failure == OTP_CONNECT_BUSY);
+    }
+
+    if(busy){                                                                   /* Worth trying again later, unlike a daemon that is down */
+        *failure = OTP_CONNECT_BUSY;
+    }
+    return -1;
+}
+
+/* Same as openAnyDaemon over all of endpoints, ranked for this process, but report a failure and exit. Each client
+ * process starts at a different daemon, so clients run side by side spread evenly over them */
+int connectDaemon(const struct otpEndpointList* endpoints, int mode){
+    int otherMode = (mode == OTP_MODE_ENCODE) ? OTP_MODE_DECODE : OTP_MODE_ENCODE;
+    int order[OTP_MAX_ENDPOINTS];
+    int failure, chosen = 0;
+    int socketFD;
+    const struct otpEndpoint* endpoint;
+
+    otpEndpointsRank(endpoints, getpid(), order);
+    socketFD = openAnyDaemon(endpoints, order, mode, &failure, &chosen);
+    if(socketFD >= 0){
+        return socketFD;
+    }
+    if(failure == OTP_CONNECT_FAILED){
+        error("CLIENT: ERROR connecting");
+    }
+    if(failure == OTP_CONNECT_BUSY){
+        fprintf(stderr, "Error: %s_d is busy, try again later\n", programName(mode));
+        exit(2);
+    }
+
+    endpoint = &endpoints->endpoints[chosen];
+    if(endpoint->unixPath != NULL){
+        fprintf(stderr, "Error: could not contact %s_d on %s\n", programName(failure == OTP_CONNECT_OTHER_DAEMON ? otherMode : mode), endpoint->unixPath);
+    }
+    else{
+        fprintf(stderr, "Error: could not contact %s_d on port %d\n", programName(failure == OTP_CONNECT_OTHER_DAEMON ? otherMode : mode), endpoint->portNumber);   /* Name the daemon that answered, as before */
+    }
+    exit(2);                                                                    /* Exit the program */
+}
+
+/* Ask the daemon for a wire format. Returns format once the daemon confirms it, or OTP_FORMAT_TEXT for a daemon that
+ * rejects it. Such a daemon took the FORMAT frame for the start of request 0, so that request is ended before any other */
+static int negotiateFormat(int socketFD, struct otpRecvBuffer* recvBuffer, char format){
+    struct otpFrameHeader header;
+    char* payload;
+
+    if(sendFrame(socketFD, OTP_FRAME_FORMAT, 0, &format, 1, NULL, 0) != OTP_OK){
+        error("CLIENT: ERROR writing to socket");
+    }
+    if(recvFrame(socketFD, recvBuffer, OTP_CHUNK_SIZE, &header, &payload) != OTP_OK){
+        error("CLIENT: ERROR reading from socket");
+    }
+    if(header.type == OTP_FRAME_FORMAT && header.length == 1 && payload[0] == format){
+        return format;
+    }
+    if(header.type != OTP_FRAME_ERROR){
+        error("CLIENT: ERROR reading from socket");
+    }
+    if(sendFrame(socketFD, OTP_FRAME_END, 0, NULL, 0, NULL, 0) != OTP_OK){      /* Dropped by the daemon with the rest of the failed request */
+        error("CLIENT: ERROR writing to socket");
+    }
+    return OTP_FORMAT_TEXT;
+}
+
+/* Send chunk characters of message from offset as a packed DATA frame, built in frame, with the key unless it comes from a pad */
+static int sendPackedFrame(int socketFD, uint16_t requestId, const struct otpMessage* message, long offset, size_t chunk, char* frame){
+    size_t packedSize = OTP_PACKED_SIZE(chunk);
+
+    encodeUint64(frame, chunk);
+    otpPack(message->text.data + offset, chunk, frame + OTP_PACKED_COUNT_SIZE);
+    if(message->key.fd >= 0){
+        otpPack(message->key.data + offset, chunk, frame + OTP_PACKED_COUNT_SIZE + packedSize);
+    }
+    releaseRead(message, offset + chunk);                                       /* Read through the mappings, unlike sendfile */
+
+    return sendFrame(socketFD, OTP_FRAME_DATA, requestId, frame, OTP_PACKED_COUNT_SIZE + (message->key.fd >= 0 ? 2 : 1) * packedSize, NULL, 0);
+}
+
+static void transformRemotely(struct otpMessage* messages, int messageCount, const char* pad, int format, const struct otpEndpointList* endpoints, int mode, char* buffer){
+    int socketFD = connectDaemon(endpoints, mode);
+    struct otpRecvBuffer recvBuffer;                                            /* Frames received from the daemon */
+    struct otpReplyState state = {0, pad, mode, OTP_FORMAT_TEXT, buffer};
+    char* frame = NULL;                                                         /* Payload of a packed DATA frame */
+    int outstanding = 0;                                                        /* Number of frames whose reply has not been read yet */
+    int i;
+
+    if(recvBufferInit(&recvBuffer, OTP_RECV_BUFFER_SIZE) != OTP_OK){
+        error("CLIENT: ERROR allocating the receive buffer");
+    }
+    if(format != OTP_FORMAT_TEXT){
+        state.format = negotiateFormat(socketFD, &recvBuffer, format);
+    }
+    if(state.format == OTP_FORMAT_PACKED){
+        frame = malloc(OTP_PACKED_COUNT_SIZE + 2 * OTP_PACKED_SIZE(OTP_CHUNK_SIZE));
+        if(frame == NULL){
+            error("CLIENT: ERROR allocating the packed frame buffer");
+        }
+    }
+    if(format == OTP_FORMAT_BINARY && state.format != format){                  /* Binary data cannot fall back to the text format */
+        fprintf(stderr, "%s error: the daemon does not support --binary\n", programName(mode));
+        exit(1);
+    }
+
+    for(i = 0; i < messageCount; i++){
+        struct otpMessage* message = &messages[i];
+        uint16_t requestId = i;                                                 /* Only has to tell apart the requests in flight */
+        long remaining = message->textLength;
+        off_t offset;
+        size_t chunk;
+
+        if(pad != NULL){                                                        /* Ask the daemon to take the key from its pad */
+            char request[OTP_KEY_REQUEST_SIZE];
+            const char* at = strchr(pad, '@');
+            size_t nameLength = at != NULL ? (size_t)(at - pad) : strlen(pad);
+
+            encodeUint64(request, at != NULL ? strtoull(at + 1, NULL, 10) : OTP_PAD_NEXT);
+            encodeUint64(request + 8, message->textLength);
+            if(sendFrame(socketFD, OTP_FRAME_KEY, requestId, request, sizeof(request), pad, nameLength) != OTP_OK){
+                error("CLIENT: ERROR writing to socket");
+            }
+            outstanding++;
+        }
+
+        /* Stream the message to the daemon one chunk at a time, with the coinciding key unless it comes from a pad */
+        while(remaining > 0 || outstanding >= OTP_CLIENT_WINDOW){
+            if(outstanding >= OTP_CLIENT_WINDOW){                               /* Keep the window full by reading back the oldest reply */
+                recvReply(socketFD, &recvBuffer, &state);
+                outstanding--;
+                continue;
+            }
+
+            chunk = remaining < OTP_CHUNK_SIZE ? remaining : OTP_CHUNK_SIZE;
+            offset = message->textLength - remaining;                           /* Text and key characters coincide, so they share the offset */
+            if(state.format == OTP_FORMAT_PACKED){
+                if(sendPackedFrame(socketFD, requestId, message, offset, chunk, frame) != OTP_OK){
+                    error("CLIENT: ERROR writing to socket");
+                }
+            }
+            else if(sendFileFrame(socketFD, OTP_FRAME_DATA, requestId, message->text.fd, offset, message->key.fd, offset, chunk) != OTP_OK){
+                error("CLIENT: ERROR writing to socket");
+            }
+            outstanding++;
+            remaining -= chunk;
+        }
+
+        if(sendFrame(socketFD, OTP_FRAME_END, requestId, NULL, 0, NULL, 0) != OTP_OK){    /* The daemon acknowledges the end of every message */
+            error("CLIENT: ERROR writing to socket");
+        }
+        outstanding++;
+    }
+
+    while(outstanding > 0){                                                     /* Drain the replies still in flight */
+        recvReply(socketFD, &recvBuffer, &state);
+        outstanding--;
+    }
+
+    close(socketFD);                                                            /* Close the socket */
+    recvBufferFree(&recvBuffer);                                                /* Free memory allocated to recvBuffer */
+    free(frame);
+}
+
+static int printStats(const struct otpEndpointList* endpoints, int mode){       /* --stats: print the daemon's metrics instead of sending a message */
+    int socketFD = connectDaemon(endpoints, mode);
+    struct otpRecvBuffer recvBuffer;
+    struct otpFrameHeader header;
+    char* payload;
+
+    if(recvBufferInit(&recvBuffer, OTP_STATS_MAX_SIZE + OTP_FRAME_HEADER_SIZE) != OTP_OK){
+        error("CLIENT: ERROR allocating the receive buffer");
+    }
+    if(sendFrame(socketFD, OTP_FRAME_STATS, 0, NULL, 0, NULL, 0) != OTP_OK){
+        error("CLIENT: ERROR writing to socket");
+    }
+    if(recvFrame(socketFD, &recvBuffer, OTP_STATS_MAX_SIZE, &header, &payload) != OTP_OK || header.type != OTP_FRAME_STATS){
+        fprintf(stderr, "%s error: the daemon did not return its metrics\n", programName(mode));
+        exit(1);
+    }
+    fwrite(payload, 1, header.length, stdout);
+
+    close(socketFD);
+    recvBufferFree(&recvBuffer);
+    return 0;
+}
+
+static void parsePorts(struct otpEndpointList* endpoints, const char* ports){   /* The port argument: one port, or a comma separated list of daemons to choose from */
+    if(otpEndpointsAdd(endpoints, ports, NULL) < 0){
+        fprintf(stderr, "Error: bad port list %s, expected up to %d ports separated by commas\n", ports, OTP_MAX_ENDPOINTS);
+        exit(1);
+    }
+}
+
+int runClient(int argc, char* argv[], int mode){
+    static struct option longOptions[] = {
+        {"local", no_argument, NULL, 'l'},
+        {"pad", required_argument, NULL, 'k'},
+        {"batch", required_argument, NULL, 'b'},
+        {"connections", required_argument, NULL, 'c'},
+        {"unix", required_argument, NULL, 'u'},
+        {"stats", no_argument, NULL, 's'},
+        {"packed", no_argument, NULL, 'p'},
+        {"binary", no_argument, NULL, 'x'},
+        {NULL, 0, NULL, 0}
+    };
+    struct otpMessage* messages;
+    int messageCount, fileCount;                                                /* fileCount is the number of file arguments: text and key for each message */
+    char* buffer;                                                               /* A chunk of output of the local codec, or of unpacked results */
+    const char* pad = NULL;
+    const char* manifest = NULL;
+    int connections = OTP_BATCH_DEFAULT_CONNECTIONS;
+    struct otpEndpointList endpoints;                                           /* Daemons to choose from, the --unix options or else the port list */
+    int local = 0;
+    int stats = 0;
+    int packed = 0;
+    int binary = 0;
+    int option, i;
+
+    endpoints.count = 0;
+    while((option = getopt_long(argc, argv, "lk:b:c:u:spx", longOptions, NULL)) != -1){
+        if(option == 'l'){
+            local = 1;
+        }
+        else if(option == 'p'){
+            packed = 1;
+        }
+        else if(option == 'x'){
+            binary = 1;
+        }
+        else if(option == 's'){
+            stats = 1;
+        }
+        else if(option == 'k'){
+            pad = optarg;
+        }
+        else if(option == 'b'){
+            manifest = optarg;
+        }
+        else if(option == 'c' && atoi(optarg) > 0){
+            connections = atoi(optarg);
+        }
+        else if(option == 'u'){
+            if(otpEndpointsAdd(&endpoints, NULL, optarg) < 0){
+                fprintf(stderr, "At most %d daemons can be given.\n", OTP_MAX_ENDPOINTS);
+                exit(1);
+            }
+        }
+        else{
+            exit(1);                                                            /* getopt already reported the bad option */
+        }
+    }
+
+    if(local && pad != NULL){                                                   /* The pad lives in the daemon */
+        fprintf(stderr, "--local cannot be combined with --pad.\n");
+        exit(1);
+    }
+    if(packed && (local || stats || manifest != NULL)){                         /* Only a message sent to the daemon has a wire format */
+        fprintf(stderr, "--packed cannot be combined with --local, --stats or --batch.\n");
+        exit(1);
+    }
+    if(binary && (packed || stats || manifest != NULL || pad != NULL)){         /* Packing needs the alphabet, and pads hold text keys */
+        fprintf(stderr, "--binary cannot be combined with --packed, --stats, --batch or --pad.\n");
+        exit(1);
+    }
+
+    if(stats){
+        if(local || pad != NULL || manifest != NULL || argc - optind != (endpoints.count > 0 ? 0 : 1)){
+            fprintf(stderr, "USAGE: %s --stats (port | --unix path)\n", programName(mode));
+            exit(1);
+        }
+        if(endpoints.count == 0){
+            parsePorts(&endpoints, argv[optind]);
+        }
+        if(endpoints.count > 1){                                                /* Metrics are per daemon */
+            fprintf(stderr, "--stats takes a single daemon.\n");
+            exit(1);
+        }
+        return printStats(&endpoints, mode);
+    }
+
+    if(manifest != NULL){                                                       /* Output goes to the files named in the manifest, see otp_batch.c */
+        if(local || pad != NULL || argc - optind != (endpoints.count > 0 ? 0 : 1)){
+            fprintf(stderr, "USAGE: %s --batch manifest [--connections N] (port[,port]... | --unix path...)\n", programName(mode));
+            exit(1);
+        }
+        if(endpoints.count == 0){
+            parsePorts(&endpoints, argv[optind]);
+        }
+        return runBatch(manifest, connections, &endpoints, mode);
+    }
+
+    /* Verify if enough arguments were used: a text and, unless --pad, a key for every message, then the port unless --local or --unix */
+    fileCount = argc - optind - (local || endpoints.count > 0 ? 0 : 1);
+    messageCount = pad != NULL ? fileCount : fileCount / 2;
+    if (messageCount < 1 || (pad == NULL && fileCount % 2 != 0)){
+        fprintf(stderr,"Not enough arguments.\n");
+        exit(1);                                                                /* Set the exit value to 1 */
+    }
+    if(pad != NULL && strchr(pad, '@') != NULL && messageCount > 1){          /* Every message needs its own range */
+        fprintf(stderr, "--pad NAME@OFFSET takes a single file.\n");
+        exit(1);
+    }
+
+    messages = calloc(messageCount, sizeof(struct otpMessage));
+    if(messages == NULL){
+        error("CLIENT: ERROR allocating the message list");
+    }
+    buffer = malloc(OTP_CHUNK_SIZE);
+    if(buffer == NULL){
+        error("CLIENT: ERROR allocating the chunk buffer");
+    }
+    signal(SIGPIPE, SIG_IGN);                                                   /* sendfile has no MSG_NOSIGNAL, a closed socket must show up as an error instead */
+
+    for(i = 0; i < messageCount; i++){                                          /* Check every message before any of them is sent */
+        struct otpMessage* message = &messages[i];
+        const char* textPath = argv[optind + (pad != NULL ? i : 2 * i)];
+
+        openInput(textPath, &message->text);
+        if(binary){                                                             /* A final newline byte is data too */
+            message->text.length = message->text.size;
+        }
+        message->textLength = message->text.length;
+        message->key.fd = -1;
+        if(pad == NULL){
+            const char* keyPath = argv[optind + 2 * i + 1];
+
+            openInput(keyPath, &message->key);
+            if(binary){
+                message->key.length = message->key.size;
+            }
+            if(message->text.length > message->key.length){                     /* If text > key, report an error and exit program */
+                fprintf(stderr, "Error: key %s is too short\n", keyPath);
+                exit(1);
+            }
+        }
+
+        /* Checked in place in the mappings. Only the part of the key that coincides with the text is used, so only that part has to be valid */
+        if(!binary && (!validateInput(&message->text, message->text.length) || (message->key.fd >= 0 && !validateInput(&message->key, message->text.length)))){
+            fprintf(stderr, "%s error: input contains bad characters\n", programName(mode));
+            exit(1);
+        }
+    }
+
+    if(local){
+        for(i = 0; i < messageCount; i++){
+            transformLocally(&messages[i], binary ? OTP_MODE_XOR : mode, buffer);
+        }
+    }
+    else{
+        if(endpoints.count == 0){
+            parsePorts(&endpoints, argv[argc - 1]);
+        }
+        transformRemotely(messages, messageCount, pad, binary ? OTP_FORMAT_BINARY : packed ? OTP_FORMAT_PACKED : OTP_FORMAT_TEXT, &endpoints, mode, buffer);
+    }
+
+    for(i = 0; i < messageCount; i++){
+        closeInputFile(&messages[i].text);
+        closeInputFile(&messages[i].key);
+    }
+    free(messages);
+    free(buffer);                                                               /* Free memory allocated to buffer */
+
+    return 0;
+}
@@ -0,0 +1,35 @@
+/****************************************************************
+* Author: Nicholas Schaffner
+* Last Modified: 10/17/26
+* Description: Client side shared by otp_enc and otp_dec. The two clients only differ in the mode they pass in.
+****************************************************************/
+
+#ifndef OTP_CLIENT_H
+#define OTP_CLIENT_H
+
+#include <stddef.h>
+
+#include "otp_endpoint.h"
+
+#define OTP_CLIENT_WINDOW 4                                                     /* Number of frames that may be sent before the first reply is read back */
+#define OTP_INPUT_WINDOW (8 << 20)                                              /* Bytes of a mapped input scanned before its pages are let go */
+#define OTP_BATCH_DEFAULT_CONNECTIONS 4                                         /* Connections a --batch run opens unless --connections says otherwise */
+
+struct otpInput{                                                                /* A text or key file, mapped read-only */
+    int fd;                                                                     /* Kept open for sendfile, which copies from the same page cache pages */
+    const char* data;                                                           /* The mapping, NULL for an empty file */
+    size_t size;                                                                /* Size of the file and of the mapping */
+    size_t length;                                                              /* Size without the trailing newline character */
+};
+
+int runClient(int argc, char* argv[], int mode);
+int runBatch(const char* manifestPath, int connections, const struct otpEndpointList* endpoints, int mode);
+const char* programName(int mode);
+int openInputFile(const char* path, struct otpInput* input);
+void closeInputFile(struct otpInput* input);
+int validateInput(const struct otpInput* input, size_t length);
+int openDaemon(const struct otpEndpoint* endpoint, int mode, int* failure);
+int openAnyDaemon(const struct otpEndpointList* endpoints, const int* order, int mode, int* failure, int* chosen);
+int connectDaemon(const struct otpEndpointList* endpoints, int mode);
+
+#endif
@@ -0,0 +1,628 @@
+/****************************************************************
+* Author: Nicholas Schaffner
+* Last Modified: 10/17/26
+* Description: Implementations of the mod 27 one-time pad transform and of the alphabet check. The scalar version is
+*               the same math that used to be inlined in the child branch of otp_enc_d and otp_dec_d and is the
+*               reference the others must match. The table version does the same with two small lookup tables instead of
+*               branches and a division. The SSE4.1, AVX2 and AVX-512 versions handle 16, 32 or 64 characters
+*               per step without branches or division: a value v in 0-53 is reduced modulo 27 as min(v, v - 27) on
+*               unsigned bytes, since v - 27 wraps around to a large value whenever v < 27. The fastest version the
+*               CPU supports is picked when the program starts; the OTP_CODEC environment variable (scalar, table,
+*               sse4.1, avx2 or avx512) overrides the choice. The vector transforms assume the input has been validated.
+*               The packed format (see otp_codec.h) has a scalar version and an AVX2 version, which splits 8 groups into
+*               their base 27 digits at once with a multiply and shift in place of the division by 27; avx512 uses the
+*               AVX2 one and sse4.1 and table the scalar one. OTP_MODE_XOR, the binary mode, XORs whole bytes and has
+*               no alphabet to map to or from, so every version is a plain XOR as wide as its registers: 64 bits at a
+*               time for scalar and table, 128, 256 and 512 bits for the vector versions.
+****************************************************************/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+
+#include "otp_codec.h"
+
+static int charToValue(char c){                                                 /* Map ' ' to '[' and subtract 65 to get a value between 0-26 */
+    if(c == ' '){
+        c = '[';
+    }
+    return c - 65;
+}
+
+static char valueToChar(int value){                                             /* Add 65 to get a character between 65-91 and map 91 back to the space character */
+    value = value + 65;
+    if(value == 91){
+        value = 32;
+    }
+    return value;
+}
+
+static void transformScalar(int mode, const char* text, const char* key, char* out, size_t length){
+    size_t i;
+    int textValue, keyValue, resultValue;
+
+    for(i = 0; i < length; i++){                                                /* Transform each character of text via the coinciding character of key */
+        textValue = charToValue(text[i]);
+        keyValue = charToValue(key[i]);
+
+        if(mode == OTP_MODE_ENCODE){
+            resultValue = (textValue + keyValue) % 27;                          /* Encrypt the current text character with the key character */
+        }
+        else{
+            resultValue = textValue - keyValue;                                 /* Subtract the key value from the text value. If the difference < 0, add 27 */
+            if(resultValue < 0){
+                resultValue = resultValue + 27;
+            }
+        }
+
+        out[i] = valueToChar(resultValue);
+    }
+}
+
+static int validateScalar(const char* text, size_t length){                     /* Return 1 if every character is an uppercase letter or a space character, otherwise 0 */
+    size_t i;
+
+    for(i = 0; i < length; i++){
+        if((text[i] < 'A' || text[i] > 'Z') && text[i] != ' '){
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static void xorScalar(const char* text, const char* key, char* out, size_t length){     /* 8 bytes per step, memcpy keeps the unaligned loads legal */
+    uint64_t textWord, keyWord;
+    size_t i;
+
+    for(i = 0; i + 8 <= length; i += 8){
+        memcpy(&textWord, text + i, 8);
+        memcpy(&keyWord, key + i, 8);
+        textWord ^= keyWord;
+        memcpy(out + i, &textWord, 8);
+    }
+    for(; i < length; i++){
+        out[i] = text[i] ^ key[i];
+    }
+}
+
+/* Table version: the scalar math with the branches and the division replaced by lookups, for CPUs without SSE4.1 */
+
+static unsigned char valueOf[256];                                              /* Character to value 0-26, OTP_TABLE_BAD for characters that are not allowed */
+static char charOfSum[64];                                                      /* Value 0-53 to the character of that value modulo 27 */
+
+#define OTP_TABLE_BAD 0x80                                                      /* Set in valueOf for bad characters, never set in a value */
+
+static void buildTables(void){
+    int i;
+
+    for(i = 0; i < 256; i++){
+        valueOf[i] = ((i >= 'A' && i <= 'Z') || i == ' ') ? charToValue(i) : OTP_TABLE_BAD;
+    }
+    for(i = 0; i < 64; i++){                                                    /* 54-63 are only reached through bad characters */
+        charOfSum[i] = valueToChar(i % 27);
+    }
+}
+
+static void transformTable(int mode, const char* text, const char* key, char* out, size_t length){
+    const unsigned char* textBytes = (const unsigned char*)text;
+    const unsigned char* keyBytes = (const unsigned char*)key;
+    size_t i;
+
+    if(mode == OTP_MODE_ENCODE){
+        for(i = 0; i < length; i++){
+            out[i] = charOfSum[(valueOf[textBytes[i]] + valueOf[keyBytes[i]]) & 63];      /* The mask keeps bad characters inside the table */
+        }
+    }
+    else{
+        for(i = 0; i < length; i++){                                            /* text - key + 27 is always in 1-53 */
+            out[i] = charOfSum[(valueOf[textBytes[i]] + 27 - valueOf[keyBytes[i]]) & 63];
+        }
+    }
+}
+
+static int validateTable(const char* text, size_t length){
+    const unsigned char* bytes = (const unsigned char*)text;
+    unsigned char bad = 0;
+    size_t i;
+
+    for(i = 0; i < length; i++){                                                /* No branch per character, the flags are just ORed together */
+        bad |= valueOf[bytes[i]];
+    }
+
+    return !(bad & OTP_TABLE_BAD);
+}
+
+/* SSE4.1: 16 characters per step */
+
+__attribute__((target("sse4.1")))
+static __m128i toValues128(__m128i chars){                                      /* 'A'-'Z' become 0-25 and ' ' becomes 26 */
+    __m128i isSpace = _mm_cmpeq_epi8(chars, _mm_set1_epi8(' '));
+    return _mm_blendv_epi8(_mm_sub_epi8(chars, _mm_set1_epi8(65)), _mm_set1_epi8(26), isSpace);
+}
+
+__attribute__((target("sse4.1")))
+static __m128i toChars128(__m128i values){                                      /* 0-25 become 'A'-'Z' and 26 becomes ' ' */
+    __m128i isSpace = _mm_cmpeq_epi8(values, _mm_set1_epi8(26));
+    return _mm_blendv_epi8(_mm_add_epi8(values, _mm_set1_epi8(65)), _mm_set1_epi8(' '), isSpace);
+}
+
+__attribute__((target("sse4.1")))
+static void transformSSE41(int mode, const char* text, const char* key, char* out, size_t length){
+    const __m128i twentySeven = _mm_set1_epi8(27);
+    size_t i;
+
+    for(i = 0; i + 16 <= length; i += 16){
+        __m128i textValues = toValues128(_mm_loadu_si128((const __m128i*)(text + i)));
+        __m128i keyValues = toValues128(_mm_loadu_si128((const __m128i*)(key + i)));
+        __m128i sum = (mode == OTP_MODE_ENCODE) ? _mm_add_epi8(textValues, keyValues)                        /* 0-52 */
+                                                : _mm_sub_epi8(_mm_add_epi8(textValues, twentySeven), keyValues); /* 1-53, the + 27 keeps it positive */
+        __m128i reduced = _mm_min_epu8(sum, _mm_sub_epi8(sum, twentySeven));
+        _mm_storeu_si128((__m128i*)(out + i), toChars128(reduced));
+    }
+
+    transformScalar(mode, text + i, key + i, out + i, length - i);              /* Fewer than 16 characters left */
+}
+
+__attribute__((target("sse4.1")))
+static int validateSSE41(const char* text, size_t length){
+    __m128i bad = _mm_setzero_si128();
+    size_t i;
+
+    for(i = 0; i + 16 <= length; i += 16){
+        __m128i chars = _mm_loadu_si128((const __m128i*)(text + i));
+        __m128i letter = _mm_sub_epi8(chars, _mm_set1_epi8('A'));
+        __m128i isLetter = _mm_cmpeq_epi8(_mm_min_epu8(letter, _mm_set1_epi8(25)), letter);   /* chars - 'A' <= 25 as unsigned bytes */
+        __m128i isSpace = _mm_cmpeq_epi8(chars, _mm_set1_epi8(' '));
+        bad = _mm_or_si128(bad, _mm_andnot_si128(_mm_or_si128(isLetter, isSpace), _mm_set1_epi8(-1)));
+        if((i & 4095) == 4080 && !_mm_testz_si128(bad, bad)){                   /* Stop early every 4 KB instead of on every step */
+            return 0;
+        }
+    }
+
+    return _mm_testz_si128(bad, bad) && validateScalar(text + i, length - i);
+}
+
+__attribute__((target("sse4.1")))
+static void xorSSE41(const char* text, const char* key, char* out, size_t length){
+    size_t i;
+
+    for(i = 0; i + 16 <= length; i += 16){
+        __m128i bytes = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(text + i)), _mm_loadu_si128((const __m128i*)(key + i)));
+        _mm_storeu_si128((__m128i*)(out + i), bytes);
+    }
+
+    xorScalar(text + i, key + i, out + i, length - i);
+}
+
+/* AVX2: 32 characters per step */
+
+__attribute__((target("avx2")))
+static __m256i toValues256(__m256i chars){
+    __m256i isSpace = _mm256_cmpeq_epi8(chars, _mm256_set1_epi8(' '));
+    return _mm256_blendv_epi8(_mm256_sub_epi8(chars, _mm256_set1_epi8(65)), _mm256_set1_epi8(26), isSpace);
+}
+
+__attribute__((target("avx2")))
+static __m256i toChars256(__m256i values){
+    __m256i isSpace = _mm256_cmpeq_epi8(values, _mm256_set1_epi8(26));
+    return _mm256_blendv_epi8(_mm256_add_epi8(values, _mm256_set1_epi8(65)), _mm256_set1_epi8(' '), isSpace);
+}
+
+__attribute__((target("avx2")))
+static void transformAVX2(int mode, const char* text, const char* key, char* out, size_t length){
+    const __m256i twentySeven = _mm256_set1_epi8(27);
+    size_t i;
+
+    for(i = 0; i + 32 <= length; i += 32){
+        __m256i textValues = toValues256(_mm256_loadu_si256((const __m256i*)(text + i)));
+        __m256i keyValues = toValues256(_mm256_loadu_si256((const __m256i*)(key + i)));
+        __m256i sum = (mode == OTP_MODE_ENCODE) ? _mm256_add_epi8(textValues, keyValues)
+                                                : _mm256_sub_epi8(_mm256_add_epi8(textValues, twentySeven), keyValues);
+        __m256i reduced = _mm256_min_epu8(sum, _mm256_sub_epi8(sum, twentySeven));
+        _mm256_storeu_si256((__m256i*)(out + i), toChars256(reduced));
+    }
+
+    transformSSE41(mode, text + i, key + i, out + i, length - i);
+}
+
+__attribute__((target("avx2")))
+static int validateAVX2(const char* text, size_t length){
+    __m256i bad = _mm256_setzero_si256();
+    size_t i;
+
+    for(i = 0; i + 32 <= length; i += 32){
+        __m256i chars = _mm256_loadu_si256((const __m256i*)(text + i));
+        __m256i letter = _mm256_sub_epi8(chars, _mm256_set1_epi8('A'));
+        __m256i isLetter = _mm256_cmpeq_epi8(_mm256_min_epu8(letter, _mm256_set1_epi8(25)), letter);
+        __m256i isSpace = _mm256_cmpeq_epi8(chars, _mm256_set1_epi8(' '));
+        bad = _mm256_or_si256(bad, _mm256_andnot_si256(_mm256_or_si256(isLetter, isSpace), _mm256_set1_epi8(-1)));
+        if((i & 4095) == 4064 && !_mm256_testz_si256(bad, bad)){
+            return 0;
+        }
+    }
+
+    return _mm256_testz_si256(bad, bad) && validateSSE41(text + i, length - i);
+}
+
+__attribute__((target("avx2")))
+static void xorAVX2(const char* text, const char* key, char* out, size_t length){
+    size_t i;
+
+    for(i = 0; i + 32 <= length; i += 32){
+        __m256i bytes = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(text + i)), _mm256_loadu_si256((const __m256i*)(key + i)));
+        _mm256_storeu_si256((__m256i*)(out + i), bytes);
+    }
+
+    xorSSE41(text + i, key + i, out + i, length - i);
+}
+
+/* AVX-512 (BW): 64 characters per step, using mask registers instead of blends */
+
+__attribute__((target("avx512f,avx512bw")))
+static __m512i toValues512(__m512i chars){
+    __mmask64 isSpace = _mm512_cmpeq_epi8_mask(chars, _mm512_set1_epi8(' '));
+    return _mm512_mask_blend_epi8(isSpace, _mm512_sub_epi8(chars, _mm512_set1_epi8(65)), _mm512_set1_epi8(26));
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static __m512i toChars512(__m512i values){
+    __mmask64 isSpace = _mm512_cmpeq_epi8_mask(values, _mm512_set1_epi8(26));
+    return _mm512_mask_blend_epi8(isSpace, _mm512_add_epi8(values, _mm512_set1_epi8(65)), _mm512_set1_epi8(' '));
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void transformAVX512(int mode, const char* text, const char* key, char* out, size_t length){
+    const __m512i twentySeven = _mm512_set1_epi8(27);
+    size_t i;
+
+    for(i = 0; i + 64 <= length; i += 64){
+        __m512i textValues = toValues512(_mm512_loadu_si512((const void*)(text + i)));
+        __m512i keyValues = toValues512(_mm512_loadu_si512((const void*)(key + i)));
+        __m512i sum = (mode == OTP_MODE_ENCODE) ? _mm512_add_epi8(textValues, keyValues)
+                                                : _mm512_sub_epi8(_mm512_add_epi8(textValues, twentySeven), keyValues);
+        __m512i reduced = _mm512_min_epu8(sum, _mm512_sub_epi8(sum, twentySeven));
+        _mm512_storeu_si512((void*)(out + i), toChars512(reduced));
+    }
+
+    transformAVX2(mode, text + i, key + i, out + i, length - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static int validateAVX512(const char* text, size_t length){
+    size_t i;
+
+    for(i = 0; i + 64 <= length; i += 64){
+        __m512i chars = _mm512_loadu_si512((const void*)(text + i));
+        __mmask64 isLetter = _mm512_cmple_epu8_mask(_mm512_sub_epi8(chars, _mm512_set1_epi8('A')), _mm512_set1_epi8(25));
+        __mmask64 isSpace = _mm512_cmpeq_epi8_mask(chars, _mm512_set1_epi8(' '));
+        if((isLetter | isSpace) != ~(__mmask64)0){                              /* Mask registers make an early exit cheap */
+            return 0;
+        }
+    }
+
+    return validateAVX2(text + i, length - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void xorAVX512(const char* text, const char* key, char* out, size_t length){
+    size_t i;
+
+    for(i = 0; i + 64 <= length; i += 64){
+        __m512i bytes = _mm512_xor_si512(_mm512_loadu_si512((const void*)(text + i)), _mm512_loadu_si512((const void*)(key + i)));
+        _mm512_storeu_si512((void*)(out + i), bytes);
+    }
+
+    xorAVX2(text + i, key + i, out + i, length - i);
+}
+
+/* Packed symbols: 5 symbols in 3 bytes. A group holds v0 + 27 v1 + 27^2 v2 + 27^3 v3 + 27^4 v4, the values of its 5
+ * symbols, as a little-endian 24 bit number (27^5 < 2^24). The last group of a length that is not a multiple of 5 is
+ * padded with the value 0. A transform works on the digits of the groups and never goes through the characters */
+
+#define OTP_PACKED_LIMIT 14348907u                                              /* 27^5, no group may hold this value or more */
+
+static uint32_t loadGroup(const char* in){
+    const unsigned char* bytes = (const unsigned char*)in;
+    return bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16;
+}
+
+static void storeGroup(char* out, uint32_t value){
+    out[0] = value & 0xff;
+    out[1] = (value >> 8) & 0xff;
+    out[2] = (value >> 16) & 0xff;
+}
+
+static void packScalar(const char* text, size_t length, char* out){
+    size_t i;
+    uint32_t value;
+    int j;
+
+    for(i = 0; i < length; i += OTP_PACK_GROUP){
+        value = 0;
+        for(j = OTP_PACK_GROUP - 1; j >= 0; j--){                               /* Horner's rule from the last symbol of the group */
+            value = value * 27 + (i + j < length ? charToValue(text[i + j]) : 0);
+        }
+        storeGroup(out + i / OTP_PACK_GROUP * OTP_PACKED_GROUP_SIZE, value);
+    }
+}
+
+static void unpackScalar(const char* packed, size_t length, char* out){
+    size_t i;
+    uint32_t value;
+    int j;
+
+    for(i = 0; i < length; i += OTP_PACK_GROUP){
+        value = loadGroup(packed + i / OTP_PACK_GROUP * OTP_PACKED_GROUP_SIZE);
+        for(j = 0; j < OTP_PACK_GROUP && i + j < length; j++){
+            out[i + j] = valueToChar(value % 27);
+            value /= 27;
+        }
+    }
+}
+
+static int validatePackedScalar(const char* packed, size_t length){             /* Return 1 if every group holds 5 symbols, or the symbols left and padding, otherwise 0 */
+    size_t i;
+    uint32_t limit;
+    int j;
+
+    for(i = 0; i < length; i += OTP_PACK_GROUP){
+        limit = 1;
+        for(j = 0; j < OTP_PACK_GROUP && i + j < length; j++){
+            limit *= 27;
+        }
+        if(loadGroup(packed + i / OTP_PACK_GROUP * OTP_PACKED_GROUP_SIZE) >= limit){
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static void transformPackedScalar(int mode, const char* text, const char* key, char* out, size_t length){
+    size_t offset;
+    uint32_t textGroup, keyGroup, result, scale;
+    int j, digit;
+
+    for(offset = 0; offset < OTP_PACKED_SIZE(length); offset += OTP_PACKED_GROUP_SIZE){
+        textGroup = loadGroup(text + offset);
+        keyGroup = loadGroup(key + offset);
+        result = 0;
+        scale = 1;
+        for(j = 0; j < OTP_PACK_GROUP; j++){                                    /* Padding is 0 in both, so it stays 0 */
+            if(mode == OTP_MODE_ENCODE){
+                digit = (textGroup % 27 + keyGroup % 27) % 27;
+            }
+            else{
+                digit = ((int)(textGroup % 27) - (int)(keyGroup % 27) + 27) % 27;
+            }
+            result += digit * scale;
+            scale *= 27;
+            textGroup /= 27;
+            keyGroup /= 27;
+        }
+        storeGroup(out + offset, result);
+    }
+}
+
+/* AVX2 packed: 8 groups (40 symbols) per step, one group in each 32 bit lane. A step loads 32 bytes for its 24, so
+ * the vector loops stop OTP_PACKED_SLACK groups before the end and leave the rest to the scalar versions */
+
+#define OTP_PACKED_SLACK 11                                                     /* 8 groups and the 8 bytes read past them */
+
+__attribute__((target("avx2")))
+static __m256i loadGroups256(const char* in){
+    __m256i bytes = _mm256_permutevar8x32_epi32(_mm256_loadu_si256((const __m256i*)in), _mm256_setr_epi32(0, 1, 2, 3, 3, 4, 5, 6));
+    return _mm256_shuffle_epi8(bytes, _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                                                       0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1));
+}
+
+__attribute__((target("avx2")))
+static void storeGroups256(char* out, __m256i groups){                           /* Writes exactly 24 bytes */
+    __m256i bytes = _mm256_shuffle_epi8(groups, _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                                                 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1));
+    bytes = _mm256_permutevar8x32_epi32(bytes, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7));
+    _mm_storeu_si128((__m128i*)out, _mm256_castsi256_si128(bytes));
+    _mm_storel_epi64((__m128i*)(out + 16), _mm256_extracti128_si256(bytes, 1));
+}
+
+__attribute__((target("avx2")))
+static __m256i divide27(__m256i values){                                        /* Exact for values below 2^24: v / 27 = (v * 19884109) >> 29 */
+    const __m256i magic = _mm256_set1_epi64x(19884109);
+    __m256i even = _mm256_srli_epi64(_mm256_mul_epu32(values, magic), 29);
+    __m256i odd = _mm256_slli_epi64(_mm256_srli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(values, 32), magic), 29), 32);
+    return _mm256_blend_epi32(even, odd, 0xaa);
+}
+
+__attribute__((target("avx2")))
+static __m256i multiply27(__m256i values){                                      /* 27 v = 32 v - 4 v - v */
+    return _mm256_sub_epi32(_mm256_sub_epi32(_mm256_slli_epi32(values, 5), _mm256_slli_epi32(values, 2)), values);
+}
+
+__attribute__((target("avx2")))
+static void splitGroups256(__m256i groups, __m256i digits[OTP_PACK_GROUP]){     /* The 5 symbol values of every group */
+    __m256i quotient;
+    int j;
+
+    for(j = 0; j < OTP_PACK_GROUP - 1; j++){
+        quotient = divide27(groups);
+        digits[j] = _mm256_sub_epi32(groups, multiply27(quotient));
+        groups = quotient;
+    }
+    digits[OTP_PACK_GROUP - 1] = groups;
+}
+
+__attribute__((target("avx2")))
+static void packAVX2(const char* text, size_t length, char* out){
+    const __m256i offsets = _mm256_setr_epi32(0, 5, 10, 15, 20, 25, 30, 35);
+    size_t groups = (length + OTP_PACK_GROUP - 1) / OTP_PACK_GROUP;
+    size_t i;
+
+    for(i = 0; i + OTP_PACKED_SLACK <= groups; i += 8){
+        const char* in = text + i * OTP_PACK_GROUP;
+        __m256i low = toValues256(_mm256_i32gather_epi32((const int*)in, offsets, 1));          /* Symbols 0-3 of each group */
+        __m256i high = toValues256(_mm256_i32gather_epi32((const int*)(in + 1), offsets, 1));   /* Symbol 4 in the top byte */
+        __m256i pairs = _mm256_maddubs_epi16(low, _mm256_set1_epi16(27 << 8 | 1));             /* v0 + 27 v1 and v2 + 27 v3 */
+        __m256i value = _mm256_madd_epi16(pairs, _mm256_set1_epi32(729 << 16 | 1));
+        value = _mm256_add_epi32(value, _mm256_mullo_epi32(_mm256_srli_epi32(high, 24), _mm256_set1_epi32(531441)));
+        storeGroups256(out + i * OTP_PACKED_GROUP_SIZE, value);
+    }
+
+    packScalar(text + i * OTP_PACK_GROUP, length - i * OTP_PACK_GROUP, out + i * OTP_PACKED_GROUP_SIZE);
+}
+
+__attribute__((target("avx2")))
+static void unpackAVX2(const char* packed, size_t length, char* out){
+    size_t groups = (length + OTP_PACK_GROUP - 1) / OTP_PACK_GROUP;
+    uint32_t first[8], last[8];                                                 /* Characters 0-3 and character 4 of each group */
+    __m256i digits[OTP_PACK_GROUP];
+    size_t i;
+    int j;
+
+    for(i = 0; i + OTP_PACKED_SLACK <= groups; i += 8){
+        splitGroups256(loadGroups256(packed + i * OTP_PACKED_GROUP_SIZE), digits);
+        __m256i chars = _mm256_or_si256(_mm256_or_si256(digits[0], _mm256_slli_epi32(digits[1], 8)),
+                                        _mm256_or_si256(_mm256_slli_epi32(digits[2], 16), _mm256_slli_epi32(digits[3], 24)));
+        _mm256_storeu_si256((__m256i*)first, toChars256(chars));
+        _mm256_storeu_si256((__m256i*)last, toChars256(digits[4]));
+        for(j = 0; j < 8; j++){                                                 /* 5 bytes per group do not fit a shuffle within 128 bit lanes */
+            memcpy(out + (i + j) * OTP_PACK_GROUP, &first[j], 4);
+            out[(i + j) * OTP_PACK_GROUP + 4] = (char)last[j];
+        }
+    }
+
+    unpackScalar(packed + i * OTP_PACKED_GROUP_SIZE, length - i * OTP_PACK_GROUP, out + i * OTP_PACK_GROUP);
+}
+
+__attribute__((target("avx2")))
+static int validatePackedAVX2(const char* packed, size_t length){
+    size_t groups = (length + OTP_PACK_GROUP - 1) / OTP_PACK_GROUP;
+    __m256i bad = _mm256_setzero_si256();
+    size_t i;
+
+    for(i = 0; i + OTP_PACKED_SLACK <= groups; i += 8){
+        bad = _mm256_or_si256(bad, _mm256_cmpgt_epi32(loadGroups256(packed + i * OTP_PACKED_GROUP_SIZE), _mm256_set1_epi32(OTP_PACKED_LIMIT - 1)));
+    }
+
+    return _mm256_testz_si256(bad, bad) && validatePackedScalar(packed + i * OTP_PACKED_GROUP_SIZE, length - i * OTP_PACK_GROUP);
+}
+
+__attribute__((target("avx2")))
+static void transformPackedAVX2(int mode, const char* text, const char* key, char* out, size_t length){
+    const __m256i twentySeven = _mm256_set1_epi32(27);
+    size_t groups = (length + OTP_PACK_GROUP - 1) / OTP_PACK_GROUP;
+    __m256i textDigits[OTP_PACK_GROUP], keyDigits[OTP_PACK_GROUP];
+    size_t i;
+    int j;
+
+    for(i = 0; i + OTP_PACKED_SLACK <= groups; i += 8){                         /* Both groups are loaded before the result is stored, so out may be text */
+        splitGroups256(loadGroups256(text + i * OTP_PACKED_GROUP_SIZE), textDigits);
+        splitGroups256(loadGroups256(key + i * OTP_PACKED_GROUP_SIZE), keyDigits);
+        __m256i result = _mm256_setzero_si256();
+        for(j = OTP_PACK_GROUP - 1; j >= 0; j--){
+            __m256i sum = (mode == OTP_MODE_ENCODE) ? _mm256_add_epi32(textDigits[j], keyDigits[j])
+                                                    : _mm256_sub_epi32(_mm256_add_epi32(textDigits[j], twentySeven), keyDigits[j]);
+            result = _mm256_add_epi32(multiply27(result), _mm256_min_epu32(sum, _mm256_sub_epi32(sum, twentySeven)));
+        }
+        storeGroups256(out + i * OTP_PACKED_GROUP_SIZE, result);
+    }
+
+    transformPackedScalar(mode, text + i * OTP_PACKED_GROUP_SIZE, key + i * OTP_PACKED_GROUP_SIZE, out + i * OTP_PACKED_GROUP_SIZE, length - i * OTP_PACK_GROUP);
+}
+
+/* Runtime selection */
+
+struct otpCodecKernels{
+    const char* name;
+    const char* feature;                                                        /* CPU feature required, NULL for none */
+    void (*transform)(int mode, const char* text, const char* key, char* out, size_t length);
+    int (*validate)(const char* text, size_t length);
+    void (*pack)(const char* text, size_t length, char* out);
+    void (*unpack)(const char* packed, size_t length, char* out);
+    int (*validatePacked)(const char* packed, size_t length);
+    void (*transformPacked)(int mode, const char* text, const char* key, char* out, size_t length);
+    void (*xorBytes)(const char* text, const char* key, char* out, size_t length);
+};
+
+static const struct otpCodecKernels kernels[] = {                               /* Fastest first */
+    {"avx512", "avx512bw", transformAVX512, validateAVX512, packAVX2, unpackAVX2, validatePackedAVX2, transformPackedAVX2, xorAVX512},
+    {"avx2", "avx2", transformAVX2, validateAVX2, packAVX2, unpackAVX2, validatePackedAVX2, transformPackedAVX2, xorAVX2},
+    {"sse4.1", "sse4.1", transformSSE41, validateSSE41, packScalar, unpackScalar, validatePackedScalar, transformPackedScalar, xorSSE41},
+    {"table", NULL, transformTable, validateTable, packScalar, unpackScalar, validatePackedScalar, transformPackedScalar, xorScalar},
+    {"scalar", NULL, transformScalar, validateScalar, packScalar, unpackScalar, validatePackedScalar, transformPackedScalar, xorScalar}
+};
+
+static const struct otpCodecKernels* selected = &kernels[4];
+
+static int kernelSupported(const struct otpCodecKernels* candidate){
+    if(candidate->feature == NULL){
+        return 1;
+    }
+    if(strcmp(candidate->feature, "avx512bw") == 0){
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+    }
+    if(strcmp(candidate->feature, "avx2") == 0){
+        return __builtin_cpu_supports("avx2");
+    }
+    return __builtin_cpu_supports("sse4.1");
+}
+
+int otpCodecSelect(const char* name){                                           /* Use the named implementation, or the fastest supported one when name is NULL. Returns 0 if it cannot run here */
+    size_t i;
+
+    __builtin_cpu_init();
+    for(i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++){
+        if((name == NULL || strcmp(name, kernels[i].name) == 0) && kernelSupported(&kernels[i])){
+            selected = &kernels[i];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+const char* otpCodecName(void){
+    return selected->name;
+}
+
+const char* otpCodecVariant(size_t index){                                      /* Name of the index-th implementation, supported here or not. NULL past the last */
+    return index < sizeof(kernels) / sizeof(kernels[0]) ? kernels[index].name : NULL;
+}
+
+__attribute__((constructor))
+static void selectAtStartup(void){
+    const char* requested = getenv("OTP_CODEC");
+
+    buildTables();
+    if(requested == NULL || !otpCodecSelect(requested)){
+        otpCodecSelect(NULL);
+    }
+}
+
+void otpTransform(int mode, const char* text, const char* key, char* out, size_t length){
+    if(mode == OTP_MODE_XOR){
+        selected->xorBytes(text, key, out, length);
+        return;
+    }
+    selected->transform(mode, text, key, out, length);
+}
+
+int otpValidate(const char* text, size_t length){                               /* Return 1 if every character is an uppercase letter or a space character, otherwise 0 */
+    return selected->validate(text, length);
+}
+
+void otpPack(const char* text, size_t length, char* out){                       /* length validated characters into OTP_PACKED_SIZE(length) bytes */
+    selected->pack(text, length, out);
+}
+
+void otpUnpack(const char* packed, size_t length, char* out){                   /* The first length symbols of packed back into characters */
+    selected->unpack(packed, length, out);
+}
+
+int otpPackedValidate(const char* packed, size_t length){                       /* Return 1 if packed holds length symbols and zero padding, otherwise 0 */
+    return selected->validatePacked(packed, length);
+}
+
+void otpPackedTransform(int mode, const char* text, const char* key, char* out, size_t length){  /* otpTransform on packed symbols, out may be text */
+    selected->transformPacked(mode, text, key, out, length);
+}
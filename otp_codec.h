@@ -0,0 +1,38 @@
+/****************************************************************
+* Author: Nicholas Schaffner
+* Last Modified: 10/17/26
+* Description: Shared one-time pad codec used by the daemons and the clients. The 27 allowed characters (A-Z and ' ')
+*               are mapped to the values 0-26 ('A' = 0 ... 'Z' = 25, ' ' = 26). Encoding adds the key value to the text
+*               value modulo 27 and decoding subtracts it modulo 27. otpTransform and otpValidate run the fastest
+*               implementation the CPU supports (scalar, table, sse4.1, avx2 or avx512), see otp_codec.c.
+*               A symbol carries log2(27) = 4.75 bits, so the packed format stores 5 of them in 3 bytes (27^5 < 2^24)
+*               for the wire: otpPack and otpUnpack convert between characters and packed groups, and
+*               otpPackedTransform encodes or decodes packed text with a packed key without unpacking either.
+*               otpTransform in OTP_MODE_XOR is the binary mode: any byte is allowed, each text byte is XORed with the
+*               coinciding key byte, and the same call decrypts what it encrypted.
+****************************************************************/
+
+#ifndef OTP_CODEC_H
+#define OTP_CODEC_H
+
+#include <stddef.h>
+
+#define OTP_MODE_ENCODE 0                                                       /* Transform plaintext into ciphertext */
+#define OTP_MODE_DECODE 1                                                       /* Transform ciphertext into plaintext */
+#define OTP_MODE_XOR 3                                                          /* Binary: XOR bytes with key bytes, both ways (2 is OTP_MODE_ANY, see otp_proto.h) */
+
+#define OTP_PACK_GROUP 5                                                        /* Symbols in a packed group */
+#define OTP_PACKED_GROUP_SIZE 3                                                 /* Bytes of a packed group */
+#define OTP_PACKED_SIZE(length) (OTP_PACKED_GROUP_SIZE * (((length) + OTP_PACK_GROUP - 1) / OTP_PACK_GROUP))    /* Bytes holding length packed symbols */
+
+void otpTransform(int mode, const char* text, const char* key, char* out, size_t length);
+int otpValidate(const char* text, size_t length);
+void otpPack(const char* text, size_t length, char* out);
+void otpUnpack(const char* packed, size_t length, char* out);
+int otpPackedValidate(const char* packed, size_t length);
+void otpPackedTransform(int mode, const char* text, const char* key, char* out, size_t length);
+int otpCodecSelect(const char* name);
+const char* otpCodecName(void);
+const char* otpCodecVariant(size_t index);
+
+#endif
@@ -0,0 +1,235 @@
+/****************************************************************
+* Author: Nicholas Schaffner
+* Last Modified: 10/17/26
+* Description: Microbenchmark of the codec kernels in otp_codec.c, away from sockets and daemons. For every
+*               implementation this CPU supports (avx512, avx2, sse4.1, table and scalar) it times the encode, decode
+*               and binary xor transforms, run through an otpPool of each requested thread count, and the alphabet check the
+*               clients run on their input, at sizes from 64 bytes up to the maximum size, growing 8 times per step.
+*               Every implementation is first checked against the scalar one. The syntax for this program is:
+*               otp_codec_bench [-c codec] [-t threads[,threads]...] [-s max_size]
+*               -c limits the run to one implementation, -t lists the thread counts of the transforms (default 1; the
+*               check always runs on one thread) and -s caps the largest size (default 1 GB; the text, key and output
+*               buffers of that size must fit in memory). The pool is created with no threshold, so small sizes show
+*               what waking the helpers costs. Every result is the best of BENCH_TRIALS timed runs, each repeating
+*               the operation until it covers BENCH_TRIAL_BYTES or lasts BENCH_TRIAL_NS, and is printed as one tab
+*               separated line: operation, implementation, threads, size, cycles per byte and GB/s. Cycles are time
+*               stamp counter ticks, which run at the nominal clock of the CPU whatever its actual speed.
+****************************************************************/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <x86intrin.h>
+
+#include "otp_codec.h"
+#include "otp_pool.h"
+
+#define BENCH_MIN_SIZE 64
+#define BENCH_SIZE_STEP 8                                                       /* Each size is this many times the previous one */
+#define BENCH_DEFAULT_MAX_SIZE (1ull << 30)
+#define BENCH_TRIALS 3
+#define BENCH_TRIAL_BYTES (64ull << 20)                                         /* Small sizes are repeated until a trial covers this many bytes... */
+#define BENCH_TRIAL_NS 20000000ull                                              /* ...or takes this long */
+#define BENCH_CHECK_SIZE (1 << 20)                                              /* Bytes compared with the scalar reference before timing */
+#define BENCH_MAX_THREAD_COUNTS 16
+
+#define BENCH_OP_ENCODE 0
+#define BENCH_OP_DECODE 1
+#define BENCH_OP_XOR 2
+#define BENCH_OP_VALIDATE 3
+
+struct benchBuffers{
+    char* text;
+    char* key;
+    char* out;
+    size_t size;
+};
+
+static const char* operationNames[] = {"encode", "decode", "xor", "validate"};
+static volatile int validateSink;                                               /* Keeps the compiler from dropping the checks whose result is unused */
+
+static void usage(void){
+    fprintf(stderr, "USAGE: otp_codec_bench [-c codec] [-t threads[,threads]...] [-s max_size]\n");
+    exit(1);
+}
+
+static uint64_t nowNs(void){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static char* mapBuffer(size_t size){                                            /* Anonymous memory, so 1 GB buffers do not go through malloc */
+    char* buffer = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if(buffer == MAP_FAILED){
+        fprintf(stderr, "otp_codec_bench: could not allocate %zu bytes, lower -s\n", size);
+        exit(1);
+    }
+    return buffer;
+}
+
+static void fillBuffers(struct benchBuffers* buffers){                          /* Random allowed characters, which also faults every page in before timing */
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+    size_t i;
+
+    for(i = 0; i < buffers->size; i++){
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        buffers->text[i] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ "[(state >> 8) % 27];
+        buffers->key[i] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ "[(state >> 40) % 27];
+    }
+    memset(buffers->out, '\0', buffers->size);
+}
+
+static int matchesScalar(const char* codec, const struct benchBuffers* buffers){    /* Compare codec with the scalar reference in every mode */
+    static const int modes[] = {OTP_MODE_ENCODE, OTP_MODE_DECODE, OTP_MODE_XOR};
+    size_t length = buffers->size < BENCH_CHECK_SIZE ? buffers->size : BENCH_CHECK_SIZE;
+    char* expected = malloc(length);
+    int matches = 1;
+    int i, mode;
+
+    for(i = 0; i < (int)(sizeof(modes) / sizeof(modes[0])); i++){
+        mode = modes[i];
+        otpCodecSelect("scalar");
+        otpTransform(mode, buffers->text, buffers->key, expected, length);
+        otpCodecSelect(codec);
+        otpTransform(mode, buffers->text, buffers->key, buffers->out, length);
+        matches &= memcmp(expected, buffers->out, length) == 0;
+    }
+    matches &= otpValidate(buffers->text, length);
+    buffers->text[length / 2] = 'a';                                            /* One bad character in the middle must be caught */
+    matches &= !otpValidate(buffers->text, length);
+    buffers->text[length / 2] = 'A';
+
+    free(expected);
+    return matches;
+}
+
+static uint64_t runOperation(int operation, struct otpPool* pool, const struct benchBuffers* buffers, size_t size, uint64_t repeats, uint64_t* cycles){
+    uint64_t startNs = nowNs();
+    uint64_t startCycles = __rdtsc();
+    uint64_t r;
+
+    for(r = 0; r < repeats; r++){
+        if(operation == BENCH_OP_VALIDATE){
+            validateSink = otpValidate(buffers->text, size);
+        }
+        else{
+            otpPoolTransform(pool, operation == BENCH_OP_ENCODE ? OTP_MODE_ENCODE : operation == BENCH_OP_DECODE ? OTP_MODE_DECODE : OTP_MODE_XOR,
+                             buffers->text, buffers->key, buffers->out, size);
+        }
+    }
+
+    *cycles = __rdtsc() - startCycles;
+    return nowNs() - startNs;
+}
+
+/* Find how many repeats of size bytes make a trial, then keep the fastest of BENCH_TRIALS trials */
+static void timeOperation(int operation, struct otpPool* pool, const struct benchBuffers* buffers, size_t size, double* cyclesPerByte, double* gigabytesPerSecond){
+    uint64_t repeats = 1;
+    uint64_t bestNs = UINT64_MAX, bestCycles = UINT64_MAX;
+    uint64_t elapsedNs, cycles;
+    int trial;
+
+    /* Double the repeats until a trial covers BENCH_TRIAL_BYTES or lasts BENCH_TRIAL_NS, whichever comes first */
+    while(repeats * size < BENCH_TRIAL_BYTES && runOperation(operation, pool, buffers, size, repeats, &cycles) < BENCH_TRIAL_NS){
+        repeats *= 2;
+    }
+
+    for(trial = 0; trial < BENCH_TRIALS; trial++){
+        elapsedNs = runOperation(operation, pool, buffers, size, repeats, &cycles);
+        if(elapsedNs < bestNs){
+            bestNs = elapsedNs;
+            bestCycles = cycles;
+        }
+    }
+
+    *cyclesPerByte = (double)bestCycles / (repeats * size);
+    *gigabytesPerSecond = (double)repeats * size / (bestNs > 0 ? bestNs : 1);  /* Bytes per nanosecond are GB/s */
+}
+
+int main(int argc, char* argv[]){
+    struct benchBuffers buffers;
+    struct otpPool* pool;
+    const char* onlyCodec = NULL;
+    const char* codec;
+    int threadCounts[BENCH_MAX_THREAD_COUNTS] = {1};
+    int threadCountCount = 1;
+    double cyclesPerByte, gigabytesPerSecond;
+    size_t variant, size;
+    char* list;
+    char* end;
+    int option, operation, t;
+
+    buffers.size = BENCH_DEFAULT_MAX_SIZE;
+    while((option = getopt(argc, argv, "c:t:s:")) != -1){
+        if(option == 'c'){
+            onlyCodec = optarg;
+        }
+        else if(option == 't'){
+            threadCountCount = 0;
+            for(list = strtok(optarg, ","); list != NULL; list = strtok(NULL, ",")){
+                if(threadCountCount == BENCH_MAX_THREAD_COUNTS || atoi(list) < 1){
+                    usage();
+                }
+                threadCounts[threadCountCount++] = atoi(list);
+            }
+        }
+        else if(option == 's'){
+            buffers.size = strtoull(optarg, &end, 10);
+            if(*end != '\0' || buffers.size < BENCH_MIN_SIZE){
+                usage();
+            }
+        }
+        else{
+            usage();
+        }
+    }
+    if(optind != argc){
+        usage();
+    }
+
+    buffers.text = mapBuffer(buffers.size);
+    buffers.key = mapBuffer(buffers.size);
+    buffers.out = mapBuffer(buffers.size);
+    fillBuffers(&buffers);
+
+    printf("operation\tcodec\tthreads\tbytes\tcycles_per_byte\tgb_per_s\n");
+    for(variant = 0; (codec = otpCodecVariant(variant)) != NULL; variant++){
+        if(onlyCodec != NULL && strcmp(codec, onlyCodec) != 0){
+            continue;
+        }
+        if(!otpCodecSelect(codec)){                                             /* This CPU lacks the instructions */
+            fprintf(stderr, "otp_codec_bench: %s is not supported here, skipped\n", codec);
+            continue;
+        }
+        if(!matchesScalar(codec, &buffers)){
+            fprintf(stderr, "otp_codec_bench: %s does not match the scalar codec\n", codec);
+            return 1;
+        }
+
+        for(operation = BENCH_OP_ENCODE; operation <= BENCH_OP_VALIDATE; operation++){
+            for(t = 0; t < threadCountCount; t++){
+                if(operation == BENCH_OP_VALIDATE && t > 0){                    /* The clients check their input on one thread */
+                    break;
+                }
+                pool = otpPoolCreate(threadCounts[t], 0);
+                for(size = BENCH_MIN_SIZE; size <= buffers.size; size *= BENCH_SIZE_STEP){
+                    timeOperation(operation, pool, &buffers, size, &cyclesPerByte, &gigabytesPerSecond);
+                    printf("%s\t%s\t%d\t%zu\t%.3f\t%.3f\n", operationNames[operation], codec, operation == BENCH_OP_VALIDATE ? 1 : threadCounts[t], size, cyclesPerByte, gigabytesPerSecond);
+                    fflush(stdout);
+                }
+                otpPoolDestroy(pool);
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,254 @@
+/****************************************************************
+* Author: Nicholas Schaffner
+* Last Modified: 10/17/26
+* Description: Exhaustive check of the codec kernels in otp_codec.c. The scalar implementation is first checked against
+*               the definition of the cipher (see otp_codec.h) for every one of the 27 x 27 text and key pairs, then
+*               every implementation this CPU supports (avx512, avx2, sse4.1 and table) must match it for those pairs in
+*               both modes, starting at each offset 0-63 into the buffers so every alignment and vector tail is covered,
+*               both into a separate buffer and in place over the text, the way the daemons run it.
+*               otpValidate must accept exactly the 27 allowed characters: each of the 256 byte values is placed at
+*               every position of buffers of every length up to TEST_VALIDATE_LENGTH. The packed format is checked the
+*               same way: every group otpPack writes must hold the value its definition gives, otpUnpack must give the
+*               characters back and otpPackedTransform, in place too, must give the packed scalar output. otpPackedValidate
+*               must reject a group holding 27^5 or more, and a last group whose padding is not 0, at every position of
+*               every length up to TEST_VALIDATE_LENGTH. OTP_MODE_XOR must give text ^ key for every one of the 256 x 256
+*               byte pairs, at every start offset, in place too. The syntax for this program is:
+*               otp_codec_test
+*               Each implementation prints one line, "ok" or the first mismatch, and unsupported ones are skipped. The
+*               exit value is 0 when every supported implementation passed and 1 otherwise.
+****************************************************************/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "otp_codec.h"
+
+#define TEST_PAIRS (27 * 27)
+#define TEST_OFFSETS 64                                                         /* Start offsets tried, covers every alignment up to a 512 bit vector */
+#define TEST_BYTE_PAIRS (256 * 256)
+#define TEST_VALIDATE_LENGTH 200                                                /* Longer than three 512 bit vectors plus a tail */
+
+static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ ";
+
+static int valueOf(char c){                                                     /* 'A' = 0 ... 'Z' = 25, ' ' = 26 */
+    return c == ' ' ? 26 : c - 'A';
+}
+
+/* Compare the scalar output with the definition of the cipher. Returns 0 on success */
+static int checkScalar(const char* text, const char* key, char expected[2][TEST_PAIRS]){
+    int mode, i, value;
+
+    for(mode = OTP_MODE_ENCODE; mode <= OTP_MODE_DECODE; mode++){
+        for(i = 0; i < TEST_PAIRS; i++){
+            if(mode == OTP_MODE_ENCODE){
+                value = (valueOf(text[i]) + valueOf(key[i])) % 27;
+            }
+            else{
+                value = (valueOf(text[i]) - valueOf(key[i]) + 27) % 27;
+            }
+            if(expected[mode][i] != alphabet[value]){
+                printf("scalar: %s of '%c' with key '%c' gave '%c'\n", mode == OTP_MODE_ENCODE ? "encode" : "decode", text[i], key[i], expected[mode][i]);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Compare the selected implementation with the scalar output at every start offset. Returns 0 on success */
+static int checkTransform(const char* name, const char* text, const char* key, char expected[2][TEST_PAIRS]){
+    char out[TEST_PAIRS];
+    int mode, offset, i;
+
+    for(mode = OTP_MODE_ENCODE; mode <= OTP_MODE_DECODE; mode++){
+        for(offset = 0; offset < TEST_OFFSETS; offset++){
+            memset(out, '\0', sizeof(out));
+            otpTransform(mode, text + offset, key + offset, out, TEST_PAIRS - offset);
+            for(i = offset; i < TEST_PAIRS; i++){
+                if(out[i - offset] != expected[mode][i]){
+                    printf("%s: %s of '%c' with key '%c' at offset %d gave '%c', expected '%c'\n", name, mode == OTP_MODE_ENCODE ? "encode" : "decode",
+                           text[i], key[i], offset, out[i - offset], expected[mode][i]);
+                    return -1;
+                }
+            }
+
+            memcpy(out, text + offset, TEST_PAIRS - offset);                    /* The daemons transform a DATA frame over its own text */
+            otpTransform(mode, out, key + offset, out, TEST_PAIRS - offset);
+            if(memcmp(out, expected[mode] + offset, TEST_PAIRS - offset) != 0){
+                printf("%s: %s in place at offset %d differs from the scalar output\n", name, mode == OTP_MODE_ENCODE ? "encode" : "decode", offset);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+static int checkValidate(const char* name){                                     /* Try every byte value at every position of every length. Returns 0 on success */
+    char buffer[TEST_VALIDATE_LENGTH];
+    int byte, length, position, allowed, result;
+
+    for(byte = 0; byte < 256; byte++){
+        allowed = byte == ' ' || (byte >= 'A' && byte <= 'Z');
+        for(length = 1; length <= TEST_VALIDATE_LENGTH; length++){
+            memset(buffer, 'A', sizeof(buffer));
+            for(position = 0; position < length; position++){
+                buffer[position] = (char)byte;
+                result = otpValidate(buffer, length);
+                buffer[position] = 'A';
+                if(result != allowed){
+                    printf("%s: validate %s byte %d at position %d of %d\n", name, allowed ? "rejected" : "accepted", byte, position, length);
+                    return -1;
+                }
+            }
+        }
+    }
+    if(!otpValidate(buffer, 0)){
+        printf("%s: validate rejected an empty buffer\n", name);
+        return -1;
+    }
+    return 0;
+}
+
+static void storeValue(char* out, uint32_t value){                               /* A packed group, little-endian */
+    out[0] = value & 0xff;
+    out[1] = (value >> 8) & 0xff;
+    out[2] = (value >> 16) & 0xff;
+}
+
+/* Check the packed routines at every start offset, against the definition and the scalar output. Returns 0 on success */
+static int checkPacked(const char* name, const char* text, const char* key, char expected[2][TEST_PAIRS]){
+    char packedText[OTP_PACKED_SIZE(TEST_PAIRS)], packedKey[OTP_PACKED_SIZE(TEST_PAIRS)], result[OTP_PACKED_SIZE(TEST_PAIRS)];
+    char group[OTP_PACKED_GROUP_SIZE];
+    char out[TEST_PAIRS];
+    size_t length, i;
+    uint32_t value;
+    int mode, offset, j;
+
+    for(offset = 0; offset < TEST_OFFSETS; offset++){
+        length = TEST_PAIRS - offset;                                           /* Every remainder modulo 5, so every padding */
+        otpPack(text + offset, length, packedText);
+        otpPack(key + offset, length, packedKey);
+        for(i = 0; i < length; i += OTP_PACK_GROUP){
+            value = 0;
+            for(j = OTP_PACK_GROUP - 1; j >= 0; j--){
+                value = value * 27 + (i + j < length ? valueOf(text[offset + i + j]) : 0);
+            }
+            storeValue(group, value);
+            if(memcmp(group, packedText + i / OTP_PACK_GROUP * OTP_PACKED_GROUP_SIZE, OTP_PACKED_GROUP_SIZE) != 0){
+                printf("%s: pack of group %zu at offset %d is not %u\n", name, i / OTP_PACK_GROUP, offset, value);
+                return -1;
+            }
+        }
+
+        otpUnpack(packedText, length, out);
+        if(memcmp(out, text + offset, length) != 0 || !otpPackedValidate(packedText, length)){
+            printf("%s: packed text at offset %d does not unpack or validate\n", name, offset);
+            return -1;
+        }
+
+        for(mode = OTP_MODE_ENCODE; mode <= OTP_MODE_DECODE; mode++){
+            memcpy(result, packedText, OTP_PACKED_SIZE(length));                /* The daemons transform a DATA frame over its own text */
+            otpPackedTransform(mode, result, packedKey, result, length);
+            otpUnpack(result, length, out);
+            if(memcmp(out, expected[mode] + offset, length) != 0){
+                printf("%s: packed %s at offset %d differs from the scalar output\n", name, mode == OTP_MODE_ENCODE ? "encode" : "decode", offset);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+static int checkPackedValidate(const char* name){                               /* Put a value out of range in every group of every length. Returns 0 on success */
+    char packed[OTP_PACKED_SIZE(TEST_VALIDATE_LENGTH)];
+    size_t length, group, groups, symbols;
+    uint32_t limit;
+
+    for(length = 1; length <= TEST_VALIDATE_LENGTH; length++){
+        groups = (length + OTP_PACK_GROUP - 1) / OTP_PACK_GROUP;
+        for(group = 0; group < groups; group++){
+            symbols = group + 1 < groups ? OTP_PACK_GROUP : length - group * OTP_PACK_GROUP;
+            for(limit = 1; symbols > 0; symbols--){
+                limit *= 27;
+            }
+            memset(packed, '\0', sizeof(packed));
+            storeValue(packed + group * OTP_PACKED_GROUP_SIZE, limit - 1);
+            if(!otpPackedValidate(packed, length)){
+                printf("%s: packed validate rejected %u in group %zu of %zu symbols\n", name, limit - 1, group, length);
+                return -1;
+            }
+            storeValue(packed + group * OTP_PACKED_GROUP_SIZE, limit);
+            if(otpPackedValidate(packed, length)){
+                printf("%s: packed validate accepted %u in group %zu of %zu symbols\n", name, limit, group, length);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+static int checkXor(const char* name){                                          /* Every byte against every byte, at every start offset. Returns 0 on success */
+    static char text[TEST_BYTE_PAIRS], key[TEST_BYTE_PAIRS], out[TEST_BYTE_PAIRS];
+    int offset, i;
+
+    for(i = 0; i < TEST_BYTE_PAIRS; i++){
+        text[i] = i / 256;
+        key[i] = i % 256;
+    }
+
+    for(offset = 0; offset < TEST_OFFSETS; offset++){
+        otpTransform(OTP_MODE_XOR, text + offset, key + offset, out + offset, TEST_BYTE_PAIRS - offset);
+        for(i = offset; i < TEST_BYTE_PAIRS; i++){
+            if(out[i] != (char)(text[i] ^ key[i])){
+                printf("%s: xor of %d with %d at offset %d gave %d\n", name, (unsigned char)text[i], (unsigned char)key[i], offset, (unsigned char)out[i]);
+                return -1;
+            }
+        }
+    }
+
+    memcpy(out, text, TEST_BYTE_PAIRS);                                         /* In place, then back again: XOR is its own inverse */
+    otpTransform(OTP_MODE_XOR, out, key, out, TEST_BYTE_PAIRS);
+    otpTransform(OTP_MODE_XOR, out, key, out, TEST_BYTE_PAIRS);
+    if(memcmp(out, text, TEST_BYTE_PAIRS) != 0){
+        printf("%s: xor in place does not give the text back\n", name);
+        return -1;
+    }
+    return 0;
+}
+
+int main(void){
+    char text[TEST_PAIRS], key[TEST_PAIRS];
+    char expected[2][TEST_PAIRS];                                               /* Scalar output per mode */
+    const char* name;
+    size_t index;
+    int failures = 0;
+    int i;
+
+    for(i = 0; i < TEST_PAIRS; i++){                                            /* Every text character against every key character */
+        text[i] = alphabet[i / 27];
+        key[i] = alphabet[i % 27];
+    }
+
+    otpCodecSelect("scalar");
+    otpTransform(OTP_MODE_ENCODE, text, key, expected[OTP_MODE_ENCODE], TEST_PAIRS);
+    otpTransform(OTP_MODE_DECODE, text, key, expected[OTP_MODE_DECODE], TEST_PAIRS);
+    if(checkScalar(text, key, expected) != 0){
+        return 1;                                                               /* Nothing left to compare the others with */
+    }
+
+    for(index = 0; (name = otpCodecVariant(index)) != NULL; index++){
+        if(!otpCodecSelect(name)){
+            printf("%s: not supported by this CPU, skipped\n", name);
+            continue;
+        }
+        if(checkTransform(name, text, key, expected) != 0 || checkValidate(name) != 0 ||
+           checkPacked(name, text, key, expected) != 0 || checkPackedValidate(name) != 0 || checkXor(name) != 0){
+            failures++;
+            continue;
+        }
+        printf("%s: ok\n", name);
+    }
+
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,20 @@
+/****************************************************************
+* Author: Nicholas Schaffner
+* Last Modified: 10/17/26
+* Description: This program will run in the background as a daemon that performs both the encoding and the decoding of
+*               otp_enc_d and otp_dec_d, so one set of processes, buffers and metrics serves whatever mix of the two
+*               the clients send. It greets every connection with "ENCDEC" and otp_enc and otp_dec then name their
+*               operation with a MODE frame (see otp_proto.h). The syntax for this program is:
+*               otp_d [--workers N] [--engine fork|epoll|uring] [--threads N] [--parallel-threshold BYTES] [--backlog N] [--max-connections N] [--pad NAME=FILE]... [--encode-port PORT] [--decode-port PORT] (listening_port | --unix PATH)
+*               The options are those of otp_enc_d. --encode-port and --decode-port also listen on ports that greet with
+*               the old "ENCODE" and "DECODE" handshakes, for clients that predate otp_d; they are served by the same
+*               processes. All errors are output to stderr but will not crash or otherwise exit, unless the errors happen
+*               when the program is starting up.
+****************************************************************/
+
+#include "otp_proto.h"
+#include "otp_server.h"
+
+int main(int argc, char *argv[]){
+    return runServer(argc, argv, OTP_MODE_ANY);                                 /* The shared daemon code lives in otp_server.c */
+}
@@ -0,0 +1,158 @@
+/****************************************************************
+* Author: Nicholas Schaffner
+* Last Modified: 10/17/26
+* Description: Where the daemons listen and how a client reaches one: the endpoint list a client chooses from, its
+*               rendezvous ranking, the connect itself (blocking or not) and the meaning of the daemon's greeting.
+*               Shared by otp_enc, otp_dec and the otp_async library; nothing here prints or exits.
+****************************************************************/
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+
+#include "otp_codec.h"
+#include "otp_proto.h"
+#include "otp_endpoint.h"
+
+static int unixAddress(const char* path, struct sockaddr_un* serverAddress){    /* Returns -1 with errno set when path does not fit */
+    memset((char *)serverAddress, '\0', sizeof(*serverAddress));              /* Clear out the address struct */
+    serverAddress->sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(serverAddress->sun_path)){
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(serverAddress->sun_path, path);
+    return 0;
+}
+
+static void tcpAddress(int portNumber, struct sockaddr_in* serverAddress){     /* portNumber on localhost */
+    /* Set up the address struct */
+    memset((char *)serverAddress, '\0', sizeof(*serverAddress));              /* Clear out the address struct */
+
+    serverAddress->sin_family = AF_INET;                                        /* Create a network-capable socket */
+    serverAddress->sin_port = htons(portNumber);                                /* Store the port number */
+    serverAddress->sin_addr.s_addr = htonl(INADDR_LOOPBACK);                    /* localhost, without a blocking and thread-unsafe name lookup */
+}
+
+/* Create a socket of socketFlags (SOCK_NONBLOCK, SOCK_CLOEXEC) and start connecting it to endpoint. Returns the
+ * socket, or -1 with errno set on failure. A non-blocking socket may return with errno EINPROGRESS still connecting */
+int otpEndpointConnect(const struct otpEndpoint* endpoint, int socketFlags){
+    union{
+        struct sockaddr_un unixAddress;
+        struct sockaddr_in tcpAddress;
+    } serverAddress;
+    socklen_t addressLength;
+    int socketFD, savedErrno;
+
+    if(endpoint->unixPath != NULL){
+        if(unixAddress(endpoint->unixPath, &serverAddress.unixAddress) < 0){
+            return -1;
+        }
+        addressLength = sizeof(serverAddress.unixAddress);
+    }
+    else{
+        tcpAddress(endpoint->portNumber, &serverAddress.tcpAddress);
+        addressLength = sizeof(serverAddress.tcpAddress);
+    }
+
+    /* Set up the socket */
+    socketFD = socket(endpoint->unixPath != NULL ? AF_UNIX : AF_INET, SOCK_STREAM | socketFlags, 0);    /* Create the socket */
+    if (socketFD < 0){
+        return -1;
+    }
+
+    /* Connect to server */
+    if (connect(socketFD, (struct sockaddr*)&serverAddress, addressLength) < 0 && errno != EINPROGRESS){     /* Connect socket to address */
+        savedErrno = errno;
+        close(socketFD);
+        errno = savedErrno;
+        return -1;
+    }
+
+    return socketFD;
+}
+
+/* Tell what the daemon's 6 character greeting means for a client of mode: one of the OTP_CONNECT_* reasons. For
+ * otp_d's greeting it returns OTP_CONNECT_OK and sets *unified, the client must then name its operation with a MODE frame */
+int otpCheckHandshake(const char* handshake, int mode, int* unified){
+    int otherMode = (mode == OTP_MODE_ENCODE) ? OTP_MODE_DECODE : OTP_MODE_ENCODE;
+
+    *unified = strncmp(handshake, otpHandshake(OTP_MODE_ANY), OTP_HANDSHAKE_SIZE) == 0;
+    if(*unified || strncmp(handshake, otpHandshake(mode), OTP_HANDSHAKE_SIZE) == 0){
+        return OTP_CONNECT_OK;
+    }
+    if(strncmp(handshake, OTP_HANDSHAKE_BUSY, OTP_HANDSHAKE_SIZE) == 0){         /* Turned away, the connection is closed already */
+        return OTP_CONNECT_BUSY;
+    }
+    return strncmp(handshake, otpHandshake(otherMode), OTP_HANDSHAKE_SIZE) == 0 ? OTP_CONNECT_OTHER_DAEMON : OTP_CONNECT_NO_HANDSHAKE;
+}
+
+/* Add the daemons named on the command line to endpoints: unixPath, from one --unix option, or else ports, one port
+ * number or several separated by commas. Returns 0, or -1 when a port is not a number from 1 to 65535 or the list is full */
+int otpEndpointsAdd(struct otpEndpointList* endpoints, const char* ports, const char* unixPath){
+    char* end;
+    long port;
+
+    if(unixPath != NULL){
+        if(endpoints->count == OTP_MAX_ENDPOINTS){
+            return -1;
+        }
+        endpoints->endpoints[endpoints->count].portNumber = 0;
+        endpoints->endpoints[endpoints->count++].unixPath = unixPath;
+        return 0;
+    }
+
+    do{
+        port = strtol(ports, &end, 10);
+        if(end == ports || port < 1 || port > 65535 || (*end != ',' && *end != '\0') || endpoints->count == OTP_MAX_ENDPOINTS){
+            return -1;
+        }
+        endpoints->endpoints[endpoints->count].portNumber = port;
+        endpoints->endpoints[endpoints->count++].unixPath = NULL;
+        ports = end + 1;
+    } while(*end == ',');
+
+    return 0;
+}
+
+static uint64_t mixHash(uint64_t value){                                        /* splitmix64 finalizer: every input bit affects every output bit */
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+    return value ^ (value >> 31);
+}
+
+static uint64_t endpointHash(const struct otpEndpoint* endpoint){               /* Identity of a daemon, the same in every client */
+    uint64_t hash = 0xcbf29ce484222325ULL;                                      /* FNV-1a of the socket path */
+    const char* c;
+
+    if(endpoint->unixPath == NULL){
+        return mixHash(endpoint->portNumber);
+    }
+    for(c = endpoint->unixPath; *c != '\0'; c++){
+        hash = (hash ^ (unsigned char)*c) * 0x100000001b3ULL;
+    }
+    return mixHash(hash);
+}
+
+/* Rendezvous hashing: fill order with the indexes of the endpoints from the highest hash of key and the endpoint to the
+ * lowest. One key always tries the daemons in the same order and different keys spread evenly over them. When a daemon
+ * is down, the keys that preferred it spread evenly over the others instead of all falling on its neighbour in the list */
+void otpEndpointsRank(const struct otpEndpointList* endpoints, uint64_t key, int* order){
+    uint64_t weights[OTP_MAX_ENDPOINTS];
+    int i, j;
+
+    for(i = 0; i < endpoints->count; i++){                                      /* Insertion sort, the list is short */
+        uint64_t weight = mixHash(key ^ endpointHash(&endpoints->endpoints[i]));
+
+        for(j = i; j > 0 && weights[j - 1] < weight; j--){
+            weights[j] = weights[j - 1];
+            order[j] = order[j - 1];
+        }
+        weights[j] = weight;
+        order[j] = i;
+    }
+}
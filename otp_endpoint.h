@@ -0,0 +1,35 @@
+/****************************************************************
+* Author: Nicholas Schaffner
+* Last Modified: 10/17/26
+* Description: Daemon endpoints and connecting to them, see otp_endpoint.c.
+****************************************************************/
+
+#ifndef OTP_ENDPOINT_H
+#define OTP_ENDPOINT_H
+
+#include <stdint.h>
+
+#define OTP_MAX_ENDPOINTS 16                                                    /* Daemons a client can be given to choose from */
+
+#define OTP_CONNECT_OK 0
+#define OTP_CONNECT_FAILED 1                                                    /* No connection, or it broke during the handshake; errno says why */
+#define OTP_CONNECT_OTHER_DAEMON 2                                              /* The daemon of the other mode answered */
+#define OTP_CONNECT_NO_HANDSHAKE 3                                              /* Something that is not one of our daemons answered */
+#define OTP_CONNECT_BUSY 4                                                      /* The daemon is serving as many connections as it allows */
+
+struct otpEndpoint{                                                             /* Where the daemon listens */
+    int portNumber;                                                             /* TCP port on localhost, used when unixPath is NULL */
+    const char* unixPath;                                                       /* Unix domain socket given with --unix */
+};
+
+struct otpEndpointList{                                                         /* Daemons of the same kind, any of which can serve the client */
+    struct otpEndpoint endpoints[OTP_MAX_ENDPOINTS];
+    int count;
+};
+
+int otpEndpointsAdd(struct otpEndpointList* endpoints, const char* ports, const char* unixPath);
+void otpEndpointsRank(const struct otpEndpointList* endpoints, uint64_t key, int* order);
+int otpEndpointConnect(const struct otpEndpoint* endpoint, int socketFlags);
+int otpCheckHandshake(const char* handshake, int mode, int* unified);
+
+#endif
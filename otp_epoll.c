@@ -0,0 +1,306 @@
+/****************************************************************
+* Author: Nicholas Schaffner
+* Last Modified: 10/17/26
+* Description: Single process event loop engine for the daemons (--engine epoll). All sockets are
+*               non-blocking and the connections are registered edge-triggered with one epoll instance. Every connection is a small state
+*               machine: it sends the handshake, receives frames into its otpRecvBuffer, transforms each complete DATA
+*               frame with processFrame() and sends the reply before the next frame is looked at, so a client that does
+*               not read its replies only stalls its own connection. A connection holds a receive buffer from the
+*               arena (otp_arena.h) only while it has bytes in it, and a DATA frame is transformed in place and sent
+*               straight from that buffer, so idle clients cost no buffer at all and a busy loop makes no allocations.
+****************************************************************/
+
+#define _GNU_SOURCE                                                             /* For accept4 */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+#include "otp_arena.h"
+#include "otp_codec.h"
+#include "otp_proto.h"
+#include "otp_server.h"
+#include "otp_stats.h"
+
+#define OTP_EPOLL_MAX_EVENTS 256                                                /* Number of events handled per epoll_wait call */
+#define OTP_EPOLL_SMALL_FRAME (OTP_FRAME_HEADER_SIZE + OTP_MAX_ERROR_SIZE)       /* Handshake, errors and KEY replies, which do not fit over their request */
+
+struct otpConnection{
+    int connectionFD;
+    int mode;                                                                   /* Mode of the listener that accepted it */
+    struct otpRecvBuffer recvBuffer;                                            /* Frames received from the client, no buffer while it is empty */
+    char* sendBuffer;                                                           /* Handshake or reply frame waiting to be sent: in recvBuffer, smallFrame or sendOwned */
+    char* sendOwned;                                                            /* Arena buffer holding a STATS reply, given back once it is sent */
+    char smallFrame[OTP_EPOLL_SMALL_FRAME];
+    size_t sendLength;                                                          /* Number of bytes in sendBuffer */
+    size_t sendOffset;                                                          /* Number of bytes of sendBuffer already sent */
+    int closeAfterSend;                                                         /* Set once a frame that could not be parsed has been answered */
+    struct otpSession session;                                                  /* Key pad range and failed request of the current message */
+    uint64_t recvStartNs;                                                       /* When the connection began waiting for the next frame, 0 if it is not */
+    uint64_t sendStartNs;                                                       /* When the pending reply was queued, 0 for the handshake */
+    struct otpConnection* next;                                                 /* Next closed connection kept for reuse */
+};
+
+static struct otpConnection* idleConnections = NULL;                            /* Closed connections, reused before allocating new ones */
+
+static int setNonBlocking(int fd){
+    int flags = fcntl(fd, F_GETFL, 0);
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static struct otpConnection* newConnection(void){                              /* A cleared connection, NULL when out of memory */
+    struct otpConnection* connection = idleConnections;
+
+    if(connection != NULL){
+        idleConnections = connection->next;
+    }
+    else{
+        connection = otpArenaAlloc(sizeof(*connection));
+        if(connection == NULL){
+            return NULL;
+        }
+    }
+    memset(connection, '\0', sizeof(*connection));
+    return connection;
+}
+
+static void closeConnection(struct otpConnection* connection){                  /* Closing the socket also removes it from the epoll set */
+    otpStatsCount(&otpStatsLocal->closed, 1);
+    close(connection->connectionFD);
+    otpStatsReleaseConnection();
+    otpArenaDetach(&connection->recvBuffer);
+    otpArenaGive(connection->sendOwned);
+    connection->next = idleConnections;
+    idleConnections = connection;
+}
+
+static int queueReply(struct otpConnection* connection, const struct otpFrameHeader* header, char* payload){
+    uint32_t replyLength;
+    int replyType;
+    char* frame;
+
+    if(replyInPlace(header)){                                                   /* Transform over the request, its header becomes the reply's */
+        frame = payload - OTP_FRAME_HEADER_SIZE;
+    }
+    else if(OTP_FRAME_HEADER_SIZE + maxReplyLength(header) <= sizeof(connection->smallFrame)){
+        frame = connection->smallFrame;
+    }
+    else{                                                                       /* Only a STATS reply gets this large */
+        frame = connection->sendOwned = otpArenaTake();
+        if(frame == NULL){
+            return OTP_ERR_IO;
+        }
+    }
+
+    replyType = processFrame(connection->mode, &connection->session, header, payload, frame + OTP_FRAME_HEADER_SIZE, &replyLength);
+    if(replyType == OTP_NO_REPLY){                                              /* Part of a request that was already rejected */
+        otpArenaGive(connection->sendOwned);
+        connection->sendOwned = NULL;
+        return OTP_OK;
+    }
+    encodeFrameHeader(frame, replyType, header->requestId, replyLength);
+
+    connection->sendBuffer = frame;
+    connection->sendLength = OTP_FRAME_HEADER_SIZE + replyLength;
+    connection->sendOffset = 0;
+    connection->sendStartNs = otpStatsNow();
+
+    return OTP_OK;
+}
+
+static void queueProtocolError(struct otpConnection* connection){
+    const char* msg = "malformed frame";
+    char* frame = connection->smallFrame;
+
+    otpStatsCount(&otpStatsLocal->errors[OTP_STATS_ERR_MALFORMED], 1);
+    encodeFrameHeader(frame, OTP_FRAME_ERROR, 0, strlen(msg));
+    memcpy(frame + OTP_FRAME_HEADER_SIZE, msg, strlen(msg));
+    connection->sendBuffer = frame;
+    connection->sendLength = OTP_FRAME_HEADER_SIZE + strlen(msg);
+    connection->sendOffset = 0;
+    connection->closeAfterSend = 1;
+}
+
+/* Make as much progress as the socket allows: flush the pending reply, turn the next complete frame into a reply,
+ * and read more input. Returns when every step would block. Returns -1 once the connection has been closed. */
+static int driveConnection(struct otpConnection* connection){
+    struct otpFrameHeader header;
+    char* payload;
+    ssize_t count;
+    int progress, status;
+
+    do{
+        progress = 0;
+
+        while(connection->sendOffset < connection->sendLength){                 /* Flush the pending handshake or reply */
+            count = send(connection->connectionFD, connection->sendBuffer + connection->sendOffset, connection->sendLength - connection->sendOffset, MSG_NOSIGNAL);
+            if(count < 0){
+                if(errno == EAGAIN || errno == EWOULDBLOCK){
+                    break;
+                }
+                if(errno == EINTR){
+                    continue;
+                }
+                otpStatsCount(&otpStatsLocal->errors[OTP_STATS_ERR_IO], 1);
+                closeConnection(connection);
+                return -1;
+            }
+            connection->sendOffset += count;
+            progress = 1;
+        }
+
+        if(connection->sendOffset < connection->sendLength){                    /* The client is not reading, wait for EPOLLOUT before doing more work */
+            return 0;
+        }
+        if(connection->sendStartNs != 0){                                       /* The whole reply is out */
+            otpStatsObserve(OTP_PHASE_SEND, otpStatsNow() - connection->sendStartNs);
+            connection->sendStartNs = 0;
+        }
+        connection->sendLength = 0;
+        connection->sendOffset = 0;
+        otpArenaGive(connection->sendOwned);
+        connection->sendOwned = NULL;
+
+        if(connection->closeAfterSend){
+            closeConnection(connection);
+            return -1;
+        }
+
+        status = OTP_AGAIN;
+        if(connection->recvBuffer.data != NULL){                                /* No buffer, nothing received yet */
+            status = recvBufferNextFrame(&connection->recvBuffer, 2 * OTP_CHUNK_SIZE, &header, &payload);
+        }
+        if(status == OTP_OK){
+            otpStatsObserve(OTP_PHASE_RECV, connection->recvStartNs != 0 ? otpStatsNow() - connection->recvStartNs : 0);
+            connection->recvStartNs = 0;
+            if(queueReply(connection, &header, payload) != OTP_OK){
+                closeConnection(connection);
+                return -1;
+            }
+            progress = 1;
+            continue;                                                           /* Send the reply before looking at the next frame */
+        }
+        if(status != OTP_AGAIN){
+            queueProtocolError(connection);
+            progress = 1;
+            continue;
+        }
+        if(connection->recvStartNs == 0){                                       /* Waiting for a frame starts now */
+            connection->recvStartNs = otpStatsNow();
+        }
+
+        if(otpArenaAttach(&connection->recvBuffer) != OTP_OK){
+            closeConnection(connection);
+            return -1;
+        }
+        count = recvBufferRead(connection->connectionFD, &connection->recvBuffer);
+        if(count > 0 || (count < 0 && errno == EINTR)){
+            progress = 1;
+        }
+        else if(count == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)){      /* Client went away */
+            closeConnection(connection);
+            return -1;
+        }
+    } while(progress);
+
+    if(connection->recvBuffer.start == connection->recvBuffer.end){            /* Drained, let a busier connection use the buffer meanwhile */
+        otpArenaDetach(&connection->recvBuffer);
+    }
+    return 0;
+}
+
+static void acceptConnections(const struct otpListener* listener, int epollFD){    /* Accept every pending connection */
+    struct otpConnection* connection;
+    struct epoll_event event;
+    int connectionFD;
+
+    while(1){
+        connectionFD = accept4(listener->socketFD, NULL, NULL, SOCK_NONBLOCK);
+        if(connectionFD < 0){
+            if(errno == EINTR || errno == ECONNABORTED){
+                continue;
+            }
+            acceptFailed(listener);                                             /* A failed accept only affects that one client, keep serving */
+            return;
+        }
+        if(!admitConnection(connectionFD)){                                     /* Shed, the daemon already serves --max-connections */
+            continue;
+        }
+
+        connection = newConnection();
+        if(connection == NULL){
+            close(connectionFD);
+            otpStatsReleaseConnection();
+            continue;
+        }
+        connection->connectionFD = connectionFD;
+        connection->mode = listener->mode;
+        initSession(&connection->session);
+        otpStatsCount(&otpStatsLocal->accepted, 1);
+
+        /* Queue the handshake that verifies to the client that it is connected to the correct daemon */
+        connection->sendBuffer = connection->smallFrame;
+        memcpy(connection->sendBuffer, otpHandshake(connection->mode), OTP_HANDSHAKE_SIZE);
+        connection->sendLength = OTP_HANDSHAKE_SIZE;
+
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = connection;
+        if(epoll_ctl(epollFD, EPOLL_CTL_ADD, connectionFD, &event) < 0){
+            perror("ERROR registering connection");
+            closeConnection(connection);
+            continue;
+        }
+
+        driveConnection(connection);
+    }
+}
+
+void runEpollLoop(const struct otpListener* listeners, int listenerCount){
+    struct epoll_event events[OTP_EPOLL_MAX_EVENTS];
+    struct epoll_event event;
+    int epollFD, eventCount, i;
+
+    otpStatsAttach();
+    epollFD = epoll_create1(EPOLL_CLOEXEC);
+    if(epollFD < 0){
+        perror("ERROR creating epoll instance");
+        exit(1);
+    }
+
+    for(i = 0; i < listenerCount; i++){
+        setNonBlocking(listeners[i].socketFD);
+        event.events = EPOLLIN;                                                 /* Level-triggered, so a connection that completes while the accept queue overflows is not missed */
+        event.data.u64 = i;                                                     /* A listener is marked by its index, which no connection pointer can equal */
+        if(epoll_ctl(epollFD, EPOLL_CTL_ADD, listeners[i].socketFD, &event) < 0){
+            perror("ERROR registering listening socket");
+            exit(1);
+        }
+    }
+
+    while(1){
+        eventCount = epoll_wait(epollFD, events, OTP_EPOLL_MAX_EVENTS, -1);
+        if(eventCount < 0){
+            if(errno == EINTR){
+                otpStatsDumpIfRequested();                                      /* SIGUSR1 asked for the metrics */
+                continue;
+            }
+            perror("ERROR waiting for events");
+            exit(1);
+        }
+
+        for(i = 0; i < eventCount; i++){
+            if(events[i].data.u64 < (uint64_t)listenerCount){
+                acceptConnections(&listeners[events[i].data.u64], epollFD);
+            }
+            else{
+                driveConnection(events[i].data.ptr);                            /* Errors and hangups show up as a failed send or recv */
+            }
+        }
+    }
+}
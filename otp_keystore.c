@@ -0,0 +1,152 @@
+/****************************************************************
+* Author: Nicholas Schaffner
+* Last Modified: 10/17/26
+* Description: Loading of the daemons' key pads and atomic reservation of key ranges from their ledgers. See
+*               otp_keystore.h. Pads are loaded before any worker is forked, so every worker shares the same mappings.
+****************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "otp_codec.h"
+#include "otp_keystore.h"
+
+#define OTP_LEDGER_SIZE 4096                                                    /* One page, only the first 8 bytes are used */
+
+static struct otpPad pads[OTP_MAX_PADS];
+static int padCount = 0;
+
+static uint64_t* mapLedger(const char* padPath){                                /* Open or create padPath.ledger and map its counter */
+    char ledgerPath[4096];
+    void* map;
+    int fd;
+
+    snprintf(ledgerPath, sizeof(ledgerPath), "%s.ledger", padPath);
+    fd = open(ledgerPath, O_RDWR | O_CREAT, 0600);
+    if(fd < 0){
+        fprintf(stderr, "ERROR opening ledger %s: %s\n", ledgerPath, strerror(errno));
+        return NULL;
+    }
+    if(ftruncate(fd, OTP_LEDGER_SIZE) != 0){                                    /* A new ledger reads as zero: nothing handed out yet */
+        fprintf(stderr, "ERROR sizing ledger %s: %s\n", ledgerPath, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    map = mmap(NULL, OTP_LEDGER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED){
+        fprintf(stderr, "ERROR mapping ledger %s: %s\n", ledgerPath, strerror(errno));
+        return NULL;
+    }
+
+    return map;
+}
+
+int otpKeyStoreAdd(const char* spec){                                           /* Load the pad described by "NAME=FILE". Returns 0 on success, -1 after printing why not */
+    const char* separator = strchr(spec, '=');
+    struct otpPad* pad;
+    struct stat info;
+    size_t nameLength;
+    void* map = NULL;
+    int fd;
+
+    if(separator == NULL || separator == spec || separator - spec > OTP_MAX_PAD_NAME){
+        fprintf(stderr, "ERROR: --pad expects NAME=FILE with a name of at most %d characters\n", OTP_MAX_PAD_NAME);
+        return -1;
+    }
+    nameLength = separator - spec;
+    if(otpKeyStoreFind(spec, nameLength) != NULL || padCount == OTP_MAX_PADS){
+        fprintf(stderr, "ERROR: duplicate pad name or more than %d pads\n", OTP_MAX_PADS);
+        return -1;
+    }
+
+    fd = open(separator + 1, O_RDONLY);
+    if(fd < 0){
+        fprintf(stderr, "ERROR opening pad %s: %s\n", separator + 1, strerror(errno));
+        return -1;
+    }
+    if(fstat(fd, &info) != 0){
+        fprintf(stderr, "ERROR reading pad %s: %s\n", separator + 1, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    if(info.st_size > 0){
+        map = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if(map == MAP_FAILED){
+            fprintf(stderr, "ERROR mapping pad %s: %s\n", separator + 1, strerror(errno));
+            close(fd);
+            return -1;
+        }
+        madvise(map, info.st_size, MADV_SEQUENTIAL);                            /* Ranges are consumed front to back */
+    }
+    close(fd);                                                                  /* The mapping keeps the file open */
+
+    pad = &pads[padCount];
+    memcpy(pad->name, spec, nameLength);
+    pad->name[nameLength] = '\0';
+    pad->data = map;
+    pad->length = info.st_size;
+    if(pad->length > 0 && pad->data[pad->length - 1] == '\n'){                  /* The newline keygen ends the file with is not key material */
+        pad->length--;
+    }
+    pad->next = mapLedger(separator + 1);
+    if(pad->next == NULL){
+        return -1;
+    }
+
+    padCount++;
+    return 0;
+}
+
+struct otpPad* otpKeyStoreFind(const char* name, size_t nameLength){
+    int i;
+
+    for(i = 0; i < padCount; i++){
+        if(strlen(pads[i].name) == nameLength && memcmp(pads[i].name, name, nameLength) == 0){
+            return &pads[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Reserve length key characters of pad for one message. Encoding takes the range at *offset, or the next unused range
+ * when *offset is OTP_PAD_NEXT, and moves the ledger past it before returning. Decoding needs the offset the message
+ * was encoded at and leaves the ledger alone. On success *offset holds the start of the range. */
+int otpPadReserve(struct otpPad* pad, int mode, uint64_t* offset, uint64_t length){
+    uint64_t current, start;
+
+    if(mode == OTP_MODE_DECODE){
+        if(*offset == OTP_PAD_NEXT){
+            return OTP_PAD_NO_OFFSET;
+        }
+        if(*offset > pad->length || length > pad->length - *offset){
+            return OTP_PAD_TOO_SHORT;
+        }
+        return OTP_PAD_OK;
+    }
+
+    current = __atomic_load_n(pad->next, __ATOMIC_ACQUIRE);
+    do{                                                                         /* Retry when another worker moved the ledger in the meantime */
+        start = (*offset == OTP_PAD_NEXT) ? current : *offset;
+        if(start < current){
+            return OTP_PAD_USED;
+        }
+        if(start > pad->length || length > pad->length - start){
+            return OTP_PAD_TOO_SHORT;
+        }
+    } while(!__atomic_compare_exchange_n(pad->next, &current, start + length, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+    if(msync(pad->next, OTP_LEDGER_SIZE, MS_SYNC) != 0){                        /* The range must stay used even if the machine goes down right after */
+        return OTP_PAD_IO;
+    }
+
+    *offset = start;
+    return OTP_PAD_OK;
+}
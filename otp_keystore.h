@@ -0,0 +1,45 @@
+/****************************************************************
+* Author: Nicholas Schaffner
+* Last Modified: 10/17/26
+* Description: Key pads held by the daemons (--pad NAME=FILE). A pad is a large key file, such as one made by
+*               keygen -o, that is mapped into memory once at startup so clients can send a pad name and an offset
+*               instead of shipping the key bytes with every message. Every pad has a ledger file next to it (FILE.ledger)
+*               holding the offset of the first key character that has never been handed out. The ledger is mapped
+*               shared and advanced with an atomic compare-and-swap, so concurrent workers, and several daemons using
+*               the same pad, never hand out the same range twice, and it is flushed to disk before the range is used.
+****************************************************************/
+
+#ifndef OTP_KEYSTORE_H
+#define OTP_KEYSTORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define OTP_MAX_PADS 16                                                         /* Number of --pad options a daemon accepts */
+#define OTP_MAX_PAD_NAME 32                                                     /* Longest pad name, in characters */
+#define OTP_PAD_NEXT UINT64_MAX                                                 /* Offset asking the daemon for the next unused range */
+
+#define OTP_PAD_OK 0
+#define OTP_PAD_TOO_SHORT -1                                                    /* The range runs past the end of the pad */
+#define OTP_PAD_USED -2                                                         /* The range starts before the ledger, part of it was handed out already */
+#define OTP_PAD_NO_OFFSET -3                                                    /* Decoding needs the offset the message was encoded at */
+#define OTP_PAD_IO -4                                                           /* The ledger could not be flushed to disk */
+
+struct otpPad{
+    char name[OTP_MAX_PAD_NAME + 1];
+    const char* data;                                                           /* The key characters, mapped read-only */
+    uint64_t length;                                                            /* Number of key characters, without the trailing newline */
+    uint64_t* next;                                                             /* First never-used offset, lives in the mapped ledger file */
+};
+
+struct otpKeyCursor{                                                            /* Key range a connection is working through */
+    const struct otpPad* pad;                                                   /* NULL while the client sends its own key */
+    uint64_t position;                                                          /* Offset of the key character for the next text character */
+    uint64_t end;                                                               /* One past the last key character reserved for the message */
+};
+
+int otpKeyStoreAdd(const char* spec);
+struct otpPad* otpKeyStoreFind(const char* name, size_t nameLength);
+int otpPadReserve(struct otpPad* pad, int mode, uint64_t* offset, uint64_t length);
+
+#endif
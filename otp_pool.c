@@ -0,0 +1,216 @@
+/****************************************************************
+* Author: Nicholas Schaffner
+* Last Modified: 10/17/26
+* Description: Work stealing thread pool for the mod 27 transform (see otp_pool.h). The calling thread takes part in
+*               every transform, so a pool of N threads starts N - 1 helpers. Every thread owns a share of the
+*               segments with its own atomic cursor; once its share is used up it moves on to the cursors of the
+*               other shares, which is how idle threads steal the remaining work of slow ones.
+****************************************************************/
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "otp_codec.h"
+#include "otp_pool.h"
+
+struct otpShare{                                                                /* The segments a thread starts on. Padded so cursors of different threads never share a cache line */
+    atomic_size_t next;                                                         /* Next segment of this share that nobody has taken yet */
+    size_t end;                                                                 /* One past the last segment of this share */
+    char padding[64 - sizeof(atomic_size_t) - sizeof(size_t)];
+};
+
+struct otpPool{
+    int threads;                                                                /* Number of threads taking part in a transform, including the caller */
+    size_t threshold;
+    pthread_t* helpers;
+    struct otpShare* shares;
+    pthread_mutex_t lock;
+    pthread_cond_t startCondition;                                              /* Signalled when a new transform is published */
+    pthread_cond_t doneCondition;                                               /* Signalled when the last helper finishes a transform */
+    unsigned long generation;                                                   /* Incremented for every transform so helpers can tell a new one from the last */
+    int running;                                                                /* Helpers that have not finished the current transform */
+    int stopping;
+
+    /* The transform currently being run */
+    size_t segmentSize;
+    int mode;
+    const char* text;
+    const char* key;
+    char* out;
+    size_t length;
+};
+
+struct otpHelper{
+    struct otpPool* pool;
+    int index;
+};
+
+static void runSegments(struct otpPool* pool, int self){                        /* Work through our own share first, then steal from the others in turn */
+    size_t segment, offset, length;
+    int i;
+
+    for(i = 0; i < pool->threads; i++){
+        struct otpShare* share = &pool->shares[(self + i) % pool->threads];
+
+        while((segment = atomic_fetch_add(&share->next, 1)) < share->end){
+            offset = segment * pool->segmentSize;
+            length = pool->length - offset < pool->segmentSize ? pool->length - offset : pool->segmentSize;
+            otpTransform(pool->mode, pool->text + offset, pool->key + offset, pool->out + offset, length);
+        }
+    }
+}
+
+static void* helperMain(void* argument){
+    struct otpHelper* helper = argument;
+    struct otpPool* pool = helper->pool;
+    int index = helper->index;
+    unsigned long seen = 0;
+
+    free(helper);
+
+    pthread_mutex_lock(&pool->lock);
+    while(1){
+        while(pool->generation == seen && !pool->stopping){                     /* Sleep until the next transform is published */
+            pthread_cond_wait(&pool->startCondition, &pool->lock);
+        }
+        if(pool->stopping){
+            break;
+        }
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        runSegments(pool, index);
+
+        pthread_mutex_lock(&pool->lock);
+        if(--pool->running == 0){
+            pthread_cond_signal(&pool->doneCondition);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+/* Start a pool of threads threads, the caller's included. Returns NULL when out of memory, and otpPoolTransform then
+ * runs on the calling thread alone */
+struct otpPool* otpPoolCreate(int threads, size_t threshold){
+    struct otpPool* pool = calloc(1, sizeof(*pool));
+    int i;
+
+    if(pool == NULL){
+        return NULL;
+    }
+    if(threads < 1){
+        threads = 1;
+    }
+
+    pool->threads = threads;
+    pool->threshold = threshold;
+    pool->shares = calloc(threads, sizeof(struct otpShare));
+    pool->helpers = calloc(threads, sizeof(pthread_t));
+    if(pool->shares == NULL || pool->helpers == NULL){                          /* The caller transforms on its own thread instead */
+        free(pool->shares);
+        free(pool->helpers);
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->startCondition, NULL);
+    pthread_cond_init(&pool->doneCondition, NULL);
+
+    for(i = 1; i < threads; i++){                                               /* Thread 0 is whoever calls otpPoolTransform */
+        struct otpHelper* helper = malloc(sizeof(*helper));
+        if(helper == NULL){                                                     /* Run with the helpers that did start */
+            pool->threads = i;
+            break;
+        }
+        helper->pool = pool;
+        helper->index = i;
+        if(pthread_create(&pool->helpers[i], NULL, helperMain, helper) != 0){
+            free(helper);
+            pool->threads = i;
+            break;
+        }
+    }
+
+    return pool;
+}
+
+static size_t segmentSize(size_t length, int threads){                         /* Cut length into about OTP_POOL_SEGMENTS_PER_THREAD segments per thread */
+    size_t size = length / ((size_t)threads * OTP_POOL_SEGMENTS_PER_THREAD);
+
+    size = (size + 63) & ~(size_t)63;                                           /* Whole cache lines, so no two threads write the same line of out */
+    if(size < OTP_POOL_MIN_SEGMENT_SIZE){
+        return OTP_POOL_MIN_SEGMENT_SIZE;
+    }
+    return size > OTP_POOL_SEGMENT_SIZE ? OTP_POOL_SEGMENT_SIZE : size;
+}
+
+void otpPoolTransform(struct otpPool* pool, int mode, const char* text, const char* key, char* out, size_t length){
+    size_t segments, perThread, extra, first, size;
+    int i;
+
+    if(pool == NULL || pool->threads == 1 || length < pool->threshold){         /* Not worth waking the helpers */
+        otpTransform(mode, text, key, out, length);
+        return;
+    }
+
+    size = segmentSize(length, pool->threads);
+    segments = (length + size - 1) / size;
+    perThread = segments / pool->threads;
+    extra = segments % pool->threads;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->mode = mode;
+    pool->text = text;
+    pool->key = key;
+    pool->out = out;
+    pool->length = length;
+    pool->segmentSize = size;
+
+    first = 0;
+    for(i = 0; i < pool->threads; i++){                                         /* Hand every thread an equal run of consecutive segments */
+        size_t count = perThread + ((size_t)i < extra ? 1 : 0);
+        atomic_store(&pool->shares[i].next, first);
+        pool->shares[i].end = first + count;
+        first += count;
+    }
+
+    pool->running = pool->threads - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->startCondition);
+    pthread_mutex_unlock(&pool->lock);
+
+    runSegments(pool, 0);                                                       /* The caller works too instead of just waiting */
+
+    pthread_mutex_lock(&pool->lock);
+    while(pool->running > 0){
+        pthread_cond_wait(&pool->doneCondition, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void otpPoolDestroy(struct otpPool* pool){
+    int i;
+
+    if(pool == NULL){
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->startCondition);
+    pthread_mutex_unlock(&pool->lock);
+
+    for(i = 1; i < pool->threads; i++){
+        pthread_join(pool->helpers[i], NULL);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->startCondition);
+    pthread_cond_destroy(&pool->doneCondition);
+    free(pool->shares);
+    free(pool->helpers);
+    free(pool);
+}
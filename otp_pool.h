@@ -0,0 +1,29 @@
+/****************************************************************
+* Author: Nicholas Schaffner
+* Last Modified: 10/17/26
+* Description: Thread pool that runs the mod 27 transform of one large text/key pair on several cores. The text is cut
+*               into about OTP_POOL_SEGMENTS_PER_THREAD segments per thread, of OTP_POOL_MIN_SEGMENT_SIZE to
+*               OTP_POOL_SEGMENT_SIZE characters, every thread starts on its own share of segments and a thread that
+*               finishes early steals segments from the shares of the others. A DATA frame carries at most
+*               OTP_CHUNK_SIZE characters, so one frame is never cut into more than OTP_CHUNK_SIZE /
+*               OTP_POOL_MIN_SEGMENT_SIZE segments and threads beyond that number have nothing to do. Transforms
+*               shorter than the pool's threshold stay on the calling thread.
+****************************************************************/
+
+#ifndef OTP_POOL_H
+#define OTP_POOL_H
+
+#include <stddef.h>
+
+#define OTP_POOL_SEGMENT_SIZE 16384                                             /* Largest segment: text, key and output of a segment together stay within L2 */
+#define OTP_POOL_MIN_SEGMENT_SIZE 1024                                          /* Smaller segments cost more in cursor traffic than they save */
+#define OTP_POOL_SEGMENTS_PER_THREAD 4                                          /* Enough segments per share for stealing to even out a slow thread */
+#define OTP_POOL_DEFAULT_THRESHOLD 65536                                        /* Transforms shorter than this are not worth waking the pool for */
+
+struct otpPool;
+
+struct otpPool* otpPoolCreate(int threads, size_t threshold);
+void otpPoolTransform(struct otpPool* pool, int mode, const char* text, const char* key, char* out, size_t length);
+void otpPoolDestroy(struct otpPool* pool);
+
+#endif
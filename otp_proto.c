@@ -0,0 +1,299 @@
+/****************************************************************
+* Author: Nicholas Schaffner
+* Last Modified: 10/17/26
+* Description: Socket helpers for the length-prefixed wire protocol described in otp_proto.h. Frames are received
+*               through an otpRecvBuffer, which reads whatever the socket has ready in large blocks and hands the frames
+*               out in place, so receiving a message costs time linear in its size and a few syscalls per chunk.
+****************************************************************/
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "otp_codec.h"
+#include "otp_proto.h"
+
+const char* otpHandshake(int mode){                                             /* String the daemon sends so the client can verify it connected to the correct daemon */
+    if(mode == OTP_MODE_ANY){
+        return "ENCDEC";
+    }
+    return mode == OTP_MODE_ENCODE ? "ENCODE" : "DECODE";
+}
+
+int sendAll(int socketFD, const char* data, size_t length){                     /* Keep writing until every byte has been handed to the socket */
+    ssize_t charsWritten;
+
+    while(length > 0){
+        charsWritten = send(socketFD, data, length, MSG_NOSIGNAL);
+        if(charsWritten < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return OTP_ERR_IO;
+        }
+        data += charsWritten;
+        length -= charsWritten;
+    }
+
+    return OTP_OK;
+}
+
+int recvAll(int socketFD, char* data, size_t length){                           /* Keep reading until exactly length bytes have arrived */
+    ssize_t charsRead;
+
+    while(length > 0){
+        charsRead = recv(socketFD, data, length, MSG_WAITALL);
+        if(charsRead < 0 && errno == EINTR){
+            continue;
+        }
+        if(charsRead <= 0){                                                     /* Error, or the peer closed the socket in the middle of a frame */
+            return OTP_ERR_IO;
+        }
+        data += charsRead;
+        length -= charsRead;
+    }
+
+    return OTP_OK;
+}
+
+void encodeUint64(char* out, uint64_t value){                                  /* Write value as 8 big-endian bytes */
+    int i;
+
+    for(i = 7; i >= 0; i--){
+        out[i] = value & 0xff;
+        value >>= 8;
+    }
+}
+
+uint64_t decodeUint64(const char* in){
+    uint64_t value = 0;
+    int i;
+
+    for(i = 0; i < 8; i++){
+        value = (value << 8) | (unsigned char)in[i];
+    }
+    return value;
+}
+
+void encodeFrameHeader(char* out, int type, uint16_t requestId, uint32_t length){    /* Write the 8 byte header of a frame into out */
+    uint32_t networkLength = htonl(length);
+
+    out[0] = OTP_PROTO_VERSION;
+    out[1] = type;
+    out[2] = requestId >> 8;
+    out[3] = requestId & 0xff;
+    memcpy(out + 4, &networkLength, sizeof(networkLength));
+}
+
+int sendFrame(int socketFD, int type, uint16_t requestId, const char* first, uint32_t firstLength, const char* second, uint32_t secondLength){
+    char header[OTP_FRAME_HEADER_SIZE];
+    struct iovec parts[3];
+    struct msghdr message;
+    ssize_t charsWritten;
+    int partCount = 0;
+
+    encodeFrameHeader(header, type, requestId, firstLength + secondLength);
+
+    /* Gather the header and both payload parts into one sendmsg call so a frame costs a single syscall */
+    parts[partCount].iov_base = header;
+    parts[partCount++].iov_len = sizeof(header);
+    if(firstLength > 0){
+        parts[partCount].iov_base = (void*)first;
+        parts[partCount++].iov_len = firstLength;
+    }
+    if(secondLength > 0){
+        parts[partCount].iov_base = (void*)second;
+        parts[partCount++].iov_len = secondLength;
+    }
+
+    memset(&message, '\0', sizeof(message));
+    message.msg_iov = parts;
+    message.msg_iovlen = partCount;
+
+    while(message.msg_iovlen > 0){
+        charsWritten = sendmsg(socketFD, &message, MSG_NOSIGNAL);
+        if(charsWritten < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return OTP_ERR_IO;
+        }
+        while(message.msg_iovlen > 0 && (size_t)charsWritten >= message.msg_iov[0].iov_len){   /* Skip the parts that were written completely */
+            charsWritten -= message.msg_iov[0].iov_len;
+            message.msg_iov++;
+            message.msg_iovlen--;
+        }
+        if(message.msg_iovlen > 0){                                             /* Advance into the part that was written partially */
+            message.msg_iov[0].iov_base = (char*)message.msg_iov[0].iov_base + charsWritten;
+            message.msg_iov[0].iov_len -= charsWritten;
+        }
+    }
+
+    return OTP_OK;
+}
+
+static int sendFileAll(int socketFD, int fileFD, off_t offset, size_t length){  /* Have the kernel copy length bytes of fileFD at offset straight to the socket */
+    ssize_t charsWritten;
+
+    while(length > 0){
+        charsWritten = sendfile(socketFD, fileFD, &offset, length);             /* Advances offset by itself */
+        if(charsWritten < 0 && errno == EINTR){
+            continue;
+        }
+        if(charsWritten <= 0){                                                  /* Error, or the file is shorter than it was */
+            return OTP_ERR_IO;
+        }
+        length -= charsWritten;
+    }
+
+    return OTP_OK;
+}
+
+/* Send a frame whose payload is length bytes of firstFD at firstOffset followed, unless secondFD is -1, by length
+ * bytes of secondFD at secondOffset. The payload goes from the page cache to the socket without passing through
+ * this process. Neither file's position is moved. */
+int sendFileFrame(int socketFD, int type, uint16_t requestId, int firstFD, off_t firstOffset, int secondFD, off_t secondOffset, uint32_t length){
+    char header[OTP_FRAME_HEADER_SIZE];
+    size_t sent = 0;
+    ssize_t charsWritten;
+    int corked = 1;
+
+    encodeFrameHeader(header, type, requestId, secondFD >= 0 ? 2 * length : length);
+    setsockopt(socketFD, IPPROTO_TCP, TCP_CORK, &corked, sizeof(corked));       /* Hold back partial segments until the whole frame is queued. Fails harmlessly on Unix sockets */
+    while(sent < sizeof(header)){
+        charsWritten = send(socketFD, header + sent, sizeof(header) - sent, MSG_NOSIGNAL | MSG_MORE);  /* Let TCP put the header in the same segment as the payload */
+        if(charsWritten < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return OTP_ERR_IO;
+        }
+        sent += charsWritten;
+    }
+
+    if(sendFileAll(socketFD, firstFD, firstOffset, length) != OTP_OK){
+        return OTP_ERR_IO;
+    }
+    if(secondFD >= 0 && sendFileAll(socketFD, secondFD, secondOffset, length) != OTP_OK){
+        return OTP_ERR_IO;
+    }
+    corked = 0;
+    setsockopt(socketFD, IPPROTO_TCP, TCP_CORK, &corked, sizeof(corked));       /* Push out the tail of the frame now */
+
+    return OTP_OK;
+}
+
+int recvBufferInit(struct otpRecvBuffer* buffer, size_t capacity){             /* Returns OTP_OK, or OTP_ERR_IO with an empty buffer when out of memory */
+    buffer->data = malloc(capacity);
+    buffer->capacity = buffer->data != NULL ? capacity : 0;
+    buffer->start = 0;
+    buffer->end = 0;
+    return buffer->data != NULL ? OTP_OK : OTP_ERR_IO;
+}
+
+void recvBufferFree(struct otpRecvBuffer* buffer){
+    free(buffer->data);                                                         /* Free memory allocated to the buffer */
+    buffer->data = NULL;
+    buffer->capacity = 0;
+}
+
+int recvBufferReserve(struct otpRecvBuffer* buffer, size_t needed){           /* Make room for at least needed unconsumed bytes */
+    if(buffer->start == buffer->end){                                           /* Everything has been consumed, start over at the front for free */
+        buffer->start = 0;
+        buffer->end = 0;
+    }
+
+    if(buffer->start + needed > buffer->capacity){                              /* Not enough room after the scan position, move the unconsumed bytes to the front */
+        memmove(buffer->data, buffer->data + buffer->start, buffer->end - buffer->start);
+        buffer->end -= buffer->start;
+        buffer->start = 0;
+    }
+
+    if(needed > buffer->capacity){                                              /* The frame is larger than the buffer, grow it */
+        char* grown = realloc(buffer->data, needed);
+        if(grown == NULL){
+            return OTP_ERR_IO;
+        }
+        buffer->data = grown;
+        buffer->capacity = needed;
+    }
+
+    return OTP_OK;
+}
+
+ssize_t recvBufferRead(int socketFD, struct otpRecvBuffer* buffer){             /* One recv into the free space after the received bytes. Returns what recv returned */
+    if(buffer->end == buffer->capacity){                                        /* Full, let the caller consume frames first */
+        recvBufferReserve(buffer, buffer->end - buffer->start);
+    }
+    if(buffer->end == buffer->capacity){
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    ssize_t charsRead = recv(socketFD, buffer->data + buffer->end, buffer->capacity - buffer->end, 0);
+    if(charsRead > 0){
+        buffer->end += charsRead;
+    }
+    return charsRead;
+}
+
+int recvBufferNextFrame(struct otpRecvBuffer* buffer, uint32_t maxLength, struct otpFrameHeader* header, char** payload){
+    unsigned char* raw;
+    uint32_t networkLength;
+    size_t available = buffer->end - buffer->start;
+
+    if(available < OTP_FRAME_HEADER_SIZE){                                      /* The header has not fully arrived yet */
+        recvBufferReserve(buffer, OTP_FRAME_HEADER_SIZE);
+        return OTP_AGAIN;
+    }
+
+    raw = (unsigned char*)buffer->data + buffer->start;
+    if(raw[0] != OTP_PROTO_VERSION){                                            /* Refuse frames from a newer or older protocol version */
+        return OTP_ERR_PROTO;
+    }
+
+    memcpy(&networkLength, raw + 4, sizeof(networkLength));
+    header->type = raw[1];
+    header->requestId = (raw[2] << 8) | raw[3];
+    header->length = ntohl(networkLength);
+
+    if(header->length > maxLength){                                             /* Never grow the buffer for a frame the caller would reject anyway */
+        return OTP_ERR_PROTO;
+    }
+
+    if(available < OTP_FRAME_HEADER_SIZE + header->length){                     /* The payload has not fully arrived yet, make sure it will fit */
+        if(recvBufferReserve(buffer, OTP_FRAME_HEADER_SIZE + header->length) != OTP_OK){
+            return OTP_ERR_IO;
+        }
+        return OTP_AGAIN;
+    }
+
+    *payload = buffer->data + buffer->start + OTP_FRAME_HEADER_SIZE;            /* The payload stays valid until the next call */
+    buffer->start += OTP_FRAME_HEADER_SIZE + header->length;
+
+    return OTP_OK;
+}
+
+int recvFrame(int socketFD, struct otpRecvBuffer* buffer, uint32_t maxLength, struct otpFrameHeader* header, char** payload){
+    ssize_t charsRead;
+    int status;
+
+    while((status = recvBufferNextFrame(buffer, maxLength, header, payload)) == OTP_AGAIN){
+        charsRead = recvBufferRead(socketFD, buffer);                           /* Read as much as the socket has ready, not just what this frame needs */
+        if(charsRead < 0 && errno == EINTR){
+            continue;
+        }
+        if(charsRead <= 0){                                                     /* Error, or the peer closed the socket in the middle of a frame */
+            return OTP_ERR_IO;
+        }
+    }
+
+    return status;
+}
@@ -0,0 +1,112 @@
+/****************************************************************
+* Author: Nicholas Schaffner
+* Last Modified: 10/17/26
+* Description: Length-prefixed wire protocol spoken between otp_enc/otp_dec and otp_enc_d/otp_dec_d. After the daemon
+*               sends its 6 character handshake ("ENCODE" or "DECODE"), every message is a frame made of an 8 byte
+*               header followed by a payload:
+*                   byte 0      protocol version (OTP_PROTO_VERSION)
+*                   byte 1      frame type (OTP_FRAME_*)
+*                   bytes 2-3   request ID, big-endian
+*                   bytes 4-7   payload length, big-endian
+*               The client streams the message as DATA frames whose payload is n text characters followed by the n
+*               coinciding key characters (n <= OTP_CHUNK_SIZE). The daemon answers every DATA frame with a RESULT
+*               frame carrying the n transformed characters, so no frame ever needs more than a chunk of memory. The
+*               client ends the message with an END frame, which the daemon echoes once the last RESULT has been sent.
+*               The daemon reports a rejected request with an ERROR frame whose payload is the error text.
+*               A connection stays open after END and can carry any number of messages. Every frame names the request
+*               (message) it belongs to, every reply carries the ID of the frame it answers, and replies come back in
+*               the order the frames were sent, so a client can send the next message without waiting for the replies
+*               to the previous one. After an ERROR the daemon drops the rest of that request up to and including its
+*               END and carries on with the next one; only a frame it cannot parse closes the connection.
+*               A client can use one of the daemon's key pads (see otp_keystore.h) instead of sending a key: it starts
+*               the message with a KEY frame holding the pad offset (big-endian, OTP_PAD_NEXT for the next unused range),
+*               the message length (big-endian) and the pad name. The daemon answers with a KEY frame holding the offset
+*               it reserved, and the DATA frames that follow carry only the n text characters.
+*               A STATS frame with an empty payload, sent at any point between messages, asks for the daemon's live
+*               metrics (see otp_stats.h). The daemon answers with a STATS frame holding them in the Prometheus text
+*               format, at most OTP_STATS_MAX_SIZE bytes.
+*               A daemon that is serving as many connections as it allows greets with "BUSY  " instead and closes the
+*               connection, so the client can report it or try again later.
+*               otp_d, which serves both operations, greets with "ENCDEC" instead. The client then names the operation
+*               of the requests that follow with a MODE frame holding one byte, OTP_MODE_ENCODE or OTP_MODE_DECODE. The
+*               MODE frame gets no reply and can be sent again between requests to switch.
+*               A FORMAT frame holding one byte, sent between messages, asks for another wire format for the DATA and
+*               RESULT frames that follow. The daemon answers with a FORMAT frame holding the same byte; a daemon that
+*               predates the frame rejects it with an ERROR, and the client then ends the request it named and keeps
+*               to OTP_FORMAT_TEXT. With OTP_FORMAT_PACKED every symbol is sent as 4.75 bits instead of a byte: a DATA
+*               frame holds the number n of text characters (big-endian, OTP_PACKED_COUNT_SIZE bytes) followed by the
+*               n text symbols and, unless the key comes from a pad, the n key symbols, each packed 5 to 3 bytes (see
+*               otp_codec.h). The RESULT frame holds n and the n packed result symbols. OTP_FORMAT_BINARY keeps the DATA
+*               and RESULT frames of the text format but allows every byte value: the daemon XORs each text byte with
+*               its key byte in either mode. Key pads hold text keys, so a KEY frame is rejected in that format.
+****************************************************************/
+
+#ifndef OTP_PROTO_H
+#define OTP_PROTO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define OTP_PROTO_VERSION 1
+#define OTP_HANDSHAKE_SIZE 6                                                    /* Length of the "ENCODE"/"DECODE" greeting */
+#define OTP_HANDSHAKE_BUSY "BUSY  "                                             /* Greeting of a connection the daemon has no room for */
+#define OTP_FRAME_HEADER_SIZE 8
+#define OTP_CHUNK_SIZE 65536                                                    /* Maximum number of text characters carried by one DATA frame */
+#define OTP_MAX_ERROR_SIZE 64                                                   /* Maximum length of the text carried by an ERROR frame */
+#define OTP_STATS_MAX_SIZE 16384                                                /* Maximum length of the metrics carried by a STATS reply */
+
+#define OTP_FRAME_DATA 'D'
+#define OTP_FRAME_RESULT 'R'
+#define OTP_FRAME_END 'E'
+#define OTP_FRAME_ERROR 'X'
+#define OTP_FRAME_KEY 'K'
+#define OTP_FRAME_STATS 'S'
+#define OTP_FRAME_MODE 'M'
+#define OTP_FRAME_FORMAT 'F'
+
+#define OTP_FORMAT_TEXT 0                                                       /* One character per byte, the format every connection starts in */
+#define OTP_FORMAT_PACKED 1                                                     /* 5 symbols in 3 bytes */
+#define OTP_FORMAT_BINARY 2                                                     /* Any byte, XORed with the key instead of added modulo 27 */
+#define OTP_PACKED_COUNT_SIZE 8                                                 /* Character count in front of a packed DATA or RESULT payload */
+
+#define OTP_MODE_ANY 2                                                          /* otp_d: the client picks OTP_MODE_ENCODE or OTP_MODE_DECODE with a MODE frame */
+
+#define OTP_KEY_REQUEST_SIZE 16                                                 /* Offset and length in front of the pad name in a KEY request */
+
+#define OTP_OK 0
+#define OTP_ERR_IO -1                                                           /* The socket failed or the peer closed it */
+#define OTP_ERR_PROTO -2                                                        /* The peer sent a frame this program does not understand */
+#define OTP_AGAIN -3                                                            /* A complete frame has not arrived yet */
+
+#define OTP_RECV_BUFFER_SIZE (4 * OTP_CHUNK_SIZE)                               /* Initial capacity of a receive buffer, room for at least one full DATA frame */
+
+struct otpFrameHeader{
+    int type;                                                                   /* One of the OTP_FRAME_* values */
+    uint16_t requestId;                                                         /* Message the frame belongs to, chosen by the client */
+    uint32_t length;                                                            /* Number of payload bytes following the header */
+};
+
+struct otpRecvBuffer{                                                           /* Bytes read from a socket in large blocks and handed out one frame at a time */
+    char* data;
+    size_t capacity;                                                            /* Allocated size of data, grows when a frame does not fit */
+    size_t start;                                                               /* Scan position: first byte that has not been consumed yet */
+    size_t end;                                                                 /* One past the last byte received */
+};
+
+const char* otpHandshake(int mode);
+int sendAll(int socketFD, const char* data, size_t length);
+int recvAll(int socketFD, char* data, size_t length);
+void encodeUint64(char* out, uint64_t value);
+uint64_t decodeUint64(const char* in);
+void encodeFrameHeader(char* out, int type, uint16_t requestId, uint32_t length);
+int sendFrame(int socketFD, int type, uint16_t requestId, const char* first, uint32_t firstLength, const char* second, uint32_t secondLength);
+int sendFileFrame(int socketFD, int type, uint16_t requestId, int firstFD, off_t firstOffset, int secondFD, off_t secondOffset, uint32_t length);
+int recvBufferInit(struct otpRecvBuffer* buffer, size_t capacity);
+void recvBufferFree(struct otpRecvBuffer* buffer);
+int recvBufferReserve(struct otpRecvBuffer* buffer, size_t needed);
+ssize_t recvBufferRead(int socketFD, struct otpRecvBuffer* buffer);
+int recvBufferNextFrame(struct otpRecvBuffer* buffer, uint32_t maxLength, struct otpFrameHeader* header, char** payload);
+int recvFrame(int socketFD, struct otpRecvBuffer* buffer, uint32_t maxLength, struct otpFrameHeader* header, char** payload);
+
+#endif
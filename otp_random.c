@@ -0,0 +1,160 @@
+/****************************************************************
+* Author: Nicholas Schaffner
+* Last Modified: 10/17/26
+* Description: ChaCha20 keystream (D. J. Bernstein's original layout with a 64-bit block counter and a 64-bit stream
+*               number) and the unbiased mapping of keystream bytes onto the 27 allowed characters. See otp_random.h.
+****************************************************************/
+
+#include <errno.h>
+#include <string.h>
+#include <sys/random.h>
+
+#include "otp_random.h"
+
+#define ROTATE(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
+#define QUARTER_ROUND(a, b, c, d) \
+    for(lane = 0; lane < OTP_RANDOM_LANES; lane++){ \
+        x[a][lane] += x[b][lane]; x[d][lane] ^= x[a][lane]; x[d][lane] = ROTATE(x[d][lane], 16); \
+        x[c][lane] += x[d][lane]; x[b][lane] ^= x[c][lane]; x[b][lane] = ROTATE(x[b][lane], 12); \
+        x[a][lane] += x[b][lane]; x[d][lane] ^= x[a][lane]; x[d][lane] = ROTATE(x[d][lane], 8);  \
+        x[c][lane] += x[d][lane]; x[b][lane] ^= x[c][lane]; x[b][lane] = ROTATE(x[b][lane], 7);  \
+    }
+
+static const char alphabetByByte[256] = {                                     /* Byte b maps to alphabet[b % 27] when b < 243, 0 marks a byte to throw away */
+    'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M', 'N', 'O', 'P',
+    'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y', 'Z', ' ', 'A', 'B', 'C', 'D', 'E',
+    'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M', 'N', 'O', 'P', 'Q', 'R', 'S', 'T', 'U',
+    'V', 'W', 'X', 'Y', 'Z', ' ', 'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J',
+    'K', 'L', 'M', 'N', 'O', 'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y', 'Z',
+    ' ', 'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M', 'N', 'O',
+    'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y', 'Z', ' ', 'A', 'B', 'C', 'D',
+    'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M', 'N', 'O', 'P', 'Q', 'R', 'S', 'T',
+    'U', 'V', 'W', 'X', 'Y', 'Z', ' ', 'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I',
+    'J', 'K', 'L', 'M', 'N', 'O', 'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y',
+    'Z', ' ', 'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M', 'N',
+    'O', 'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y', 'Z', ' ', 'A', 'B', 'C',
+    'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M', 'N', 'O', 'P', 'Q', 'R', 'S',
+    'T', 'U', 'V', 'W', 'X', 'Y', 'Z', ' ', 'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H',
+    'I', 'J', 'K', 'L', 'M', 'N', 'O', 'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X',
+    'Y', 'Z', ' ', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+static uint32_t loadLittleEndian(const unsigned char* bytes){
+    return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+/* Run the 20 rounds on OTP_RANDOM_LANES consecutive counter values at once and advance the counter past them. Every
+ * operation loops over the lanes, which the compiler turns into vector instructions (target_clones builds an AVX-512,
+ * an AVX2 and a plain version and the loader picks one). The output is the same as running the blocks one by one. */
+__attribute__((target_clones("avx512f", "avx2", "default")))
+static void nextBlocks(struct otpRandom* random){
+    uint32_t x[16][OTP_RANDOM_LANES];
+    uint32_t input[16][OTP_RANDOM_LANES];
+    uint64_t counter = (uint64_t)random->state[12] | ((uint64_t)random->state[13] << 32);
+    int i, lane;
+
+    for(i = 0; i < 16; i++){
+        for(lane = 0; lane < OTP_RANDOM_LANES; lane++){
+            input[i][lane] = random->state[i];
+        }
+    }
+    for(lane = 0; lane < OTP_RANDOM_LANES; lane++){                             /* Lane l is block counter + l */
+        input[12][lane] = (uint32_t)(counter + lane);
+        input[13][lane] = (uint32_t)((counter + lane) >> 32);
+    }
+
+    memcpy(x, input, sizeof(x));
+    for(i = 0; i < 10; i++){                                                    /* Every iteration is a column round followed by a diagonal round */
+        QUARTER_ROUND(0, 4, 8, 12);
+        QUARTER_ROUND(1, 5, 9, 13);
+        QUARTER_ROUND(2, 6, 10, 14);
+        QUARTER_ROUND(3, 7, 11, 15);
+        QUARTER_ROUND(0, 5, 10, 15);
+        QUARTER_ROUND(1, 6, 11, 12);
+        QUARTER_ROUND(2, 7, 8, 13);
+        QUARTER_ROUND(3, 4, 9, 14);
+    }
+
+    for(lane = 0; lane < OTP_RANDOM_LANES; lane++){
+        for(i = 0; i < 16; i++){
+            uint32_t word = x[i][lane] + input[i][lane];
+            unsigned char* out = random->block + 64 * lane + 4 * i;
+            out[0] = word;
+            out[1] = word >> 8;
+            out[2] = word >> 16;
+            out[3] = word >> 24;
+        }
+    }
+
+    counter += OTP_RANDOM_LANES;                                                /* 64-bit block counter */
+    random->state[12] = (uint32_t)counter;
+    random->state[13] = (uint32_t)(counter >> 32);
+    random->used = 0;
+}
+
+int otpRandomKey(unsigned char key[OTP_RANDOM_KEY_SIZE]){                       /* Fill key from the kernel's CSPRNG. Returns 0 on success, -1 on failure */
+    size_t filled = 0;
+    ssize_t count;
+
+    while(filled < OTP_RANDOM_KEY_SIZE){
+        count = getrandom(key + filled, OTP_RANDOM_KEY_SIZE - filled, 0);
+        if(count < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return -1;
+        }
+        filled += count;
+    }
+
+    return 0;
+}
+
+void otpRandomInit(struct otpRandom* random, const unsigned char key[OTP_RANDOM_KEY_SIZE], uint64_t stream){
+    int i;
+
+    random->state[0] = 0x61707865;                                              /* "expand 32-byte k" */
+    random->state[1] = 0x3320646e;
+    random->state[2] = 0x79622d32;
+    random->state[3] = 0x6b206574;
+    for(i = 0; i < 8; i++){
+        random->state[4 + i] = loadLittleEndian(key + 4 * i);
+    }
+    random->state[12] = 0;
+    random->state[13] = 0;
+    random->state[14] = (uint32_t)stream;
+    random->state[15] = (uint32_t)(stream >> 32);
+    random->used = sizeof(random->block);                                       /* Nothing generated yet */
+}
+
+void otpRandomBytes(struct otpRandom* random, unsigned char* out, size_t length){
+    size_t available;
+
+    while(length > 0){
+        if(random->used == sizeof(random->block)){
+            nextBlocks(random);
+        }
+        available = sizeof(random->block) - random->used;
+        if(available > length){
+            available = length;
+        }
+        memcpy(out, random->block + random->used, available);
+        random->used += available;
+        out += available;
+        length -= available;
+    }
+}
+
+void otpRandomAlphabet(struct otpRandom* random, char* out, size_t length){
+    size_t filled = 0;
+    char next;
+
+    while(filled < length){
+        if(random->used == sizeof(random->block)){
+            nextBlocks(random);
+        }
+        next = alphabetByByte[random->block[random->used++]];
+        out[filled] = next;                                                     /* Written either way, only kept when the byte was accepted */
+        filled += (next != 0);
+    }
+}
@@ -0,0 +1,31 @@
+/****************************************************************
+* Author: Nicholas Schaffner
+* Last Modified: 10/17/26
+* Description: ChaCha20 based random streams for keygen. A 32 byte key is read from the kernel with getrandom() once,
+*               and every stream number gives an independent ChaCha20 keystream under that key, so blocks of a key
+*               file can be generated on any thread in any order. Key characters are drawn from the keystream by
+*               rejection sampling: bytes 0-242 map to the 27 allowed characters (243 = 9 * 27) and bytes 243-255 are
+*               thrown away, so every character is equally likely.
+****************************************************************/
+
+#ifndef OTP_RANDOM_H
+#define OTP_RANDOM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define OTP_RANDOM_KEY_SIZE 32
+#define OTP_RANDOM_LANES 8                                                      /* ChaCha20 blocks computed side by side */
+
+struct otpRandom{
+    uint32_t state[16];                                                         /* ChaCha20 input block: constants, key, 64-bit counter, 64-bit stream number */
+    unsigned char block[64 * OTP_RANDOM_LANES];                                 /* Keystream of the current run of blocks */
+    size_t used;                                                                /* Bytes of block already handed out */
+};
+
+int otpRandomKey(unsigned char key[OTP_RANDOM_KEY_SIZE]);
+void otpRandomInit(struct otpRandom* random, const unsigned char key[OTP_RANDOM_KEY_SIZE], uint64_t stream);
+void otpRandomBytes(struct otpRandom* random, unsigned char* out, size_t length);
+void otpRandomAlphabet(struct otpRandom* random, char* out, size_t length);
+
+#endif
@@ -0,0 +1,844 @@
+/****************************************************************
+* Author: Nicholas Schaffner
+* Last Modified: 10/17/26
+* Description: Listening sockets, accept loop and per-connection request handling shared by otp_enc_d, otp_dec_d and
+*               otp_d.
+*               Each accepted connection is handed to a forked child, which greets the client with the handshake for
+*               its mode and then transforms each message one DATA frame at a time (see otp_proto.h), so the memory
+*               used by a child does not depend on the size of the message. The frames are received into a buffer
+*               of the arena (otp_arena.h) and a DATA frame is transformed in place, so serving makes no allocations.
+*               Connections stay open for as many messages as the client sends. With --workers N, N workers are forked once
+*               at startup instead and each one accepts and serves connections from the shared listening socket for its
+*               whole lifetime. The parent only supervises them and forks a replacement for any worker that exits.
+*               With --engine epoll, connections are served by the event loop in otp_epoll.c instead, either in this
+*               process or, combined with --workers, in every worker; --engine uring does the same with the io_uring
+*               loop in otp_uring.c. With --threads N, DATA frames of at least
+*               --parallel-threshold characters are transformed by a pool of N threads (see otp_pool.h). Every
+*               --pad NAME=FILE loads a key pad that clients can take their key from instead of sending it (see
+*               otp_keystore.h). With --unix PATH the daemon listens on a Unix domain socket at PATH instead of a TCP
+*               port, which skips the TCP stack for clients on the same host. Every process counts what it serves in
+*               the shared metrics of otp_stats.h, which a STATS request returns and SIGUSR1 prints to stderr.
+*               With --max-connections N, a connection that arrives while N are being served is greeted with
+*               OTP_HANDSHAKE_BUSY and closed at once instead of being served late; until it is accepted it waits in
+*               the listen queue, whose length --backlog sets. Forked children are reaped by a SIGCHLD handler as soon
+*               as they exit. A failed accept or fork turns one client away and never stops the daemon: when it is out
+*               of file descriptors it takes the pending connection with a descriptor kept in reserve and sheds it.
+*               otp_d runs in OTP_MODE_ANY: its clients pick the operation with a MODE frame, so encoding and decoding
+*               share one set of processes, buffers and metrics. --encode-port and --decode-port add listening sockets
+*               that greet with the old "ENCODE"/"DECODE" handshake and serve one fixed operation, for old clients.
+*               A client that asks for OTP_FORMAT_PACKED sends its symbols 5 to 3 bytes, and the daemon transforms them
+*               without unpacking, packing the pad range too when the key comes from a pad. One that asks for
+*               OTP_FORMAT_BINARY sends arbitrary bytes, which are XORed with the key without any alphabet check.
+****************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "otp_arena.h"
+#include "otp_codec.h"
+#include "otp_keystore.h"
+#include "otp_pool.h"
+#include "otp_proto.h"
+#include "otp_server.h"
+#include "otp_stats.h"
+
+static int transformThreads = 1;                                                /* Set by --threads, 1 keeps every transform on the serving thread */
+static size_t transformThreshold = OTP_POOL_DEFAULT_THRESHOLD;                  /* Set by --parallel-threshold */
+static struct otpPool* transformPool = NULL;                                    /* Every process creates its own, threads do not survive a fork */
+static char packedPad[OTP_PACKED_SIZE(OTP_CHUNK_SIZE)];                         /* The pad range of a packed DATA frame, packed to match its text */
+static int maxConnections = 0;                                                  /* Set by --max-connections, 0 admits every connection */
+static int reserveFD = -1;                                                      /* Given up to accept a connection to shed when descriptors run out */
+static volatile sig_atomic_t liveChildren = 0;                                  /* Fork per connection: children not reaped yet */
+
+static void error(const char *msg){                                             /* Error function used for reporting issues */
+    perror(msg);
+    exit(1);
+}
+
+static uint32_t replyError(char* reply, const char* msg, int errorType){        /* Copy the reason a request was rejected into the reply, and count it */
+    uint32_t length = strlen(msg);
+    memcpy(reply, msg, length);
+    otpStatsCount(&otpStatsLocal->errors[errorType], 1);
+    return length;
+}
+
+static int processKeyRequest(int mode, struct otpKeyCursor* cursor, const struct otpFrameHeader* header, const char* payload, char* reply, uint32_t* replyLength){
+    struct otpPad* pad;
+    uint64_t offset, length;
+
+    if(cursor->pad != NULL || header->length <= OTP_KEY_REQUEST_SIZE){          /* One KEY frame per message, and it must name a pad */
+        *replyLength = replyError(reply, "malformed frame", OTP_STATS_ERR_MALFORMED);
+        return OTP_FRAME_ERROR;
+    }
+
+    offset = decodeUint64(payload);
+    length = decodeUint64(payload + 8);
+    pad = otpKeyStoreFind(payload + OTP_KEY_REQUEST_SIZE, header->length - OTP_KEY_REQUEST_SIZE);
+    if(pad == NULL){
+        *replyLength = replyError(reply, "unknown key pad", OTP_STATS_ERR_PAD);
+        return OTP_FRAME_ERROR;
+    }
+
+    switch(otpPadReserve(pad, mode, &offset, length)){
+        case OTP_PAD_OK:
+            break;
+        case OTP_PAD_TOO_SHORT:
+            *replyLength = replyError(reply, "key pad is too short", OTP_STATS_ERR_PAD);
+            return OTP_FRAME_ERROR;
+        case OTP_PAD_USED:
+            *replyLength = replyError(reply, "key range already used", OTP_STATS_ERR_PAD);
+            return OTP_FRAME_ERROR;
+        case OTP_PAD_NO_OFFSET:
+            *replyLength = replyError(reply, "key offset required", OTP_STATS_ERR_PAD);
+            return OTP_FRAME_ERROR;
+        default:
+            *replyLength = replyError(reply, "could not update key ledger", OTP_STATS_ERR_LEDGER);
+            return OTP_FRAME_ERROR;
+    }
+
+    cursor->pad = pad;
+    cursor->position = offset;
+    cursor->end = offset + length;
+    encodeUint64(reply, offset);                                                /* Tell the client where its key starts, it needs that to decode */
+    *replyLength = 8;
+
+    return OTP_FRAME_KEY;
+}
+
+/* A DATA frame in OTP_FORMAT_PACKED. The text is transformed in the packed domain, with the key packed the same way,
+ * on the serving thread: a chunk of packed symbols costs less than handing it to the pool */
+static int processPackedFrame(int mode, struct otpKeyCursor* cursor, const struct otpFrameHeader* header, const char* payload, char* reply, uint32_t* replyLength){
+    uint64_t length;
+    size_t packedSize;
+    const char* key;
+
+    length = header->length >= OTP_PACKED_COUNT_SIZE ? decodeUint64(payload) : OTP_CHUNK_SIZE + 1;
+    packedSize = length <= OTP_CHUNK_SIZE ? OTP_PACKED_SIZE(length) : 0;
+    if(header->type != OTP_FRAME_DATA || length > OTP_CHUNK_SIZE || header->length != OTP_PACKED_COUNT_SIZE + (cursor->pad != NULL ? 1 : 2) * packedSize){
+        *replyLength = replyError(reply, "malformed frame", OTP_STATS_ERR_MALFORMED);
+        return OTP_FRAME_ERROR;
+    }
+
+    if(cursor->pad != NULL){
+        if(length > cursor->end - cursor->position){
+            *replyLength = replyError(reply, "message longer than its key range", OTP_STATS_ERR_KEY_RANGE);
+            return OTP_FRAME_ERROR;
+        }
+        if(!otpValidate(cursor->pad->data + cursor->position, length)){        /* otpPack takes valid characters, check the pad as the text format does */
+            *replyLength = replyError(reply, "input contains bad characters", OTP_STATS_ERR_BAD_INPUT);
+            return OTP_FRAME_ERROR;
+        }
+        otpPack(cursor->pad->data + cursor->position, length, packedPad);
+        key = packedPad;
+        cursor->position += length;
+    }
+    else{
+        key = payload + OTP_PACKED_COUNT_SIZE + packedSize;                     /* The packed key follows the packed text */
+    }
+
+    if(!otpPackedValidate(payload + OTP_PACKED_COUNT_SIZE, length) || (cursor->pad == NULL && !otpPackedValidate(key, length))){
+        *replyLength = replyError(reply, "input contains bad characters", OTP_STATS_ERR_BAD_INPUT);
+        return OTP_FRAME_ERROR;
+    }
+
+    encodeUint64(reply, length);                                                /* Same count, so this is a no-op when reply is payload */
+    otpPackedTransform(mode, payload + OTP_PACKED_COUNT_SIZE, key, reply + OTP_PACKED_COUNT_SIZE, length);
+    *replyLength = OTP_PACKED_COUNT_SIZE + packedSize;
+
+    return OTP_FRAME_RESULT;
+}
+
+static int processRequestFrame(int mode, int format, struct otpKeyCursor* cursor, const struct otpFrameHeader* header, const char* payload, char* reply, uint32_t* replyLength){
+    uint32_t length;
+    const char* key;
+
+    if(header->type == OTP_FRAME_END){                                          /* Every RESULT has been sent, acknowledge the end of the message */
+        cursor->pad = NULL;                                                     /* The next message on this connection starts over */
+        return OTP_FRAME_END;
+    }
+
+    if(header->type == OTP_FRAME_KEY){
+        if(format == OTP_FORMAT_BINARY){                                        /* A pad holds the 27 characters, not random bytes */
+            *replyLength = replyError(reply, "key pads hold text keys", OTP_STATS_ERR_PAD);
+            return OTP_FRAME_ERROR;
+        }
+        return processKeyRequest(mode, cursor, header, payload, reply, replyLength);
+    }
+
+    if(format == OTP_FORMAT_PACKED){
+        return processPackedFrame(mode, cursor, header, payload, reply, replyLength);
+    }
+
+    if(cursor->pad != NULL){                                                    /* The payload is all text, the key comes from the reserved pad range */
+        if(header->type != OTP_FRAME_DATA || header->length > OTP_CHUNK_SIZE){
+            *replyLength = replyError(reply, "malformed frame", OTP_STATS_ERR_MALFORMED);
+            return OTP_FRAME_ERROR;
+        }
+        if(header->length > cursor->end - cursor->position){
+            *replyLength = replyError(reply, "message longer than its key range", OTP_STATS_ERR_KEY_RANGE);
+            return OTP_FRAME_ERROR;
+        }
+        length = header->length;
+        key = cursor->pad->data + cursor->position;
+        cursor->position += length;
+    }
+    else{
+        if(header->type != OTP_FRAME_DATA || header->length % 2 != 0 || header->length > 2 * OTP_CHUNK_SIZE){
+            *replyLength = replyError(reply, "malformed frame", OTP_STATS_ERR_MALFORMED);
+            return OTP_FRAME_ERROR;
+        }
+        length = header->length / 2;                                            /* The first half is text, the second half is the coinciding key */
+        key = payload + length;
+    }
+
+    if(format == OTP_FORMAT_BINARY){                                            /* Every byte is allowed and XOR undoes itself, whatever the operation */
+        mode = OTP_MODE_XOR;
+    }
+    else if(!otpValidate(payload, length) || !otpValidate(key, length)){
+        *replyLength = replyError(reply, "input contains bad characters", OTP_STATS_ERR_BAD_INPUT);
+        return OTP_FRAME_ERROR;
+    }
+
+    if(transformPool == NULL && transformThreads > 1 && length >= transformThreshold){    /* A fork-per-connection child starts it only if it needs it */
+        transformPool = otpPoolCreate(transformThreads, transformThreshold);
+    }
+    otpPoolTransform(transformPool, mode, payload, key, reply, length);         /* Runs on this thread alone when there is no pool */
+    *replyLength = length;
+
+    return OTP_FRAME_RESULT;
+}
+
+/* Start the --threads pool of a worker or event loop before it serves, so its serving never allocates. A child
+ * forked for one connection is left to start it on its first large frame instead, most never need it. Without memory
+ * for it, every transform runs on the serving thread */
+static void startTransformPool(void){
+    if(transformPool == NULL && transformThreads > 1){
+        transformPool = otpPoolCreate(transformThreads, transformThreshold);
+    }
+}
+
+void initSession(struct otpSession* session){                                   /* No operation chosen, no pad and no failed request yet */
+    memset(session, '\0', sizeof(*session));
+    session->operation = OTP_MODE_ANY;
+}
+
+size_t maxReplyLength(const struct otpFrameHeader* header){                     /* Room processFrame needs for the reply to this frame */
+    if(header->type == OTP_FRAME_STATS){
+        return OTP_STATS_MAX_SIZE;
+    }
+    return header->length > OTP_MAX_ERROR_SIZE ? header->length : OTP_MAX_ERROR_SIZE;    /* A pad DATA frame is all text */
+}
+
+/* Turn one frame into the reply that answers it, or OTP_NO_REPLY. A rejected request gets a single ERROR, and its
+ * remaining frames, END included, are dropped so the connection can carry on with the next request. reply must hold
+ * maxReplyLength() bytes; when replyInPlace() it can be payload itself, which is then overwritten. */
+int processFrame(int mode, struct otpSession* session, const struct otpFrameHeader* header, const char* payload, char* reply, uint32_t* replyLength){
+    uint64_t startNs = otpStatsNow();
+    int replyType;
+
+    *replyLength = 0;
+    otpStatsCount(&otpStatsLocal->framesIn, 1);
+    otpStatsCount(&otpStatsLocal->bytesIn, OTP_FRAME_HEADER_SIZE + header->length);
+
+    if(header->type == OTP_FRAME_STATS){                                        /* Answered whatever request is in progress */
+        replyType = OTP_FRAME_STATS;
+        if(header->length != 0){
+            *replyLength = replyError(reply, "malformed frame", OTP_STATS_ERR_MALFORMED);
+            replyType = OTP_FRAME_ERROR;
+        }
+        else{
+            *replyLength = otpStatsFormat(reply, OTP_STATS_MAX_SIZE);
+        }
+        otpStatsCount(&otpStatsLocal->bytesOut, OTP_FRAME_HEADER_SIZE + *replyLength);
+        return replyType;
+    }
+
+    if(header->type == OTP_FRAME_MODE){                                         /* Chooses the operation of the requests that follow */
+        if(mode != OTP_MODE_ANY || header->length != 1 || (payload[0] != OTP_MODE_ENCODE && payload[0] != OTP_MODE_DECODE)){
+            *replyLength = replyError(reply, "malformed frame", OTP_STATS_ERR_MALFORMED);
+            otpStatsCount(&otpStatsLocal->bytesOut, OTP_FRAME_HEADER_SIZE + *replyLength);
+            return OTP_FRAME_ERROR;
+        }
+        session->operation = payload[0];
+        return OTP_NO_REPLY;
+    }
+
+    if(header->type == OTP_FRAME_FORMAT){                                       /* Chooses the wire format of the DATA and RESULT frames that follow */
+        if(header->length != 1 || (payload[0] != OTP_FORMAT_TEXT && payload[0] != OTP_FORMAT_PACKED && payload[0] != OTP_FORMAT_BINARY)){
+            *replyLength = replyError(reply, "unknown format", OTP_STATS_ERR_MALFORMED);
+            replyType = OTP_FRAME_ERROR;
+            session->skipping = 1;                                              /* Like a daemon that predates FORMAT, so the client's END gets no reply either way */
+            session->skippedRequest = header->requestId;
+        }
+        else{
+            session->format = payload[0];
+            reply[0] = payload[0];                                              /* Confirm it, the client falls back to text without this */
+            *replyLength = 1;
+            replyType = OTP_FRAME_FORMAT;
+        }
+        otpStatsCount(&otpStatsLocal->bytesOut, OTP_FRAME_HEADER_SIZE + *replyLength);
+        return replyType;
+    }
+    if(mode == OTP_MODE_ANY){
+        mode = session->operation;
+    }
+
+    if(session->skipping && header->requestId == session->skippedRequest){
+        if(header->type == OTP_FRAME_END){
+            session->skipping = 0;
+        }
+        return OTP_NO_REPLY;
+    }
+
+    if(mode == OTP_MODE_ANY && header->type != OTP_FRAME_END){                  /* otp_d was never told what to do */
+        *replyLength = replyError(reply, "no operation chosen", OTP_STATS_ERR_MALFORMED);
+        replyType = OTP_FRAME_ERROR;
+    }
+    else{
+        replyType = processRequestFrame(mode, session->format, &session->cursor, header, payload, reply, replyLength);
+    }
+    if(replyType == OTP_FRAME_ERROR){
+        session->cursor.pad = NULL;
+        session->skipping = 1;
+        session->skippedRequest = header->requestId;
+    }
+    else if(replyType == OTP_FRAME_END){
+        otpStatsCount(&otpStatsLocal->messages, 1);
+    }
+
+    otpStatsObserve(OTP_PHASE_TRANSFORM, otpStatsNow() - startNs);
+    otpStatsCount(&otpStatsLocal->bytesOut, OTP_FRAME_HEADER_SIZE + *replyLength);
+
+    return replyType;
+}
+
+int replyInPlace(const struct otpFrameHeader* header){                          /* Whether the reply to this frame fits over its payload */
+    return maxReplyLength(header) <= header->length;
+}
+
+void serveConnection(int connectionFD, int mode){
+    struct otpFrameHeader header;
+    struct otpRecvBuffer recvBuffer = {0};                                      /* Frames received from the client, in a buffer of the arena */
+    char* requestBuffer;                                                        /* Points at the payload of the current frame */
+    char* replyBuffer;                                                          /* The transformed characters, over the request, or the error text or metrics */
+    char spareBuffer[OTP_STATS_MAX_SIZE];                                       /* Replies that do not fit over their request: errors, KEY and STATS */
+    uint32_t replyLength;
+    int replyType;
+    struct otpSession session;
+
+    const char* handshake = otpHandshake(mode);                                 /* Verify to the client that it is connected to the correct daemon */
+    if(sendAll(connectionFD, handshake, OTP_HANDSHAKE_SIZE) != OTP_OK){
+        return;
+    }
+
+    initSession(&session);
+    if(otpArenaAttach(&recvBuffer) != OTP_OK){
+        return;
+    }
+    otpStatsCount(&otpStatsLocal->accepted, 1);
+
+    while(1){
+        uint64_t phaseStartNs = otpStatsNow();
+        int status = recvFrame(connectionFD, &recvBuffer, 2 * OTP_CHUNK_SIZE, &header, &requestBuffer);
+        if(status == OTP_ERR_PROTO){
+            replyLength = replyError(spareBuffer, "malformed frame", OTP_STATS_ERR_MALFORMED);
+            sendFrame(connectionFD, OTP_FRAME_ERROR, 0, spareBuffer, replyLength, NULL, 0);     /* The stream cannot be trusted past this point */
+            break;
+        }
+        if(status != OTP_OK){                                                   /* Client went away, or is done with the connection */
+            break;
+        }
+        otpStatsObserve(OTP_PHASE_RECV, otpStatsNow() - phaseStartNs);
+
+        replyBuffer = replyInPlace(&header) ? requestBuffer : spareBuffer;     /* A DATA frame is transformed in place */
+        replyType = processFrame(mode, &session, &header, requestBuffer, replyBuffer, &replyLength);
+        if(replyType == OTP_NO_REPLY){
+            continue;
+        }
+
+        phaseStartNs = otpStatsNow();
+        if(sendFrame(connectionFD, replyType, header.requestId, replyBuffer, replyLength, NULL, 0) != OTP_OK){
+            perror("ERROR writing to socket");
+            otpStatsCount(&otpStatsLocal->errors[OTP_STATS_ERR_IO], 1);
+            break;
+        }
+        otpStatsObserve(OTP_PHASE_SEND, otpStatsNow() - phaseStartNs);
+    }
+
+    otpStatsCount(&otpStatsLocal->closed, 1);
+    otpArenaDetach(&recvBuffer);                                                /* Kept for the next connection of this process */
+}
+
+static void shedConnection(int connectionFD){                                   /* Tell the client the daemon is full and hang up, without blocking */
+    send(connectionFD, OTP_HANDSHAKE_BUSY, OTP_HANDSHAKE_SIZE, MSG_NOSIGNAL | MSG_DONTWAIT);
+    otpStatsCount(&otpStatsLocal->shed, 1);
+    close(connectionFD);
+}
+
+/* Whether a newly accepted connection may be served: below --max-connections across every process of the daemon.
+ * Its place is then reserved, and otpStatsReleaseConnection must be called when it is closed. Otherwise it is shed
+ * and closed, and 0 is returned */
+int admitConnection(int connectionFD){
+    if(!otpStatsReserveConnection(maxConnections)){
+        shedConnection(connectionFD);
+        return 0;
+    }
+    return 1;
+}
+
+/* Called after accept on listener failed. Out of descriptors, the pending connection would stay queued and wake the
+ * loop again at once, so it is accepted with the reserved descriptor and shed. Any other failure only loses that client */
+void acceptFailed(const struct otpListener* listener){
+    struct pollfd pending = {listener->socketFD, POLLIN, 0};
+    int failure = errno;
+    int connectionFD;
+
+    if(failure == EINTR || failure == EAGAIN || failure == EWOULDBLOCK || failure == ECONNABORTED){    /* SIGUSR1, SIGCHLD, or another process won the connection */
+        return;
+    }
+    perror("ERROR on accept");
+    if((failure != EMFILE && failure != ENFILE) || reserveFD < 0){
+        return;
+    }
+
+    close(reserveFD);
+    if(poll(&pending, 1, 0) == 1 && (connectionFD = accept(listener->socketFD, NULL, NULL)) >= 0){    /* poll first, the listener may block */
+        shedConnection(connectionFD);
+    }
+    reserveFD = open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+static void usage(const char* program, int mode){
+    fprintf(stderr,"USAGE: %s [--workers N] [--engine fork|epoll|uring] [--threads N] [--parallel-threshold BYTES] [--backlog N] [--max-connections N] [--pad NAME=FILE]...%s (port | --unix PATH)\n",
+            program, mode == OTP_MODE_ANY ? " [--encode-port PORT] [--decode-port PORT]" : "");
+    exit(1);
+}
+
+static void parseServerOptions(int argc, char* argv[], int mode, struct otpServerOptions* options){
+    static struct option longOptions[] = {
+        {"workers", required_argument, NULL, 'w'},
+        {"engine", required_argument, NULL, 'e'},
+        {"threads", required_argument, NULL, 't'},
+        {"parallel-threshold", required_argument, NULL, 'p'},
+        {"pad", required_argument, NULL, 'k'},
+        {"unix", required_argument, NULL, 'u'},
+        {"encode-port", required_argument, NULL, 'E'},
+        {"decode-port", required_argument, NULL, 'D'},
+        {"backlog", required_argument, NULL, 'b'},
+        {"max-connections", required_argument, NULL, 'm'},
+        {NULL, 0, NULL, 0}
+    };
+    int option;
+
+    memset(options, '\0', sizeof(*options));                                    /* Default to one forked child per connection */
+    options->threads = 1;
+    options->parallelThreshold = OTP_POOL_DEFAULT_THRESHOLD;
+    options->backlog = OTP_LISTEN_BACKLOG;
+
+    while((option = getopt_long(argc, argv, "w:e:t:p:k:u:E:D:b:m:", longOptions, NULL)) != -1){
+        switch(option){
+            case 'w':
+                options->workers = atoi(optarg);
+                if(options->workers < 1){
+                    usage(argv[0], mode);
+                }
+                break;
+            case 't':
+                options->threads = atoi(optarg);
+                if(options->threads < 1){
+                    usage(argv[0], mode);
+                }
+                break;
+            case 'p':
+                options->parallelThreshold = strtoul(optarg, NULL, 10);
+                break;
+            case 'b':
+                options->backlog = atoi(optarg);
+                if(options->backlog < 1){
+                    usage(argv[0], mode);
+                }
+                break;
+            case 'm':
+                options->maxConnections = atoi(optarg);
+                if(options->maxConnections < 1){
+                    usage(argv[0], mode);
+                }
+                break;
+            case 'u':
+                options->unixPath = optarg;
+                break;
+            case 'E':
+            case 'D':
+                if(mode != OTP_MODE_ANY || atoi(optarg) < 1){                   /* Only otp_d serves both operations */
+                    usage(argv[0], mode);
+                }
+                *(option == 'E' ? &options->encodePort : &options->decodePort) = atoi(optarg);
+                break;
+            case 'k':
+                if(otpKeyStoreAdd(optarg) != 0){                                /* Pads are mapped now, before any worker is forked */
+                    exit(1);
+                }
+                break;
+            case 'e':
+                if(strcmp(optarg, "fork") == 0){
+                    options->engine = OTP_ENGINE_FORK;
+                }
+                else if(strcmp(optarg, "epoll") == 0){
+                    options->engine = OTP_ENGINE_EPOLL;
+                }
+                else if(strcmp(optarg, "uring") == 0){
+                    options->engine = OTP_ENGINE_URING;
+                }
+                else{
+                    usage(argv[0], mode);
+                }
+                break;
+            default:
+                usage(argv[0], mode);
+        }
+    }
+
+    if(options->unixPath != NULL){                                              /* Listen on a Unix domain socket instead of a port */
+        if(optind != argc){
+            usage(argv[0], mode);
+        }
+        return;
+    }
+    if (optind >= argc){                                                        /* Check usage & args */
+        usage(argv[0], mode);
+    }
+    options->portNumber = atoi(argv[optind]);                                   /* Get the port number, convert to an integer from a string */
+}
+
+static int bindUnixSocket(const char* path){                                    /* Same as bindTCPSocket, for a Unix domain socket at path */
+    int listenSocketFD;
+    struct sockaddr_un serverAddress;
+
+    memset((char *)&serverAddress, '\0', sizeof(serverAddress));                /* Clear out the address struct */
+    serverAddress.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(serverAddress.sun_path)){
+        fprintf(stderr, "ERROR: socket path too long\n");
+        exit(1);
+    }
+    strcpy(serverAddress.sun_path, path);
+
+    listenSocketFD = socket(AF_UNIX, SOCK_STREAM, 0);                           /* Create the socket */
+    if (listenSocketFD < 0){
+        error("ERROR opening socket");
+    }
+
+    unlink(path);                                                               /* A socket file left behind by an earlier run would make bind fail */
+    if (bind(listenSocketFD, (struct sockaddr *)&serverAddress, sizeof(serverAddress)) < 0){
+        error("ERROR on binding");
+    }
+
+    return listenSocketFD;
+}
+
+static int bindTCPSocket(int portNumber){                                       /* Create a TCP socket bound to portNumber. openListeners starts it listening */
+    int listenSocketFD;
+    int noDelay = 1;
+    struct sockaddr_in serverAddress;
+
+    /* Set up the address struct for this process (the server) */
+    memset((char *)&serverAddress, '\0', sizeof(serverAddress));                /* Clear out the address struct */
+
+    serverAddress.sin_family = AF_INET;                                         /* Create a network-capable socket */
+    serverAddress.sin_port = htons(portNumber);                                 /* Store the port number */
+    serverAddress.sin_addr.s_addr = INADDR_ANY;                                 /* Any address is allowed for connection to this process */
+
+    /* Set up the socket */
+    listenSocketFD = socket(AF_INET, SOCK_STREAM, 0);                           /* Create the socket */
+
+    if (listenSocketFD < 0){
+        error("ERROR opening socket");
+    }
+
+    /* Enable the socket to begin listening */
+    if (bind(listenSocketFD, (struct sockaddr *)&serverAddress, sizeof(serverAddress)) < 0){    /* Connect socket to port */
+        error("ERROR on binding");
+    }
+
+    /* Every reply is a complete frame, so send it at once. Otherwise Nagle holds back the small END that follows a
+     * RESULT until the client's delayed ACK, about 40 ms later. Accepted sockets inherit the option */
+    setsockopt(listenSocketFD, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+    return listenSocketFD;
+}
+
+/* Accept the next connection from any of the listeners and tell which one, for its mode. With several listeners they are
+ * non-blocking, so a process that loses the race for a connection goes back to poll instead of blocking in accept */
+static int acceptConnection(const struct otpListener* listeners, int listenerCount, const struct otpListener** listener){
+    struct pollfd ready[OTP_MAX_LISTENERS];
+    int i;
+
+    *listener = &listeners[0];
+    if(listenerCount == 1){
+        return accept(listeners[0].socketFD, NULL, NULL);
+    }
+
+    for(i = 0; i < listenerCount; i++){
+        ready[i].fd = listeners[i].socketFD;
+        ready[i].events = POLLIN;
+    }
+    if(poll(ready, listenerCount, -1) < 0){
+        return -1;
+    }
+    for(i = 0; i < listenerCount; i++){
+        if(ready[i].revents & POLLIN){
+            *listener = &listeners[i];
+            return accept(listeners[i].socketFD, NULL, NULL);
+        }
+    }
+    errno = EAGAIN;
+    return -1;
+}
+
+static void closeListeners(const struct otpListener* listeners, int listenerCount){
+    int i;
+
+    for(i = 0; i < listenerCount; i++){
+        close(listeners[i].socketFD);
+    }
+}
+
+static void reapChildren(int signalNumber){                                     /* SIGCHLD: reap every child that has exited, right away */
+    int savedErrno = errno;
+
+    pid_t exitedPid;
+
+    (void)signalNumber;
+    while((exitedPid = waitpid(-1, NULL, WNOHANG)) > 0){
+        otpStatsReclaim(exitedPid);                                             /* A child that was killed could not release its connection */
+        liveChildren--;
+    }
+    errno = savedErrno;
+}
+
+static void runForkPerConnection(const struct otpListener* listeners, int listenerCount){    /* Fork a fresh child for every connection that is accepted */
+    const struct otpListener* listener;
+    struct sigaction action;
+    sigset_t childSignal, previousMask;
+    int establishedConnectionFD;
+    int spawnPid = -5;
+
+    /* No SA_RESTART, so an accept blocked while the daemon is full wakes up when a child exits */
+    memset(&action, '\0', sizeof(action));
+    action.sa_handler = reapChildren;
+    action.sa_flags = SA_NOCLDSTOP;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGCHLD, &action, NULL);
+    sigemptyset(&childSignal);
+    sigaddset(&childSignal, SIGCHLD);
+
+    otpStatsAttach();                                                           /* Connections shed here are counted too */
+    otpArenaReserve(1);                                                         /* Every child starts with its receive buffer instead of allocating one */
+    while(1){
+        /* Accept a connection, blocking if one is not available until one connects */
+        establishedConnectionFD = acceptConnection(listeners, listenerCount, &listener);
+
+        if (establishedConnectionFD < 0){
+            acceptFailed(listener);
+            otpStatsDumpIfRequested();                                          /* SIGUSR1 asked for the metrics */
+            continue;
+        }
+        if(maxConnections > 0 && liveChildren >= maxConnections){              /* Every child counts, its connection is open until it exits */
+            shedConnection(establishedConnectionFD);
+            continue;
+        }
+
+        sigprocmask(SIG_BLOCK, &childSignal, &previousMask);                    /* The child cannot be reaped before it is counted */
+        spawnPid = fork();                                                      /* Fork the process */
+        switch(spawnPid){                                                       /* Switch statement to assess spawnPid */
+            case -1: {                                                          /* If something goes wrong, fork() returns -1 */
+                perror("Hull Breach! fork");                                    /* Inform the user that an error occurred, and turn only this client away */
+                shedConnection(establishedConnectionFD);
+                break;                                                          /* Break out of the switch statement */
+            }
+            case 0: {                                                           /* In the child process, fork() returns 0 */
+                signal(SIGCHLD, SIG_DFL);
+                sigprocmask(SIG_SETMASK, &previousMask, NULL);
+                closeListeners(listeners, listenerCount);                       /* The child only talks to its own client */
+                otpStatsAttach();
+                otpStatsReserveConnection(0);                                   /* Admitted above already, only counted here */
+                serveConnection(establishedConnectionFD, listener->mode);
+                close(establishedConnectionFD);                                 /* Close the existing socket which is connected to the client */
+                otpStatsReleaseConnection();
+                otpStatsDetach();
+                exit(0);
+                break;                                                          /* Break out of the switch statement */
+            }
+            default: {                                                          /* In the parent process, fork() returns the PID of the child process that was just created */
+                liveChildren++;
+                close(establishedConnectionFD);                                 /* Close the existing socket which is connected to the client */
+                break;                                                          /* Break out of the switch statement */
+            }
+        }
+        sigprocmask(SIG_SETMASK, &previousMask, NULL);
+    }
+}
+
+static void runWorker(const struct otpListener* listeners, int listenerCount, int engine){    /* Body of a pre-forked worker: serve connections from the shared listening sockets forever */
+    const struct otpListener* listener;
+    int establishedConnectionFD;
+
+    otpStatsAttach();
+    startTransformPool();
+    if(engine == OTP_ENGINE_EPOLL){                                             /* Every worker runs its own event loop */
+        runEpollLoop(listeners, listenerCount);
+    }
+    else if(engine == OTP_ENGINE_URING){                                        /* Every worker runs its own ring */
+        runUringLoop(listeners, listenerCount);
+    }
+
+    while(1){
+        establishedConnectionFD = acceptConnection(listeners, listenerCount, &listener);
+        if(establishedConnectionFD < 0){                                        /* A failed accept only affects that one client, keep serving */
+            acceptFailed(listener);
+            otpStatsDumpIfRequested();
+            continue;
+        }
+        if(!admitConnection(establishedConnectionFD)){                         /* The other workers are serving --max-connections clients already */
+            continue;
+        }
+
+        serveConnection(establishedConnectionFD, listener->mode);
+        close(establishedConnectionFD);                                         /* Close the existing socket which is connected to the client */
+        otpStatsReleaseConnection();
+    }
+}
+
+static pid_t spawnWorker(const struct otpListener* listeners, int listenerCount, int engine){
+    pid_t supervisorPid = getpid();
+    pid_t spawnPid = fork();
+
+    if(spawnPid == 0){                                                          /* In the worker, fork() returns 0 */
+        prctl(PR_SET_PDEATHSIG, SIGTERM);                                       /* Do not outlive the supervisor, or the port stays taken */
+        if(getppid() != supervisorPid){                                         /* The supervisor already died before prctl */
+            exit(0);
+        }
+        runWorker(listeners, listenerCount, engine);
+        exit(0);
+    }
+    if(spawnPid < 0){
+        perror("ERROR forking worker");
+    }
+
+    return spawnPid;
+}
+
+static void runWorkerPool(const struct otpListener* listeners, int listenerCount, int workers, int engine){    /* Pre-fork the workers, then restart any worker that exits */
+    pid_t* workerPids = malloc(sizeof(pid_t) * workers);
+    pid_t exitedPid;
+    int childExitMethod = 0;
+    int i;
+
+    for(i = 0; i < workers; i++){
+        workerPids[i] = spawnWorker(listeners, listenerCount, engine);
+    }
+
+    while(1){
+        exitedPid = waitpid(-1, &childExitMethod, 0);                           /* Block until a worker exits */
+        if(exitedPid < 0){
+            otpStatsDumpIfRequested();                                          /* SIGUSR1 interrupted the wait */
+            if(errno == ECHILD){                                                /* Every fork failed, try again shortly */
+                sleep(1);
+                for(i = 0; i < workers; i++){
+                    if(workerPids[i] <= 0){
+                        workerPids[i] = spawnWorker(listeners, listenerCount, engine);
+                    }
+                }
+            }
+            continue;
+        }
+        otpStatsReclaim(exitedPid);                                             /* Connections of a worker that crashed are no longer open */
+
+        for(i = 0; i < workers; i++){
+            if(workerPids[i] == exitedPid){
+                if(WIFSIGNALED(childExitMethod)){
+                    fprintf(stderr, "worker %d terminated by signal %d, restarting\n", (int)exitedPid, WTERMSIG(childExitMethod));
+                }
+                else{
+                    fprintf(stderr, "worker %d exited with status %d, restarting\n", (int)exitedPid, WEXITSTATUS(childExitMethod));
+                }
+                workerPids[i] = spawnWorker(listeners, listenerCount, engine);
+                break;
+            }
+        }
+    }
+}
+
+static int openListeners(const struct otpServerOptions* options, int mode, struct otpListener* listeners){    /* Returns the number of listeners */
+    int listenerCount = 0;
+    int i;
+
+    listeners[listenerCount].socketFD = options->unixPath != NULL ? bindUnixSocket(options->unixPath) : bindTCPSocket(options->portNumber);
+    listeners[listenerCount++].mode = mode;
+    if(options->encodePort > 0){                                                /* Old clients expect the "ENCODE" handshake */
+        listeners[listenerCount].socketFD = bindTCPSocket(options->encodePort);
+        listeners[listenerCount++].mode = OTP_MODE_ENCODE;
+    }
+    if(options->decodePort > 0){
+        listeners[listenerCount].socketFD = bindTCPSocket(options->decodePort);
+        listeners[listenerCount++].mode = OTP_MODE_DECODE;
+    }
+
+    for(i = 0; i < listenerCount; i++){
+        /* Flip the socket on. Workers and event loops keep their clients for long, so the queue must hold a burst */
+        if(listen(listeners[i].socketFD, options->backlog) < 0){
+            error("ERROR on listen");
+        }
+        if(listenerCount > 1){                                                  /* See acceptConnection */
+            fcntl(listeners[i].socketFD, F_SETFL, fcntl(listeners[i].socketFD, F_GETFL, 0) | O_NONBLOCK);
+        }
+    }
+
+    return listenerCount;
+}
+
+int runServer(int argc, char* argv[], int mode){
+    struct otpServerOptions options;
+    struct otpListener listeners[OTP_MAX_LISTENERS];
+    int listenerCount;
+
+    parseServerOptions(argc, argv, mode, &options);
+    transformThreads = options.threads;
+    transformThreshold = options.parallelThreshold;
+    maxConnections = options.maxConnections;
+    reserveFD = open("/dev/null", O_RDONLY | O_CLOEXEC);                       /* Every process inherits its own reserve */
+    listenerCount = openListeners(&options, mode, listeners);
+    otpStatsInit();                                                             /* Before any fork, so every process shares the counters */
+
+    if(options.workers > 0){                                                    /* Pre-forked workers share the listening sockets */
+        runWorkerPool(listeners, listenerCount, options.workers, options.engine);
+    }
+    else if(options.engine == OTP_ENGINE_EPOLL){                                /* One process serves every connection */
+        startTransformPool();
+        runEpollLoop(listeners, listenerCount);
+    }
+    else if(options.engine == OTP_ENGINE_URING){
+        startTransformPool();
+        runUringLoop(listeners, listenerCount);
+    }
+    else{
+        runForkPerConnection(listeners, listenerCount);
+    }
+
+    closeListeners(listeners, listenerCount);                                   /* Close the listening sockets */
+
+    return 0;
+}
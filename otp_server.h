@@ -0,0 +1,64 @@
+/****************************************************************
+* Author: Nicholas Schaffner
+* Last Modified: 10/17/26
+* Description: Daemon side shared by otp_enc_d, otp_dec_d and otp_d. The daemons only differ in the mode they pass in:
+*               OTP_MODE_ENCODE, OTP_MODE_DECODE, or OTP_MODE_ANY for otp_d, whose clients choose per request.
+****************************************************************/
+
+#ifndef OTP_SERVER_H
+#define OTP_SERVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "otp_keystore.h"
+#include "otp_proto.h"
+
+#define OTP_ENGINE_FORK 0                                                       /* Blocking sockets, one process per connection being served */
+#define OTP_ENGINE_EPOLL 1                                                      /* Non-blocking sockets multiplexed by an epoll event loop */
+#define OTP_ENGINE_URING 2                                                      /* Completion-based io_uring event loop, falls back to epoll */
+
+#define OTP_NO_REPLY 0                                                          /* processFrame dropped the frame, nothing to send */
+
+#define OTP_MAX_LISTENERS 3                                                     /* otp_d's socket, plus its legacy encode and decode ports */
+#define OTP_LISTEN_BACKLOG SOMAXCONN                                            /* Pending connections every listening socket queues unless --backlog says otherwise */
+
+struct otpListener{                                                             /* A listening socket and the mode of the connections it accepts */
+    int socketFD;
+    int mode;                                                                   /* OTP_MODE_ANY greets with "ENCDEC" and lets the client choose */
+};
+
+struct otpSession{                                                              /* Request state of one connection */
+    int operation;                                                              /* Mode chosen by the last MODE frame, OTP_MODE_ANY before the first one */
+    int format;                                                                 /* Wire format chosen by the last FORMAT frame, OTP_FORMAT_TEXT before the first one */
+    struct otpKeyCursor cursor;                                                 /* Key pad range of the current message, if it asked for one */
+    int skipping;                                                               /* Set after an ERROR until the failed request's END arrives */
+    uint16_t skippedRequest;                                                    /* ID of the failed request whose frames are dropped */
+};
+
+struct otpServerOptions{                                                        /* Command line options of otp_enc_d, otp_dec_d and otp_d */
+    int portNumber;
+    const char* unixPath;                                                       /* Listen on this Unix domain socket instead of portNumber */
+    int encodePort;                                                             /* otp_d only: also greet old otp_enc clients on this port, 0 for none */
+    int decodePort;                                                             /* otp_d only: same for old otp_dec clients */
+    int workers;                                                                /* Number of pre-forked workers, 0 forks one child per connection */
+    int engine;                                                                 /* One of the OTP_ENGINE_* values */
+    int threads;                                                                /* Threads used to transform one large DATA frame */
+    size_t parallelThreshold;                                                   /* DATA frames with fewer characters are transformed by one thread */
+    int backlog;                                                                /* Length of the kernel's queue of connections not accepted yet */
+    int maxConnections;                                                         /* Connections served at once before new ones are turned away, 0 for no limit */
+};
+
+int runServer(int argc, char* argv[], int mode);
+void initSession(struct otpSession* session);
+size_t maxReplyLength(const struct otpFrameHeader* header);
+int replyInPlace(const struct otpFrameHeader* header);
+int processFrame(int mode, struct otpSession* session, const struct otpFrameHeader* header, const char* payload, char* reply, uint32_t* replyLength);
+void serveConnection(int connectionFD, int mode);
+int admitConnection(int connectionFD);
+void acceptFailed(const struct otpListener* listener);
+void runEpollLoop(const struct otpListener* listeners, int listenerCount);
+void runUringLoop(const struct otpListener* listeners, int listenerCount);
+
+#endif
@@ -0,0 +1,218 @@
+/****************************************************************
+* Author: Nicholas Schaffner
+* Last Modified: 10/17/26
+* Description: Shared memory slots behind the daemon metrics, and their Prometheus text rendering (see otp_stats.h).
+****************************************************************/
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "otp_proto.h"
+#include "otp_stats.h"
+
+static struct otpStatsSlot unsharedSlot = {.owner = -1};                        /* Counts of a process that has not attached, never read */
+static struct otpStatsSlot* slots = NULL;                                       /* OTP_STATS_SLOTS slots shared by every process of the daemon */
+
+struct otpStatsSlot* otpStatsLocal = &unsharedSlot;
+volatile sig_atomic_t otpStatsDumpRequested = 0;
+
+static const char* phaseNames[OTP_PHASES] = {"recv", "transform", "send"};
+static const char* errorNames[OTP_STATS_ERRORS] = {"malformed", "bad_input", "key_range", "pad", "ledger", "io"};
+
+static void requestDump(int signalNumber){
+    (void)signalNumber;
+    otpStatsDumpRequested = 1;
+}
+
+void otpStatsInit(void){                                                        /* Call before forking, so every process shares the slots */
+    struct sigaction action;
+
+    slots = mmap(NULL, OTP_STATS_SLOTS * sizeof(struct otpStatsSlot), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(slots == MAP_FAILED){
+        perror("ERROR mapping metrics");
+        exit(1);
+    }
+
+    /* No SA_RESTART, so a loop blocked in accept, waitpid or epoll_wait wakes up and prints the dump */
+    memset(&action, '\0', sizeof(action));
+    action.sa_handler = requestDump;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGUSR1, &action, NULL);
+}
+
+static int ownerAlive(int owner){
+    return owner != 0 && (kill(owner, 0) == 0 || errno != ESRCH);
+}
+
+void otpStatsAttach(void){                                                      /* Claim a slot for this process, once */
+    int pid = getpid();
+    int owner, i;
+
+    if(slots == NULL || otpStatsLocal->owner == pid){
+        return;
+    }
+
+    for(i = 1; i < OTP_STATS_SLOTS; i++){                                       /* A slot whose owner died keeps its counts and is reused */
+        owner = __atomic_load_n(&slots[i].owner, __ATOMIC_ACQUIRE);
+        if(!ownerAlive(owner) && __atomic_compare_exchange_n(&slots[i].owner, &owner, pid, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+            __atomic_store_n(&slots[i].open, 0, __ATOMIC_SEQ_CST);             /* Whatever a dead owner left open was closed by the kernel */
+            otpStatsLocal = &slots[i];
+            return;
+        }
+    }
+    otpStatsLocal = &slots[0];
+}
+
+/* Called by the process that reaped pid: the connections it held are gone, and so is its claim on the slot */
+void otpStatsReclaim(int pid){
+    int owner = pid;
+    int i;
+
+    for(i = 1; slots != NULL && i < OTP_STATS_SLOTS; i++){
+        if(__atomic_load_n(&slots[i].owner, __ATOMIC_ACQUIRE) == pid){
+            __atomic_store_n(&slots[i].open, 0, __ATOMIC_SEQ_CST);
+            __atomic_compare_exchange_n(&slots[i].owner, &owner, 0, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+            return;
+        }
+    }
+}
+
+void otpStatsDetach(void){                                                      /* Give the slot back before exiting */
+    if(slots != NULL && otpStatsLocal != &slots[0] && otpStatsLocal != &unsharedSlot){
+        __atomic_store_n(&otpStatsLocal->owner, 0, __ATOMIC_RELEASE);
+    }
+    otpStatsLocal = &unsharedSlot;
+}
+
+uint64_t otpStatsNow(void){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+void otpStatsObserve(int phase, uint64_t elapsedNs){                           /* Add one observation to a phase histogram */
+    uint64_t micros = (elapsedNs + 999) / 1000;
+    int bucket = micros <= 1 ? 0 : 64 - __builtin_clzll(micros - 1);            /* Smallest k with micros <= 2^k */
+
+    if(bucket > OTP_STATS_BUCKETS - 1){
+        bucket = OTP_STATS_BUCKETS - 1;
+    }
+    otpStatsCount(&otpStatsLocal->phaseBuckets[phase][bucket], 1);
+    otpStatsCount(&otpStatsLocal->phaseNs[phase], elapsedNs);
+}
+
+/* Sum every slot and write the result to out in the Prometheus text format. Returns the number of characters written,
+ * the text is cut short rather than overflow capacity */
+size_t otpStatsFormat(char* out, size_t capacity){
+    struct otpStatsSlot total;
+    uint64_t cumulative, count;
+    size_t length = 0;
+    int processes = 0;
+    int i, j, phase;
+
+#define EMIT(...) (length += snprintf(out + length, length < capacity ? capacity - length : 0, __VA_ARGS__))
+
+    memset(&total, '\0', sizeof(total));
+    for(i = 0; slots != NULL && i < OTP_STATS_SLOTS; i++){
+        const struct otpStatsSlot* slot = &slots[i];
+
+        processes += i > 0 && ownerAlive(__atomic_load_n(&slot->owner, __ATOMIC_RELAXED));
+        total.accepted += __atomic_load_n(&slot->accepted, __ATOMIC_RELAXED);
+        total.closed += __atomic_load_n(&slot->closed, __ATOMIC_RELAXED);
+        total.shed += __atomic_load_n(&slot->shed, __ATOMIC_RELAXED);
+        total.open += __atomic_load_n(&slot->open, __ATOMIC_RELAXED);
+        total.framesIn += __atomic_load_n(&slot->framesIn, __ATOMIC_RELAXED);
+        total.bytesIn += __atomic_load_n(&slot->bytesIn, __ATOMIC_RELAXED);
+        total.bytesOut += __atomic_load_n(&slot->bytesOut, __ATOMIC_RELAXED);
+        total.messages += __atomic_load_n(&slot->messages, __ATOMIC_RELAXED);
+        total.allocations += __atomic_load_n(&slot->allocations, __ATOMIC_RELAXED);
+        for(j = 0; j < OTP_STATS_ERRORS; j++){
+            total.errors[j] += __atomic_load_n(&slot->errors[j], __ATOMIC_RELAXED);
+        }
+        for(phase = 0; phase < OTP_PHASES; phase++){
+            for(j = 0; j < OTP_STATS_BUCKETS; j++){
+                total.phaseBuckets[phase][j] += __atomic_load_n(&slot->phaseBuckets[phase][j], __ATOMIC_RELAXED);
+            }
+            total.phaseNs[phase] += __atomic_load_n(&slot->phaseNs[phase], __ATOMIC_RELAXED);
+        }
+    }
+
+    EMIT("# HELP otp_connections_accepted_total Connections accepted.\n# TYPE otp_connections_accepted_total counter\notp_connections_accepted_total %llu\n", (unsigned long long)total.accepted);
+    EMIT("# HELP otp_connections_active Connections open right now.\n# TYPE otp_connections_active gauge\notp_connections_active %llu\n", (unsigned long long)total.open);
+    EMIT("# HELP otp_connections_shed_total Connections turned away because the daemon was full.\n# TYPE otp_connections_shed_total counter\notp_connections_shed_total %llu\n", (unsigned long long)total.shed);
+    EMIT("# HELP otp_processes_active Children, workers or event loops serving connections right now.\n# TYPE otp_processes_active gauge\notp_processes_active %d\n", processes);
+    EMIT("# HELP otp_frames_received_total Frames received.\n# TYPE otp_frames_received_total counter\notp_frames_received_total %llu\n", (unsigned long long)total.framesIn);
+    EMIT("# HELP otp_bytes_received_total Frame bytes received.\n# TYPE otp_bytes_received_total counter\notp_bytes_received_total %llu\n", (unsigned long long)total.bytesIn);
+    EMIT("# HELP otp_bytes_sent_total Frame bytes sent.\n# TYPE otp_bytes_sent_total counter\notp_bytes_sent_total %llu\n", (unsigned long long)total.bytesOut);
+    EMIT("# HELP otp_messages_total Messages completed.\n# TYPE otp_messages_total counter\notp_messages_total %llu\n", (unsigned long long)total.messages);
+    EMIT("# HELP otp_allocations_total Heap allocations made while serving connections.\n# TYPE otp_allocations_total counter\notp_allocations_total %llu\n", (unsigned long long)total.allocations);
+
+    EMIT("# HELP otp_errors_total Rejected requests and failed sends by type.\n# TYPE otp_errors_total counter\n");
+    for(j = 0; j < OTP_STATS_ERRORS; j++){
+        EMIT("otp_errors_total{type=\"%s\"} %llu\n", errorNames[j], (unsigned long long)total.errors[j]);
+    }
+
+    EMIT("# HELP otp_phase_seconds Time spent per frame in each phase.\n# TYPE otp_phase_seconds histogram\n");
+    for(phase = 0; phase < OTP_PHASES; phase++){
+        cumulative = 0;
+        for(j = 0; j < OTP_STATS_BUCKETS - 1; j++){
+            cumulative += total.phaseBuckets[phase][j];
+            EMIT("otp_phase_seconds_bucket{phase=\"%s\",le=\"%g\"} %llu\n", phaseNames[phase], (double)(1ull << j) / 1e6, (unsigned long long)cumulative);
+        }
+        count = cumulative + total.phaseBuckets[phase][OTP_STATS_BUCKETS - 1];
+        EMIT("otp_phase_seconds_bucket{phase=\"%s\",le=\"+Inf\"} %llu\n", phaseNames[phase], (unsigned long long)count);
+        EMIT("otp_phase_seconds_sum{phase=\"%s\"} %.9f\n", phaseNames[phase], total.phaseNs[phase] / 1e9);
+        EMIT("otp_phase_seconds_count{phase=\"%s\"} %llu\n", phaseNames[phase], (unsigned long long)count);
+    }
+
+#undef EMIT
+
+    return length < capacity ? length : capacity - 1;
+}
+
+uint64_t otpStatsOpenConnections(void){                                        /* Connections open in every process of the daemon */
+    uint64_t open = 0;
+    int i;
+
+    for(i = 0; slots != NULL && i < OTP_STATS_SLOTS; i++){
+        open += __atomic_load_n(&slots[i].open, __ATOMIC_SEQ_CST);
+    }
+    return open;
+}
+
+/* Count one more open connection for this process, unless the daemon then holds more than limit (0 for no limit).
+ * The add comes before the sum and both are sequentially consistent, so of two processes reserving the last place at
+ * once at least one sees the other's add and backs off. Returns 1 when reserved, 0 when the daemon is full */
+int otpStatsReserveConnection(uint64_t limit){
+    __atomic_fetch_add(&otpStatsLocal->open, 1, __ATOMIC_SEQ_CST);
+    if(limit > 0 && otpStatsOpenConnections() > limit){
+        __atomic_fetch_sub(&otpStatsLocal->open, 1, __ATOMIC_SEQ_CST);
+        return 0;
+    }
+    return 1;
+}
+
+void otpStatsReleaseConnection(void){                                          /* A reserved connection was closed */
+    __atomic_fetch_sub(&otpStatsLocal->open, 1, __ATOMIC_SEQ_CST);
+}
+
+void otpStatsDumpIfRequested(void){                                            /* Print the metrics to stderr if SIGUSR1 arrived */
+    static char text[OTP_STATS_MAX_SIZE];
+    size_t length;
+
+    if(!otpStatsDumpRequested){
+        return;
+    }
+    otpStatsDumpRequested = 0;
+    length = otpStatsFormat(text, sizeof(text));
+    if(write(STDERR_FILENO, text, length) < 0){                                 /* Nowhere left to report it */
+        return;
+    }
+}
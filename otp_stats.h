@@ -0,0 +1,85 @@
+/****************************************************************
+* Author: Nicholas Schaffner
+* Last Modified: 10/17/26
+* Description: Live metrics of otp_enc_d, otp_dec_d and otp_d. The counters live in one shared memory region that is created
+*               before the daemon forks, split into OTP_STATS_SLOTS cache-line aligned slots. Every process that
+*               serves connections (a forked child, a worker or an event loop) claims a slot of its own and is the only
+*               writer of it, so counting is a plain add with no lock and no shared cache line. Slots are only summed
+*               when the metrics are read, by a STATS request (see otp_proto.h) or by SIGUSR1, which prints them to
+*               stderr. Both use the Prometheus text format. Processes beyond the last slot share slot 0 with atomic
+*               adds. Each slot also holds the number of connections its process has open, which --max-connections
+*               admission and the otp_connections_active gauge sum. A process reserves its place with an atomic add
+*               before it sums (see otpStatsReserveConnection), so processes admitting at the same time cannot
+*               overshoot the limit together. The open connections of a process that dies without closing them are
+*               dropped when the supervisor reaps it or another process reclaims its slot; those of processes sharing
+*               slot 0 are not. Time spent per frame is kept as a histogram per phase:
+*                   recv        from the moment the daemon waits for a frame until the frame is complete; a frame
+*                               that had already arrived counts as 0, so this includes the client's think time
+*                   transform   processing the frame into its reply
+*                   send        handing the reply, or a batch of replies, to the socket
+****************************************************************/
+
+#ifndef OTP_STATS_H
+#define OTP_STATS_H
+
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define OTP_STATS_SLOTS 64                                                      /* Slot 0 is shared by the processes that find no free slot */
+#define OTP_STATS_BUCKETS 25                                                    /* Histogram bounds 1 us, 2 us ... 2^23 us (8.4 s), then +Inf */
+
+#define OTP_PHASE_RECV 0
+#define OTP_PHASE_TRANSFORM 1
+#define OTP_PHASE_SEND 2
+#define OTP_PHASES 3
+
+#define OTP_STATS_ERR_MALFORMED 0                                               /* Frames that break the protocol */
+#define OTP_STATS_ERR_BAD_INPUT 1                                               /* Text or key with characters outside the alphabet */
+#define OTP_STATS_ERR_KEY_RANGE 2                                               /* Pad message longer than the range it reserved */
+#define OTP_STATS_ERR_PAD 3                                                     /* Unknown pad, pad too short, range used, offset missing */
+#define OTP_STATS_ERR_LEDGER 4                                                  /* A pad ledger could not be written */
+#define OTP_STATS_ERR_IO 5                                                      /* A reply could not be sent */
+#define OTP_STATS_ERRORS 6
+
+struct otpStatsSlot{
+    int owner;                                                                  /* PID of the process writing this slot, 0 when free */
+    uint64_t accepted;                                                          /* Connections accepted */
+    uint64_t closed;                                                            /* Connections closed */
+    uint64_t shed;                                                              /* Connections turned away with the busy greeting */
+    uint64_t open;                                                              /* Connections admitted and not closed yet, always updated atomically */
+    uint64_t framesIn;
+    uint64_t bytesIn;                                                           /* Frame headers and payloads received */
+    uint64_t bytesOut;                                                          /* Frame headers and payloads sent, the handshake excluded */
+    uint64_t messages;                                                          /* END frames answered */
+    uint64_t allocations;                                                       /* Heap allocations made while serving, see otp_arena.h */
+    uint64_t errors[OTP_STATS_ERRORS];
+    uint64_t phaseBuckets[OTP_PHASES][OTP_STATS_BUCKETS];
+    uint64_t phaseNs[OTP_PHASES];                                               /* Sum of the observed times */
+} __attribute__((aligned(64)));
+
+extern struct otpStatsSlot* otpStatsLocal;                                      /* Slot of this process */
+extern volatile sig_atomic_t otpStatsDumpRequested;                             /* Set by SIGUSR1 */
+
+void otpStatsInit(void);
+void otpStatsAttach(void);
+void otpStatsDetach(void);
+uint64_t otpStatsNow(void);
+void otpStatsObserve(int phase, uint64_t elapsedNs);
+size_t otpStatsFormat(char* out, size_t capacity);
+void otpStatsDumpIfRequested(void);
+uint64_t otpStatsOpenConnections(void);
+int otpStatsReserveConnection(uint64_t limit);
+void otpStatsReleaseConnection(void);
+void otpStatsReclaim(int pid);
+
+static inline void otpStatsCount(uint64_t* counter, uint64_t amount){          /* Add amount to a counter of otpStatsLocal */
+    if(otpStatsLocal->owner == 0){                                              /* The shared slot has several writers */
+        __atomic_fetch_add(counter, amount, __ATOMIC_RELAXED);
+    }
+    else{                                                                       /* Single writer: no lock prefix, readers never see a torn value */
+        __atomic_store_n(counter, *counter + amount, __ATOMIC_RELAXED);
+    }
+}
+
+#endif
@@ -0,0 +1,622 @@
+/****************************************************************
+* Author: Nicholas Schaffner
+* Last Modified: 10/17/26
+* Description: io_uring event loop engine for otp_enc_d, otp_dec_d and otp_d (--engine uring). It drives the kernel
+*               interface with raw syscalls, so it needs no library beyond the kernel headers. One multishot accept per
+*               listening socket keeps taking new connections without being resubmitted. Every connection has at most one send and one receive in
+*               flight: when a receive completes, every complete frame in the buffer is transformed by processFrame()
+*               straight into the send buffer, and the batch of replies is submitted as a send linked to the next
+*               receive, so both go to the kernel in the same io_uring_enter that also collects the next completions.
+*               The first OTP_URING_FIXED_SLOTS connections use buffers registered with the ring once at startup,
+*               which saves the kernel from mapping the pages on every operation; later connections take theirs from the
+*               arena (otp_arena.h), and only while they have bytes in them, as under epoll: a connection with nothing
+*               received waits with a poll instead of a receive, borrows a receive buffer once the poll completes and
+*               gives it back when its frames are drained, and takes a send buffer only while a batch of replies is
+*               being sent. An idle connection then holds no buffer at all. Closed connections are kept for reuse, so
+*               once the loop has seen its peak load it makes no allocations.
+*               On a kernel without io_uring (or with it disabled) the daemon falls back to the epoll engine.
+****************************************************************/
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include "otp_arena.h"
+#include "otp_codec.h"
+#include "otp_proto.h"
+#include "otp_server.h"
+#include "otp_stats.h"
+
+#define OTP_URING_ENTRIES 256                                                   /* Submission queue size, the completion queue is twice as large */
+#define OTP_URING_FIXED_SLOTS 16                                                /* Connections that get registered buffers */
+#define OTP_URING_RECV_SIZE OTP_ARENA_BUFFER_SIZE                               /* Receive buffer of a connection, always holds a full frame */
+#define OTP_URING_SEND_SIZE OTP_ARENA_BUFFER_SIZE                               /* Most reply bytes batched into one send */
+#define OTP_URING_LARGEST_REPLY (OTP_FRAME_HEADER_SIZE + 2 * OTP_CHUNK_SIZE)    /* Largest frame processFrame can answer with */
+
+/* The user_data of an accept is the index of its listener, which no connection address can equal */
+#define OTP_URING_OP_RECV 1                                                     /* Low bits of a connection's user_data say which operation completed */
+#define OTP_URING_OP_SEND 2
+#define OTP_URING_OP_POLL 3                                                     /* An arena connection without a receive buffer waits for data */
+#define OTP_URING_OP_MASK 3
+
+struct otpRing{                                                                 /* The mapped submission and completion queues */
+    int ringFD;
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned* sqMask;
+    unsigned* sqArray;
+    unsigned sqEntries;
+    struct io_uring_sqe* sqes;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned* cqMask;
+    struct io_uring_cqe* cqes;
+    unsigned unsubmitted;                                                       /* SQEs filled in since the last io_uring_enter */
+};
+
+struct otpUringConnection{
+    int connectionFD;
+    int mode;                                                                   /* Mode of the listener that accepted it */
+    int slot;                                                                   /* Registered buffer pair in use, -1 for arena buffers */
+    struct otpRecvBuffer recvBuffer;                                            /* Frames received from the client */
+    char* sendBuffer;                                                           /* Handshake or batch of replies waiting to be sent, NULL between batches of an arena connection */
+    size_t sendCapacity;
+    size_t sendLength;                                                          /* Number of bytes in sendBuffer */
+    size_t sendOffset;                                                          /* Number of bytes of sendBuffer already sent */
+    char handshake[OTP_HANDSHAKE_SIZE];                                         /* Send buffer of an arena connection's handshake, so it borrows nothing */
+    int recvPending;                                                            /* A receive or poll has been submitted and has not completed yet */
+    int sendPending;
+    int closing;                                                                /* Closed once the operations in flight have completed */
+    int closeAfterSend;                                                         /* Set once a frame that could not be parsed has been answered */
+    struct otpSession session;                                                  /* Key pad range and failed request of the current message */
+    uint64_t recvStartNs;                                                       /* When the connection began waiting for the next frame, 0 if it is not */
+    uint64_t sendStartNs;                                                       /* When the pending batch was queued, 0 for the handshake */
+    struct otpUringConnection* next;                                            /* Next closed connection kept for reuse */
+};
+
+struct otpUringServer{
+    struct otpRing ring;
+    const struct otpListener* listeners;
+    int listenerCount;
+    int multishotAccept;                                                        /* Cleared when the kernel is too old for multishot accept */
+    char* arena;                                                                /* Registered buffers, OTP_URING_FIXED_SLOTS pairs of receive and send buffer */
+    int freeSlots[OTP_URING_FIXED_SLOTS];
+    int freeSlotCount;
+    struct otpUringConnection* idleConnections;                                 /* Closed connections, reused before allocating new ones */
+};
+
+static int ringSetup(unsigned entries, struct io_uring_params* params){
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int ringEnter(int ringFD, unsigned toSubmit, unsigned minComplete, unsigned flags){
+    return syscall(__NR_io_uring_enter, ringFD, toSubmit, minComplete, flags, NULL, 0);
+}
+
+static int ringRegister(int ringFD, unsigned opcode, void* arg, unsigned count){
+    return syscall(__NR_io_uring_register, ringFD, opcode, arg, count);
+}
+
+static int openRing(struct otpRing* ring){                                      /* Create the ring and map its queues. Returns -1 with errno set on failure */
+    struct io_uring_params params;
+    size_t sqSize, cqSize;
+    char* sq;
+    char* cq;
+
+    /* Completions are only ever reaped by this thread inside io_uring_enter, which lets the kernel defer its work until then */
+    memset(&params, '\0', sizeof(params));
+    params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    ring->ringFD = ringSetup(OTP_URING_ENTRIES, &params);
+    if(ring->ringFD < 0 && errno == EINVAL){                                    /* Kernel older than 6.1 */
+        memset(&params, '\0', sizeof(params));
+        ring->ringFD = ringSetup(OTP_URING_ENTRIES, &params);
+    }
+    if(ring->ringFD < 0){
+        return -1;
+    }
+
+    sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP){                              /* Both queues live in one mapping */
+        sqSize = cqSize = sqSize > cqSize ? sqSize : cqSize;
+    }
+
+    sq = mmap(NULL, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ringFD, IORING_OFF_SQ_RING);
+    if(sq == MAP_FAILED){
+        close(ring->ringFD);
+        return -1;
+    }
+    cq = sq;
+    if(!(params.features & IORING_FEAT_SINGLE_MMAP)){
+        cq = mmap(NULL, cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ringFD, IORING_OFF_CQ_RING);
+        if(cq == MAP_FAILED){
+            close(ring->ringFD);
+            return -1;
+        }
+    }
+    ring->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ringFD, IORING_OFF_SQES);
+    if(ring->sqes == MAP_FAILED){
+        close(ring->ringFD);
+        return -1;
+    }
+
+    ring->sqHead = (unsigned*)(sq + params.sq_off.head);
+    ring->sqTail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned*)(sq + params.sq_off.array);
+    ring->sqEntries = params.sq_entries;
+    ring->cqHead = (unsigned*)(cq + params.cq_off.head);
+    ring->cqTail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    ring->unsubmitted = 0;
+
+    return 0;
+}
+
+static void submitAndWait(struct otpRing* ring, unsigned minComplete){         /* Hand the filled SQEs to the kernel and wait for minComplete completions */
+    int submitted;
+
+    while(1){
+        submitted = ringEnter(ring->ringFD, ring->unsubmitted, minComplete, IORING_ENTER_GETEVENTS);
+        if(submitted >= 0){
+            ring->unsubmitted -= submitted;
+            return;
+        }
+        if(errno == EBUSY || errno == EAGAIN){                                  /* The completion queue is full, the caller reaps it first */
+            return;
+        }
+        if(errno != EINTR){
+            perror("ERROR entering io_uring");
+            exit(1);
+        }
+        otpStatsDumpIfRequested();                                              /* SIGUSR1 asked for the metrics */
+    }
+}
+
+static struct io_uring_sqe* nextSqe(struct otpRing* ring){                      /* Next free submission entry, cleared */
+    unsigned tail = *ring->sqTail;
+    unsigned index;
+    struct io_uring_sqe* sqe;
+
+    while(tail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE) == ring->sqEntries){   /* Full, let the kernel consume some */
+        submitAndWait(ring, 0);
+    }
+
+    index = tail & *ring->sqMask;
+    sqe = &ring->sqes[index];
+    memset(sqe, '\0', sizeof(*sqe));
+    ring->sqArray[index] = index;
+    __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+    ring->unsubmitted++;
+
+    return sqe;
+}
+
+static void armAccept(struct otpUringServer* server, int listener){
+    struct io_uring_sqe* sqe = nextSqe(&server->ring);
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = server->listeners[listener].socketFD;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->ioprio = server->multishotAccept ? IORING_ACCEPT_MULTISHOT : 0;        /* One multishot accept completes once per connection */
+    sqe->user_data = listener;
+}
+
+static void queueRecv(struct otpUringServer* server, struct otpUringConnection* connection){
+    struct otpRecvBuffer* buffer = &connection->recvBuffer;
+    struct io_uring_sqe* sqe;
+
+    if(connection->recvStartNs == 0){                                           /* Waiting for a frame starts now */
+        connection->recvStartNs = otpStatsNow();
+    }
+    if(connection->slot < 0 && buffer->start == buffer->end){                  /* Drained, lend the buffer to a busier connection until data arrives */
+        otpArenaDetach(buffer);
+        sqe = nextSqe(&server->ring);
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = connection->connectionFD;
+        sqe->poll32_events = POLLIN;
+        sqe->user_data = (uintptr_t)connection | OTP_URING_OP_POLL;
+        connection->recvPending = 1;
+        return;
+    }
+
+    if(buffer->end == buffer->capacity){                                        /* Make room after the unconsumed bytes */
+        recvBufferReserve(buffer, buffer->end - buffer->start);
+    }
+
+    sqe = nextSqe(&server->ring);
+    sqe->fd = connection->connectionFD;
+    sqe->addr = (uintptr_t)(buffer->data + buffer->end);
+    sqe->len = buffer->capacity - buffer->end;
+    if(connection->slot >= 0){
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->buf_index = connection->slot;
+    }
+    else{
+        sqe->opcode = IORING_OP_RECV;
+    }
+    sqe->user_data = (uintptr_t)connection | OTP_URING_OP_RECV;
+    connection->recvPending = 1;
+}
+
+static void queueSend(struct otpUringServer* server, struct otpUringConnection* connection, int linkRecv){
+    struct io_uring_sqe* sqe = nextSqe(&server->ring);
+
+    sqe->fd = connection->connectionFD;
+    sqe->addr = (uintptr_t)(connection->sendBuffer + connection->sendOffset);
+    sqe->len = connection->sendLength - connection->sendOffset;
+    if(connection->slot >= 0){
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->buf_index = connection->slot;
+    }
+    else{
+        sqe->opcode = IORING_OP_SEND;
+        sqe->msg_flags = MSG_NOSIGNAL;
+    }
+    sqe->user_data = (uintptr_t)connection | OTP_URING_OP_SEND;
+    connection->sendPending = 1;
+
+    if(linkRecv){                                                               /* The receive starts once the whole batch has been sent, and is cancelled if it was not */
+        sqe->flags = IOSQE_IO_LINK;
+        queueRecv(server, connection);
+    }
+}
+
+static void releaseSend(struct otpUringConnection* connection){               /* Lend an arena connection's send buffer to a busier connection */
+    if(connection->sendBuffer != connection->handshake){
+        otpArenaGive(connection->sendBuffer);
+    }
+    connection->sendBuffer = NULL;
+}
+
+static void freeConnection(struct otpUringServer* server, struct otpUringConnection* connection){
+    otpStatsCount(&otpStatsLocal->closed, 1);
+    close(connection->connectionFD);
+    otpStatsReleaseConnection();
+    if(connection->slot >= 0){
+        server->freeSlots[server->freeSlotCount++] = connection->slot;
+    }
+    else{
+        otpArenaDetach(&connection->recvBuffer);
+        releaseSend(connection);
+    }
+    connection->next = server->idleConnections;
+    server->idleConnections = connection;
+}
+
+static void closeConnection(struct otpUringServer* server, struct otpUringConnection* connection){
+    if(connection->recvPending || connection->sendPending){                     /* Make the operations in flight complete, the last one frees the connection */
+        connection->closing = 1;
+        shutdown(connection->connectionFD, SHUT_RDWR);
+        return;
+    }
+    freeConnection(server, connection);
+}
+
+/* The poll of an arena connection completed: borrow a receive buffer and take what arrived without blocking.
+ * Returns -1 when the connection was closed */
+static int readAfterPoll(struct otpUringServer* server, struct otpUringConnection* connection){
+    struct otpRecvBuffer* buffer = &connection->recvBuffer;
+    ssize_t count;
+
+    if(otpArenaAttach(buffer) != OTP_OK){
+        closeConnection(server, connection);
+        return -1;
+    }
+    count = recv(connection->connectionFD, buffer->data + buffer->end, buffer->capacity - buffer->end, MSG_DONTWAIT);
+    if(count > 0){
+        buffer->end += count;
+    }
+    else if(count == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)){    /* Client went away */
+        closeConnection(server, connection);
+        return -1;
+    }
+    return 0;
+}
+
+static char* reserveSend(struct otpUringConnection* connection, size_t length){  /* Room for length more bytes after the batched replies */
+    if(connection->sendBuffer == NULL){                                         /* First reply of a batch on an arena connection */
+        connection->sendBuffer = otpArenaTake();
+        if(connection->sendBuffer == NULL){
+            return NULL;
+        }
+        connection->sendCapacity = OTP_URING_SEND_SIZE;
+    }
+    if(connection->sendLength + length > connection->sendCapacity){             /* Cannot happen, batchReplies stops while a batch still has room for any reply */
+        return NULL;
+    }
+    return connection->sendBuffer + connection->sendLength;
+}
+
+static void batchProtocolError(struct otpUringConnection* connection){
+    const char* msg = "malformed frame";
+    char* frame = reserveSend(connection, OTP_FRAME_HEADER_SIZE + strlen(msg));
+
+    connection->closeAfterSend = 1;
+    otpStatsCount(&otpStatsLocal->errors[OTP_STATS_ERR_MALFORMED], 1);
+    if(frame == NULL){
+        return;
+    }
+    encodeFrameHeader(frame, OTP_FRAME_ERROR, 0, strlen(msg));
+    memcpy(frame + OTP_FRAME_HEADER_SIZE, msg, strlen(msg));
+    connection->sendLength += OTP_FRAME_HEADER_SIZE + strlen(msg);
+}
+
+/* Transform every complete frame in the receive buffer into the send buffer, as long as the batch has room for
+ * another reply. Returns OTP_AGAIN when the buffer ran out of frames, OTP_OK when the batch filled up first, and
+ * OTP_ERR_IO when out of memory */
+static int batchReplies(struct otpUringConnection* connection){
+    struct otpFrameHeader header;
+    char* payload;
+    char* frame;
+    uint32_t replyLength;
+    int replyType, status;
+
+    if(connection->recvBuffer.data == NULL){                                   /* No buffer, nothing received yet */
+        return OTP_AGAIN;
+    }
+    while(connection->sendLength == 0 || connection->sendLength + OTP_URING_LARGEST_REPLY <= OTP_URING_SEND_SIZE){
+        status = recvBufferNextFrame(&connection->recvBuffer, 2 * OTP_CHUNK_SIZE, &header, &payload);
+        if(status == OTP_AGAIN){
+            return OTP_AGAIN;
+        }
+        if(status != OTP_OK){
+            batchProtocolError(connection);
+            return OTP_OK;
+        }
+
+        otpStatsObserve(OTP_PHASE_RECV, connection->recvStartNs != 0 ? otpStatsNow() - connection->recvStartNs : 0);
+        connection->recvStartNs = 0;                                            /* The frames after the first had already arrived */
+
+        frame = reserveSend(connection, OTP_FRAME_HEADER_SIZE + maxReplyLength(&header));
+        if(frame == NULL){
+            return OTP_ERR_IO;
+        }
+
+        /* Transform straight into the send buffer, right after the space for the header */
+        replyType = processFrame(connection->mode, &connection->session, &header, payload, frame + OTP_FRAME_HEADER_SIZE, &replyLength);
+        if(replyType == OTP_NO_REPLY){                                          /* Part of a request that was already rejected */
+            continue;
+        }
+        encodeFrameHeader(frame, replyType, header.requestId, replyLength);
+        connection->sendLength += OTP_FRAME_HEADER_SIZE + replyLength;
+    }
+
+    return OTP_OK;
+}
+
+/* Decide the next operations of a connection once nothing is in flight: finish a partial send, or answer the frames
+ * received so far and receive more */
+static void driveConnection(struct otpUringServer* server, struct otpUringConnection* connection){
+    int status;
+
+    if(connection->recvPending || connection->sendPending){
+        return;
+    }
+    if(connection->closing){
+        freeConnection(server, connection);
+        return;
+    }
+
+    if(connection->sendOffset < connection->sendLength){                        /* The handshake, or the rest of a batch the socket took only part of */
+        queueSend(server, connection, 0);
+        return;
+    }
+    connection->sendLength = 0;
+    connection->sendOffset = 0;
+    if(connection->slot < 0){                                                   /* Nothing to send, lend the buffer to a busier connection meanwhile */
+        releaseSend(connection);
+    }
+
+    if(connection->closeAfterSend){
+        closeConnection(server, connection);
+        return;
+    }
+
+    status = batchReplies(connection);
+    if(status == OTP_ERR_IO){
+        closeConnection(server, connection);
+        return;
+    }
+    if(connection->sendLength > 0){
+        connection->sendStartNs = otpStatsNow();
+    }
+    if(connection->closeAfterSend){
+        queueSend(server, connection, 0);
+    }
+    else if(connection->sendLength > 0){                                        /* Out of frames: receive the next ones as soon as the replies are out */
+        queueSend(server, connection, status == OTP_AGAIN);
+    }
+    else{
+        queueRecv(server, connection);
+    }
+}
+
+static struct otpUringConnection* newConnection(struct otpUringServer* server){    /* A cleared connection, NULL when out of memory */
+    struct otpUringConnection* connection = server->idleConnections;
+
+    if(connection != NULL){
+        server->idleConnections = connection->next;
+    }
+    else{
+        connection = otpArenaAlloc(sizeof(*connection));
+        if(connection == NULL){
+            return NULL;
+        }
+    }
+    memset(connection, '\0', sizeof(*connection));
+    return connection;
+}
+
+static void acceptConnection(struct otpUringServer* server, int connectionFD, int mode){
+    struct otpUringConnection* connection = newConnection(server);
+
+    if(connection == NULL){
+        close(connectionFD);
+        otpStatsReleaseConnection();
+        return;
+    }
+    connection->connectionFD = connectionFD;
+    connection->mode = mode;
+    initSession(&connection->session);
+    otpStatsCount(&otpStatsLocal->accepted, 1);
+    if(server->freeSlotCount > 0){                                              /* Use a registered buffer pair */
+        char* pair;
+
+        connection->slot = server->freeSlots[--server->freeSlotCount];
+        pair = server->arena + (size_t)connection->slot * (OTP_URING_RECV_SIZE + OTP_URING_SEND_SIZE);
+        connection->recvBuffer.data = pair;
+        connection->recvBuffer.capacity = OTP_URING_RECV_SIZE;                  /* Never grows, a full frame always fits */
+        connection->sendBuffer = pair + OTP_URING_RECV_SIZE;
+        connection->sendCapacity = OTP_URING_SEND_SIZE;
+    }
+    else{                                                                       /* Buffers are only borrowed once there are frames to receive or replies to send */
+        connection->slot = -1;
+        connection->sendBuffer = connection->handshake;
+        connection->sendCapacity = OTP_HANDSHAKE_SIZE;
+    }
+
+    /* Queue the handshake that verifies to the client that it is connected to the correct daemon */
+    memcpy(connection->sendBuffer, otpHandshake(connection->mode), OTP_HANDSHAKE_SIZE);
+    connection->sendLength = OTP_HANDSHAKE_SIZE;
+    queueSend(server, connection, 1);
+}
+
+static void registerBuffers(struct otpUringServer* server){                    /* Without registered buffers every connection simply uses heap buffers */
+    struct iovec slots[OTP_URING_FIXED_SLOTS];
+    size_t slotSize = OTP_URING_RECV_SIZE + OTP_URING_SEND_SIZE;
+    int i;
+
+    server->freeSlotCount = 0;
+    server->arena = mmap(NULL, slotSize * OTP_URING_FIXED_SLOTS, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(server->arena == MAP_FAILED){
+        return;
+    }
+
+    for(i = 0; i < OTP_URING_FIXED_SLOTS; i++){
+        slots[i].iov_base = server->arena + i * slotSize;
+        slots[i].iov_len = slotSize;
+    }
+    if(ringRegister(server->ring.ringFD, IORING_REGISTER_BUFFERS, slots, OTP_URING_FIXED_SLOTS) < 0){    /* Usually RLIMIT_MEMLOCK */
+        munmap(server->arena, slotSize * OTP_URING_FIXED_SLOTS);
+        return;
+    }
+
+    for(i = 0; i < OTP_URING_FIXED_SLOTS; i++){
+        server->freeSlots[server->freeSlotCount++] = OTP_URING_FIXED_SLOTS - 1 - i;
+    }
+}
+
+static void handleCompletion(struct otpUringServer* server, const struct io_uring_cqe* cqe){
+    struct otpUringConnection* connection;
+    int result = cqe->res;
+
+    if(cqe->user_data < (uint64_t)server->listenerCount){
+        if(result >= 0){
+            if(admitConnection(result)){                                        /* Otherwise shed, the daemon already serves --max-connections */
+                acceptConnection(server, result, server->listeners[cqe->user_data].mode);
+            }
+        }
+        else if(result == -EINVAL && server->multishotAccept){                  /* Kernel older than 5.19, accept one connection per submission */
+            server->multishotAccept = 0;
+        }
+        else{                                                                   /* A failed accept only affects that one client, keep serving */
+            errno = -result;
+            acceptFailed(&server->listeners[cqe->user_data]);
+        }
+        if(!(cqe->flags & IORING_CQE_F_MORE)){                                  /* The accept is no longer armed */
+            armAccept(server, cqe->user_data);
+        }
+        return;
+    }
+
+    connection = (struct otpUringConnection*)(uintptr_t)(cqe->user_data & ~(uint64_t)OTP_URING_OP_MASK);
+    if((cqe->user_data & OTP_URING_OP_MASK) == OTP_URING_OP_POLL){
+        connection->recvPending = 0;
+        if(result > 0 && !connection->closing){
+            if(readAfterPoll(server, connection) < 0){
+                return;
+            }
+        }
+        else if(!connection->closing && result != -ECANCELED && result != -EINTR){    /* A cancelled poll is re-armed after its send */
+            closeConnection(server, connection);
+            return;
+        }
+    }
+    else if((cqe->user_data & OTP_URING_OP_MASK) == OTP_URING_OP_RECV){
+        connection->recvPending = 0;
+        if(result > 0){
+            connection->recvBuffer.end += result;
+        }
+        else if(!connection->closing && result != -ECANCELED && result != -EINTR && result != -EAGAIN){    /* Client went away. A cancelled receive is re-armed after its send */
+            closeConnection(server, connection);
+            return;
+        }
+    }
+    else{
+        connection->sendPending = 0;
+        if(result >= 0){
+            connection->sendOffset += result;
+            if(connection->sendOffset == connection->sendLength && connection->sendStartNs != 0){    /* The whole batch is out */
+                otpStatsObserve(OTP_PHASE_SEND, otpStatsNow() - connection->sendStartNs);
+                connection->sendStartNs = 0;
+                connection->recvStartNs = otpStatsNow();                        /* The linked receive only started now */
+            }
+        }
+        else if(!connection->closing && result != -EINTR && result != -EAGAIN){
+            otpStatsCount(&otpStatsLocal->errors[OTP_STATS_ERR_IO], 1);
+            closeConnection(server, connection);
+            return;
+        }
+    }
+
+    driveConnection(server, connection);
+}
+
+void runUringLoop(const struct otpListener* listeners, int listenerCount){
+    struct otpUringServer server;
+    unsigned head, tail;
+    int i;
+
+    memset(&server, '\0', sizeof(server));
+    otpStatsAttach();
+    if(openRing(&server.ring) < 0){                                             /* No io_uring in this kernel, or it is disabled */
+        fprintf(stderr, "io_uring is not available (%s), using the epoll engine\n", strerror(errno));
+        runEpollLoop(listeners, listenerCount);
+        return;
+    }
+
+    signal(SIGPIPE, SIG_IGN);                                                   /* A write to a socket the client closed must fail, not kill the daemon */
+    server.listeners = listeners;
+    server.listenerCount = listenerCount;
+    server.multishotAccept = 1;
+    registerBuffers(&server);
+
+    for(i = 0; i < listenerCount; i++){
+        armAccept(&server, i);
+    }
+
+    while(1){
+        submitAndWait(&server.ring, 1);                                         /* The only syscall of the loop: submit everything queued and wait for work */
+
+        head = *server.ring.cqHead;
+        tail = __atomic_load_n(server.ring.cqTail, __ATOMIC_ACQUIRE);
+        while(head != tail){
+            handleCompletion(&server, &server.ring.cqes[head & *server.ring.cqMask]);
+            head++;
+            __atomic_store_n(server.ring.cqHead, head, __ATOMIC_RELEASE);      /* Release the entry before handling the next, so the kernel can reuse it */
+            tail = __atomic_load_n(server.ring.cqTail, __ATOMIC_ACQUIRE);
+        }
+    }
+}